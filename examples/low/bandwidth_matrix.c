@@ -0,0 +1,87 @@
+#include <numa.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sicm_low.h"
+
+/* Read, write, copy and triad bandwidth of every device from the CPUs of
+ * every NUMA node, in GB/s. Rows are the nodes that run the kernels and
+ * columns the devices, tagged with their node and page size. Nodes without
+ * CPUs are left out.
+ *
+ *     bandwidth_matrix [size in MiB] [nt]
+ *
+ * With nt, the stores of the kernels bypass the caches.
+ */
+
+static const char *ops[] = {"read", "write", "copy", "triad"};
+
+int main(int argc, char *argv[]) {
+    size_t size = 512;
+    int flags = 0;
+
+    if (argc > 1) {
+        if (sscanf(argv[1], "%zu", &size) != 1) {
+            fprintf(stderr, "Bad size (MiB): %s\n", argv[1]);
+            return 1;
+        }
+    }
+
+    if (argc > 2) {
+        if (strcmp(argv[2], "nt") != 0) {
+            fprintf(stderr, "Unknown option: %s\n", argv[2]);
+            return 1;
+        }
+        flags = SICM_BW_NONTEMPORAL;
+    }
+
+    size *= 1024 * 1024;
+
+    sicm_device_list devs = sicm_init();
+    const int nodes = numa_max_node() + 1;
+    double *matrix = malloc(nodes * devs.count * sizeof(double));
+    if (!matrix) {
+        fprintf(stderr, "Could not allocate the matrix\n");
+        return 1;
+    }
+
+    struct bitmask *cpus = numa_allocate_cpumask();
+
+    printf("%zu MiB per measurement, %s kernels%s\n", size / (1024 * 1024), sicm_bandwidth_isa(),
+           (flags & SICM_BW_NONTEMPORAL) ? ", non-temporal stores" : "");
+
+    for(int op = SICM_BW_READ; op <= SICM_BW_TRIAD; op++) {
+        if (sicm_bandwidth_matrix(op, flags, size, matrix) != 0) {
+            fprintf(stderr, "Could not measure %s bandwidth\n", ops[op]);
+            return 1;
+        }
+
+        printf("\n%-8s", ops[op]);
+        for(unsigned int i = 0; i < devs.count; i++) {
+            char name[32];
+            snprintf(name, sizeof(name), "%s:%d/%dK", sicm_device_tag_str(devs.devices[i]->tag),
+                     sicm_numa_id(devs.devices[i]), sicm_device_page_size(devs.devices[i]));
+            printf(" %14s", name);
+        }
+        printf("\n");
+
+        for(int node = 0; node < nodes; node++) {
+            if ((numa_node_to_cpus(node, cpus) != 0) || !numa_bitmask_weight(cpus)) {
+                continue;
+            }
+
+            printf("node %-3d", node);
+            for(unsigned int i = 0; i < devs.count; i++) {
+                printf(" %14.2f", matrix[node * devs.count + i]);
+            }
+            printf("\n");
+        }
+    }
+
+    numa_free_cpumask(cpus);
+    free(matrix);
+    sicm_fini();
+
+    return 0;
+}
@@ -0,0 +1,93 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "nano.h"
+#include "sicm_low.h"
+
+/* Allocating and freeing many objects of the same size in an arena, one at
+ * a time against in batches. Prints nanoseconds per object for each size.
+ */
+
+static size_t alloc_scalar(sicm_arena arena, const size_t size, const size_t n, void **ptrs) {
+    size_t i;
+    for(i = 0; i < n; i++) {
+        ptrs[i] = sicm_arena_alloc(arena, size);
+        if (!ptrs[i]) {
+            break;
+        }
+    }
+    return i;
+}
+
+static void free_scalar(void **ptrs, const size_t n, const size_t size) {
+    for(size_t i = 0; i < n; i++) {
+        sicm_free(ptrs[i]);
+    }
+}
+
+static void free_batch(void **ptrs, const size_t n, const size_t size) {
+    sicm_free_batch(ptrs, n);
+}
+
+static double run(sicm_arena arena, const size_t size, const size_t n, const size_t rounds, void **ptrs,
+                  size_t (*ALLOC)(sicm_arena, const size_t, const size_t, void **),
+                  void (*FREE)(void **, const size_t, const size_t)) {
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for(size_t r = 0; r < rounds; r++) {
+        const size_t got = ALLOC(arena, size, n, ptrs);
+        if (got != n) {
+            fprintf(stderr, "Only allocated %zu of %zu objects of %zu bytes\n", got, n, size);
+        }
+        FREE(ptrs, got, size);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return nano(&start, &end) / (n * rounds);
+}
+
+int main(int argc, char *argv[]) {
+    static const size_t sizes[] = {16, 64, 256, 1024, 4096, 16384};
+    size_t n = 4096;
+    size_t rounds = 100;
+
+    if (argc > 1) {
+        if (sscanf(argv[1], "%zu", &n) != 1) {
+            fprintf(stderr, "Bad object count: %s\n", argv[1]);
+            return 1;
+        }
+    }
+
+    if (argc > 2) {
+        if (sscanf(argv[2], "%zu", &rounds) != 1) {
+            fprintf(stderr, "Bad round count: %s\n", argv[2]);
+            return 1;
+        }
+    }
+
+    sicm_device_list devs = sicm_init();
+    sicm_arena arena = sicm_arena_create(0, 0, &(sicm_device_list) { .count = 1, .devices = &devs.devices[0] });
+    if (!arena) {
+        fprintf(stderr, "Could not create an arena\n");
+        return 1;
+    }
+
+    void **ptrs = calloc(n, sizeof(void *));
+
+    printf("%8s %10s %10s %10s\n", "size", "scalar", "batch", "sized");
+    for(size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        /* warm up the arena's slabs and extents */
+        run(arena, sizes[i], n, 1, ptrs, alloc_scalar, free_scalar);
+
+        const double scalar = run(arena, sizes[i], n, rounds, ptrs, alloc_scalar, free_scalar);
+        const double batch = run(arena, sizes[i], n, rounds, ptrs, sicm_arena_alloc_batch, free_batch);
+        const double sized = run(arena, sizes[i], n, rounds, ptrs, sicm_arena_alloc_batch, sicm_free_batch_sized);
+        printf("%8zu %10.1f %10.1f %10.1f\n", sizes[i], scalar, batch, sized);
+    }
+
+    free(ptrs);
+    sicm_arena_destroy(arena);
+    sicm_fini();
+
+    return 0;
+}
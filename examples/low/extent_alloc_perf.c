@@ -0,0 +1,138 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "nano.h"
+#include "sicm_low.h"
+
+/* Latency and throughput of allocations that need new extents, with threads
+ * allocating concurrently from the same arena. The allocations are large
+ * and never freed while the threads run, so jemalloc keeps having to ask
+ * the arena's extent hooks for more memory.
+ */
+
+struct ThreadArgs {
+    sicm_arena arena;
+    size_t count;
+    size_t size;
+    void **ptrs;
+    double *latencies;
+};
+
+static void *alloc_thread(void *ptr) {
+    struct ThreadArgs *args = ptr;
+
+    for(size_t i = 0; i < args->count; i++) {
+        struct timespec start, end;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        args->ptrs[i] = sicm_arena_alloc(args->arena, args->size);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+
+        if (!args->ptrs[i]) {
+            fprintf(stderr, "Could not allocate %zu bytes\n", args->size);
+        }
+        args->latencies[i] = nano(&start, &end);
+    }
+
+    return NULL;
+}
+
+static int cmp_double(const void *a, const void *b) {
+    const double x = * (const double *) a;
+    const double y = * (const double *) b;
+    return (x > y) - (x < y);
+}
+
+int main(int argc, char *argv[]) {
+    size_t max_threads = 16;
+    size_t count = 256;
+    size_t size = 4 * 1024 * 1024;
+
+    if (argc > 1) {
+        if (sscanf(argv[1], "%zu", &max_threads) != 1) {
+            fprintf(stderr, "Bad thread count: %s\n", argv[1]);
+            return 1;
+        }
+    }
+
+    if (argc > 2) {
+        if (sscanf(argv[2], "%zu", &count) != 1) {
+            fprintf(stderr, "Bad allocation count: %s\n", argv[2]);
+            return 1;
+        }
+    }
+
+    if (argc > 3) {
+        if (sscanf(argv[3], "%zu", &size) != 1) {
+            fprintf(stderr, "Bad allocation size: %s\n", argv[3]);
+            return 1;
+        }
+    }
+
+    sicm_device_list devs = sicm_init();
+    sicm_device_list ds = {
+        .count = 1,
+        .devices = &devs.devices[0],
+    };
+
+    printf("threads allocs/s mean(us) p99(us) max(us)\n");
+    for(size_t thread_count = 1; thread_count <= max_threads; thread_count *= 2) {
+        sicm_arena arena = sicm_arena_create(0, 0, &ds);
+        if (!arena) {
+            fprintf(stderr, "Could not create arena\n");
+            return 1;
+        }
+
+        pthread_t *threads      = calloc(thread_count, sizeof(pthread_t));
+        struct ThreadArgs *args = calloc(thread_count, sizeof(struct ThreadArgs));
+        void **ptrs             = calloc(thread_count * count, sizeof(void *));
+        double *latencies       = calloc(thread_count * count, sizeof(double));
+
+        struct timespec start, end;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for(size_t i = 0; i < thread_count; i++) {
+            args[i].arena = arena;
+            args[i].count = count;
+            args[i].size = size;
+            args[i].ptrs = &ptrs[i * count];
+            args[i].latencies = &latencies[i * count];
+            if (pthread_create(&threads[i], NULL, alloc_thread, &args[i]) != 0) {
+                fprintf(stderr, "Could not create thread %zu\n", i);
+                return 1;
+            }
+        }
+
+        for(size_t i = 0; i < thread_count; i++) {
+            pthread_join(threads[i], NULL);
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+
+        const size_t total = thread_count * count;
+        double mean = 0;
+        for(size_t i = 0; i < total; i++) {
+            mean += latencies[i];
+        }
+        mean /= total;
+        qsort(latencies, total, sizeof(double), cmp_double);
+
+        printf("%zu %.0f %.1f %.1f %.1f\n", thread_count,
+               total / (nano(&start, &end) / 1e9),
+               mean / 1e3, latencies[(total * 99) / 100] / 1e3, latencies[total - 1] / 1e3);
+
+        for(size_t i = 0; i < total; i++) {
+            sicm_free(ptrs[i]);
+        }
+
+        free(latencies);
+        free(ptrs);
+        free(args);
+        free(threads);
+
+        sicm_arena_destroy(arena);
+    }
+
+    sicm_fini();
+
+    return 0;
+}
@@ -0,0 +1,102 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "nano.h"
+#include "sicm_extent_arr.h"
+
+/* Attributes `samples` sampled addresses to the extents in the array, the
+ * same way the high-level profiler attributes PEBS samples to arenas.
+ */
+
+static size_t attribute_indexed(extent_arr *a, void **samples, const size_t count) {
+    size_t found = 0;
+    for(size_t i = 0; i < count; i++) {
+        extent_info *extent = extent_arr_lookup(a, samples[i]);
+        if (extent) {
+            (* (size_t *) extent->arena)++;
+            found++;
+        }
+    }
+    return found;
+}
+
+/* the linear scan the profiler used before the array was sorted */
+static size_t attribute_linear(extent_arr *a, void **samples, const size_t count) {
+    size_t found = 0;
+    for(size_t i = 0; i < count; i++) {
+        size_t j;
+        extent_arr_for(a, j) {
+            if ((samples[i] >= a->arr[j].start) && (samples[i] < a->arr[j].end)) {
+                (* (size_t *) a->arr[j].arena)++;
+                found++;
+            }
+        }
+    }
+    return found;
+}
+
+static double rate(size_t (*attribute)(extent_arr *, void **, const size_t),
+                   extent_arr *a, void **samples, const size_t count) {
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    const size_t found = attribute(a, samples, count);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    if (found != count) {
+        fprintf(stderr, "Only attributed %zu of %zu samples\n", found, count);
+    }
+
+    return count / (nano(&start, &end) / 1e9);
+}
+
+int main(int argc, char *argv[]) {
+    size_t max_extents = 65536;
+    size_t sample_count = 16384;
+
+    if (argc > 1) {
+        if (sscanf(argv[1], "%zu", &max_extents) != 1) {
+            fprintf(stderr, "Bad extent count: %s\n", argv[1]);
+            return 1;
+        }
+    }
+
+    if (argc > 2) {
+        if (sscanf(argv[2], "%zu", &sample_count) != 1) {
+            fprintf(stderr, "Bad sample count: %s\n", argv[2]);
+            return 1;
+        }
+    }
+
+    /* fake extents: 2 MiB each, with a gap between neighbors, inserted in random order */
+    const size_t extent_size = 2 * 1024 * 1024;
+    size_t *accesses = calloc(max_extents, sizeof(size_t));
+    void **samples = malloc(sample_count * sizeof(void *));
+    unsigned int seed = time(NULL);
+
+    printf("extents samples/s(indexed) samples/s(linear)\n");
+    for(size_t count = 16; count <= max_extents; count *= 2) {
+        extent_arr *a = extent_arr_init();
+        for(size_t i = 0; i < count; i++) {
+            const size_t slot = (i * 7919) % count;
+            char *start = (char *) ((slot + 1) * 2 * extent_size);
+            extent_arr_insert(a, start, start + extent_size, &accesses[slot]);
+        }
+
+        for(size_t i = 0; i < sample_count; i++) {
+            const size_t slot = rand_r(&seed) % count;
+            samples[i] = (char *) ((slot + 1) * 2 * extent_size) + rand_r(&seed) % extent_size;
+        }
+
+        printf("%zu %.0f %.0f\n", count,
+               rate(attribute_indexed, a, samples, sample_count),
+               rate(attribute_linear,  a, samples, sample_count));
+
+        extent_arr_free(a);
+    }
+
+    free(samples);
+    free(accesses);
+
+    return 0;
+}
@@ -0,0 +1,131 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "nano.h"
+#include "sicm_low.h"
+
+/* Measures sicm_arena_lookup throughput as the number of threads calling it
+ * concurrently grows. Every thread looks up the same set of pointers, which
+ * are spread across several arenas, the way the high-level profiler and
+ * sicm_free map pointers back to their arenas.
+ */
+
+struct ThreadArgs {
+    void **ptrs;
+    sicm_arena *owners;
+    size_t count;
+    size_t lookups;
+    size_t wrong;
+};
+
+static void *lookup_thread(void *ptr) {
+    struct ThreadArgs *args = ptr;
+    unsigned int seed = (unsigned int) (size_t) args;
+    for(size_t i = 0; i < args->lookups; i++) {
+        const size_t j = rand_r(&seed) % args->count;
+        if (sicm_arena_lookup(args->ptrs[j]) != args->owners[j]) {
+            args->wrong++;
+        }
+    }
+    return NULL;
+}
+
+int main(int argc, char *argv[]) {
+    size_t max_threads = 8;
+    size_t lookups = 1000000;
+    const size_t arena_count = 8;
+    const size_t count = 4096;
+
+    if (argc > 1) {
+        if (sscanf(argv[1], "%zu", &max_threads) != 1) {
+            fprintf(stderr, "Bad thread count: %s\n", argv[1]);
+            return 1;
+        }
+    }
+
+    if (argc > 2) {
+        if (sscanf(argv[2], "%zu", &lookups) != 1) {
+            fprintf(stderr, "Bad lookup count: %s\n", argv[2]);
+            return 1;
+        }
+    }
+
+    sicm_device_list devs = sicm_init();
+    sicm_device_list ds = {
+        .count = 1,
+        .devices = &devs.devices[0],
+    };
+
+    sicm_arena *arenas = calloc(arena_count, sizeof(sicm_arena));
+    for(size_t i = 0; i < arena_count; i++) {
+        arenas[i] = sicm_arena_create(0, 0, &ds);
+        if (!arenas[i]) {
+            fprintf(stderr, "Could not create arena %zu\n", i);
+            return 1;
+        }
+    }
+
+    /* a mix of small and large allocations so that lookups hit both slab and large extents */
+    void **ptrs = calloc(count, sizeof(void *));
+    sicm_arena *owners = calloc(count, sizeof(sicm_arena));
+    for(size_t i = 0; i < count; i++) {
+        owners[i] = arenas[i % arena_count];
+        ptrs[i] = sicm_arena_alloc(owners[i], (i % 16)?64:(256 * 1024));
+        if (!ptrs[i]) {
+            fprintf(stderr, "Could not allocate ptrs[%zu]\n", i);
+            return 1;
+        }
+    }
+
+    printf("threads lookups/s\n");
+    for(size_t thread_count = 1; thread_count <= max_threads; thread_count *= 2) {
+        pthread_t *threads      = calloc(thread_count, sizeof(pthread_t));
+        struct ThreadArgs *args = calloc(thread_count, sizeof(struct ThreadArgs));
+
+        struct timespec start, end;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for(size_t i = 0; i < thread_count; i++) {
+            args[i].ptrs = ptrs;
+            args[i].owners = owners;
+            args[i].count = count;
+            args[i].lookups = lookups;
+            if (pthread_create(&threads[i], NULL, lookup_thread, &args[i]) != 0) {
+                fprintf(stderr, "Could not create thread %zu\n", i);
+                return 1;
+            }
+        }
+
+        size_t wrong = 0;
+        for(size_t i = 0; i < thread_count; i++) {
+            pthread_join(threads[i], NULL);
+            wrong += args[i].wrong;
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+
+        if (wrong) {
+            fprintf(stderr, "%zu lookups returned the wrong arena\n", wrong);
+        }
+
+        printf("%zu %.0f\n", thread_count, (thread_count * lookups) / (nano(&start, &end) / 1e9));
+
+        free(args);
+        free(threads);
+    }
+
+    for(size_t i = 0; i < count; i++) {
+        sicm_free(ptrs[i]);
+    }
+    free(owners);
+    free(ptrs);
+
+    for(size_t i = 0; i < arena_count; i++) {
+        sicm_arena_destroy(arenas[i]);
+    }
+    free(arenas);
+
+    sicm_fini();
+
+    return 0;
+}
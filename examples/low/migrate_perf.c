@@ -0,0 +1,103 @@
+#include <numa.h>
+#include <numaif.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "nano.h"
+#include "sicm_low.h"
+
+/* Throughput of moving a buffer from one NUMA node to another: one mbind
+ * call with MPOL_MF_MOVE (what moving an extent used to do), against
+ * sicm_move with increasing numbers of migration threads. The buffer is
+ * moved back with mbind between runs.
+ */
+
+static int bind_move(sicm_device *dev, void *ptr, size_t size) {
+    struct bitmask *nodes = numa_allocate_nodemask();
+    numa_bitmask_setbit(nodes, sicm_numa_id(dev));
+    const int err = mbind(ptr, size, MPOL_BIND, nodes->maskp, nodes->size + 1, MPOL_MF_MOVE);
+    numa_free_nodemask(nodes);
+    return err;
+}
+
+static void report(const char *name, size_t size, struct timespec *start, struct timespec *end) {
+    const double elapsed = nano(start, end);
+    printf("%-12s %10.3f %10.3f\n", name, elapsed / 1e6, (size / elapsed) * 1e9 / (1024.0 * 1024 * 1024));
+}
+
+int main(int argc, char *argv[]) {
+    size_t size = 1024;
+    int max_threads = 16;
+
+    if (argc > 1) {
+        if (sscanf(argv[1], "%zu", &size) != 1) {
+            fprintf(stderr, "Bad size (MiB): %s\n", argv[1]);
+            return 1;
+        }
+    }
+
+    if (argc > 2) {
+        if (sscanf(argv[2], "%d", &max_threads) != 1) {
+            fprintf(stderr, "Bad thread count: %s\n", argv[2]);
+            return 1;
+        }
+    }
+
+    size *= 1024 * 1024;
+
+    sicm_device_list devs = sicm_init();
+    sicm_device *src = devs.devices[0];
+    sicm_device *dst = devs.devices[0];
+    for(unsigned int i = 0; i < devs.count; i++) {
+        if ((sicm_device_page_size(devs.devices[i]) == sicm_device_page_size(src)) &&
+            (sicm_numa_id(devs.devices[i]) != sicm_numa_id(src))) {
+            dst = devs.devices[i];
+            break;
+        }
+    }
+
+    if (sicm_numa_id(src) == sicm_numa_id(dst)) {
+        fprintf(stderr, "Only found one NUMA node, nothing will actually move\n");
+    }
+
+    char *buf = sicm_device_alloc(src, size);
+    if (!buf) {
+        fprintf(stderr, "Could not allocate %zu bytes\n", size);
+        return 1;
+    }
+    memset(buf, 1, size);
+
+    printf("Moving %zu MiB from node %d to node %d\n", size / (1024 * 1024), sicm_numa_id(src), sicm_numa_id(dst));
+    printf("%-12s %10s %10s\n", "method", "ms", "GiB/s");
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if (bind_move(dst, buf, size) != 0) {
+        fprintf(stderr, "mbind failed\n");
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    report("mbind", size, &start, &end);
+
+    for(int threads = 1; threads <= max_threads; threads *= 2) {
+        char name[32];
+
+        bind_move(src, buf, size);
+
+        sicm_set_migration_threads(threads);
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        if (sicm_move(src, dst, buf, size) != 0) {
+            fprintf(stderr, "sicm_move failed\n");
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+
+        snprintf(name, sizeof(name), "threads=%d", threads);
+        report(name, size, &start, &end);
+    }
+
+    sicm_device_free(src, buf, size);
+    sicm_fini();
+
+    return 0;
+}
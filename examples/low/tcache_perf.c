@@ -0,0 +1,121 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "nano.h"
+#include "sicm_low.h"
+
+/* Small object malloc/free throughput of threads sharing one arena, with
+ * and without per-thread caches (SICM_ARENA_TCACHE).
+ */
+
+#define BATCH 64
+
+struct ThreadArgs {
+    sicm_arena arena;
+    size_t iterations;
+    size_t size;
+};
+
+static void *alloc_thread(void *ptr) {
+    struct ThreadArgs *args = ptr;
+    void *ptrs[BATCH];
+
+    for(size_t i = 0; i < args->iterations; i++) {
+        for(size_t j = 0; j < BATCH; j++) {
+            ptrs[j] = sicm_arena_alloc(args->arena, args->size);
+            if (!ptrs[j]) {
+                fprintf(stderr, "Could not allocate %zu bytes\n", args->size);
+                return NULL;
+            }
+        }
+
+        for(size_t j = 0; j < BATCH; j++) {
+            sicm_free(ptrs[j]);
+        }
+    }
+
+    return NULL;
+}
+
+static double run(sicm_device_list *devs, const sicm_arena_flags flags,
+                  const size_t thread_count, const size_t iterations, const size_t size) {
+    sicm_arena arena = sicm_arena_create(0, flags, devs);
+    if (!arena) {
+        fprintf(stderr, "Could not create arena\n");
+        return 0;
+    }
+
+    pthread_t *threads      = calloc(thread_count, sizeof(pthread_t));
+    struct ThreadArgs *args = calloc(thread_count, sizeof(struct ThreadArgs));
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for(size_t i = 0; i < thread_count; i++) {
+        args[i].arena = arena;
+        args[i].iterations = iterations;
+        args[i].size = size;
+        if (pthread_create(&threads[i], NULL, alloc_thread, &args[i]) != 0) {
+            fprintf(stderr, "Could not create thread %zu\n", i);
+            return 0;
+        }
+    }
+
+    for(size_t i = 0; i < thread_count; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    free(args);
+    free(threads);
+
+    sicm_arena_destroy(arena);
+
+    /* malloc/free pairs per second */
+    return (thread_count * iterations * BATCH) / (nano(&start, &end) / 1e9);
+}
+
+int main(int argc, char *argv[]) {
+    size_t max_threads = 64;
+    size_t iterations = 10000;
+    size_t size = 64;
+
+    if (argc > 1) {
+        if (sscanf(argv[1], "%zu", &max_threads) != 1) {
+            fprintf(stderr, "Bad thread count: %s\n", argv[1]);
+            return 1;
+        }
+    }
+
+    if (argc > 2) {
+        if (sscanf(argv[2], "%zu", &iterations) != 1) {
+            fprintf(stderr, "Bad iteration count: %s\n", argv[2]);
+            return 1;
+        }
+    }
+
+    if (argc > 3) {
+        if (sscanf(argv[3], "%zu", &size) != 1) {
+            fprintf(stderr, "Bad allocation size: %s\n", argv[3]);
+            return 1;
+        }
+    }
+
+    sicm_device_list devs = sicm_init();
+    sicm_device_list ds = {
+        .count = 1,
+        .devices = &devs.devices[0],
+    };
+
+    printf("threads pairs/s(no tcache) pairs/s(tcache)\n");
+    for(size_t thread_count = 1; thread_count <= max_threads; thread_count *= 2) {
+        printf("%zu %.0f %.0f\n", thread_count,
+               run(&ds, SICM_ALLOC_STRICT, thread_count, iterations, size),
+               run(&ds, SICM_ALLOC_STRICT | SICM_ARENA_TCACHE, thread_count, iterations, size));
+    }
+
+    sicm_fini();
+
+    return 0;
+}
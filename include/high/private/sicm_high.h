@@ -17,10 +17,24 @@ enum arena_layout {
   INVALID_LAYOUT
 };
 
+/* A physical arena shared by sites once there are too many of them for
+ * each to get its own. Sites are grouped by the device that they're bound
+ * to and by how hot they are. The group's extents aren't owned by any one
+ * site, so they're never moved; sites move by switching groups, and stop
+ * being charged for the extents that they leave behind.
+ */
+typedef struct arena_group {
+  sicm_device *device;
+  int bucket;
+  sicm_arena arena;
+  size_t sites;
+} arena_group;
+
 /* Keeps track of additional information about arenas for profiling */
 typedef struct arena_info {
   unsigned index, id;
   sicm_arena arena;
+  arena_group *group; /* NULL if the arena isn't shared with other sites */
   size_t accesses, rss, peak_rss;
 } arena_info;
 
@@ -47,7 +61,9 @@ extern char *profile_one_event, *profile_all_event;
 extern sicm_device *online_device;
 extern sicm_device *default_device;
 extern ssize_t online_device_cap;
+extern double online_ns_saved;
 extern int max_index;
+extern int num_hotness_buckets;
 extern int max_sample_pages;
 extern int sample_freq;
 extern int num_imcs, max_imc_len, max_event_len;
@@ -66,7 +82,9 @@ void* sh_alloc(int id, size_t sz);
 void* sh_calloc(int id, size_t num, size_t sz);
 void* sh_realloc(int id, void *ptr, size_t sz);
 
-void sh_create_extent(void *begin, void *end);
+void sh_create_extent(arena_info *info, void *begin, void *end);
+void sh_delete_extent(void *begin, void *end);
 
 void sh_free(void* ptr);
 int get_arena_index(int id);
+void sh_move_site(int index, sicm_device *device, int bucket, double priority);
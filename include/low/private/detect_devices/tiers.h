@@ -0,0 +1,20 @@
+#ifndef __SICM_DETECT_TIERS_H
+#define __SICM_DETECT_TIERS_H
+
+#include "detect_devices.h"
+
+/* reads the kernel's memory tiers and HMAT numbers, before the detectors run */
+void detect_tiers(struct bitmask* compute_nodes);
+
+/* ranks the nodes that the kernel didn't describe, once the devices are known */
+void rank_tiers(struct sicm_device **devices, int count);
+
+/* whether the kernel puts a CPU-less node in the same tier as the compute nodes */
+int tiers_same_as_compute(int node);
+
+/* whether cpu_node is one of the nearest initiators of node, -1 if unknown */
+int tiers_is_initiator(int node, int cpu_node);
+
+int tiers_get_perf(int node, sicm_device_perf *perf);
+
+#endif
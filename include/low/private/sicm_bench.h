@@ -0,0 +1,47 @@
+#ifndef __SICM_BENCH_H
+#define __SICM_BENCH_H
+
+#include <stddef.h>
+
+#include "sicm_low.h"
+
+// Memory kernels used to measure devices. Every run is bound to the CPUs
+// of one NUMA node, and buffers come from sicm_device_alloc. The streaming
+// kernels are picked once for the CPU, see sicm_bandwidth_isa.
+
+// size of the lines that the pointer chase links
+#define SB_LINE 64
+// dependent accesses timed together, for percentiles
+#define SB_BATCH 256
+
+// Links the lines of buf into a single random cycle and returns its start.
+void **sb_chase_init(char *buf, size_t size, unsigned int seed);
+
+// Follows count links from *pos, which is updated. Returns ns per link.
+double sb_chase(void ***pos, size_t count);
+
+// Chases the first half of buf from the calling thread, count links, while
+// threads on node read the second half. *pos comes from sb_chase_init on
+// that half and is updated.
+int sb_latency(char *buf, size_t size, void ***pos, size_t count, int threads, int node, sicm_latency_stats *stats);
+
+// Runs op over buf with threads pinned to the CPUs of node, passes times,
+// each thread on its own slice. Returns GB/s, 0 if it couldn't run.
+double sb_stream(char *buf, size_t size, sicm_bandwidth_op op, int flags, int node, int threads, int passes);
+
+// Threads bound to node that keep reading buf until sb_load_stop.
+typedef struct sb_load sb_load;
+sb_load *sb_load_start(char *buf, size_t size, int node, int threads);
+// Returns the GB/s that the load read.
+double sb_load_stop(sb_load *load);
+
+// Number of CPUs of a node.
+int sb_node_cpus(int node);
+
+// Loads the cached device models of this machine, called by sicm_init.
+void sicm_model_load(sicm_device_list *devs);
+
+// Forgets the device models, called by sicm_fini with the devices.
+void sicm_model_clear(void);
+
+#endif
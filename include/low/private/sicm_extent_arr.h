@@ -1,15 +1,18 @@
 #pragma once
 /* extent_arr is an array of jemalloc extents. Each element of
  * the array stores a start and end address, as well as a pointer to an arena.
- * This is designed to be extremely cache-friendly, and thus makes some
- * sacrifices in the runtime complexity department. It's extremely fast
- * for use cases where we need to iterate over all of the extents in the array
- * very quickly, which we do when we rebind an arena or when we search
- * all allocated extents while profiling.
+ * This is designed to be extremely cache-friendly: the array is kept dense
+ * and sorted by start address, so iterating over all of the extents is a
+ * linear walk (which we do when we rebind an arena or when we walk all
+ * allocated extents while profiling), and finding the extent that contains
+ * an address is a binary search (which we do for every profiling sample).
+ * Inserting and deleting find their slot with the same binary search and then
+ * shift the tail of the array with a single memmove.
  */
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <string.h>
 #include <pthread.h>
 
 /* Stores information about a jemalloc extent */
@@ -20,7 +23,7 @@ typedef struct extent_info {
 
 typedef struct extent_arr {
   pthread_mutex_t mutex;
-  size_t max_extents, index, deleted;
+  size_t max_extents, index;
   extent_info *arr;
 } extent_arr;
 
@@ -29,24 +32,55 @@ typedef struct extent_arr {
 
 static inline extent_arr *extent_arr_init() {
   extent_arr *a;
-  size_t i;
 
   a = (extent_arr *) malloc(sizeof(extent_arr));
   a->max_extents = 2;
   a->index = 0;
-  a->deleted = 0;
   pthread_mutex_init(&a->mutex, NULL);
-  a->arr = (extent_info *) malloc(sizeof(extent_info) * a->max_extents);
-  extent_arr_for(a, i) {
-    a->arr[i].start = NULL;
-    a->arr[i].end = NULL;
-    a->arr[i].arena = NULL;
-  }
+  a->arr = (extent_info *) calloc(a->max_extents, sizeof(extent_info));
   return a;
 }
 
+/* Returns the index of the first extent whose start address is greater than
+ * `addr`, i.e. the position at which an extent starting at `addr` would be
+ * inserted. Does not take the mutex.
+ */
+static inline size_t extent_arr_upper_bound(extent_arr *a, void *addr) {
+  size_t lo, hi, mid;
+
+  lo = 0;
+  hi = a->index;
+  while(lo < hi) {
+    mid = lo + (hi - lo) / 2;
+    if((char *) a->arr[mid].start <= (char *) addr) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return lo;
+}
+
+/* Finds the extent that contains `addr`, or NULL if there isn't one.
+ * Like extent_arr_for, this doesn't take the mutex; the caller is
+ * responsible for making sure that nobody modifies the array concurrently.
+ */
+static inline extent_info *extent_arr_lookup(extent_arr *a, void *addr) {
+  size_t i;
+
+  i = extent_arr_upper_bound(a, addr);
+  if(i == 0) {
+    return NULL;
+  }
+  i--;
+  if((char *) addr < (char *) a->arr[i].end) {
+    return &(a->arr[i]);
+  }
+  return NULL;
+}
+
 static inline void extent_arr_insert(extent_arr *a, void *start, void *end, void *arena) {
-  size_t old_max_extents, i, found;
+  size_t i;
 
   if(!a) {
     fprintf(stderr, "Extent array is NULL. Aborting.\n");
@@ -55,42 +89,23 @@ static inline void extent_arr_insert(extent_arr *a, void *start, void *end, void
 
   pthread_mutex_lock(&a->mutex);
 
-  /* First search for a blank spot */
-  found = SIZE_MAX;
-  if(a->deleted > 0) {
-    extent_arr_for(a, i) {
-      /* Empty element when both addresses are NULL */
-      if(!a->arr[i].start && !a->arr[i].end) {
-        found = i;
-        break;
-      }
-    }
-  }
-
-  /* If we didn't find a deleted element, add to the array and possibly expand it */
-  if(found == SIZE_MAX) {
-    found = a->index;
-    /* Now expand the array to allow for more items */
-    if(a->index == a->max_extents - 1) {
-      /* We need to reallocate */
-      old_max_extents = a->max_extents;
-      a->max_extents *= 2;
-      a->arr = (extent_info *) realloc(a->arr, a->max_extents * sizeof(extent_info));
-      for(i = old_max_extents; i < a->max_extents; i++) {
-        a->arr[i].start = NULL;
-        a->arr[i].end = NULL;
-        a->arr[i].arena = NULL;
-      }
+  /* Expand the array to allow for more items */
+  if(a->index == a->max_extents) {
+    a->max_extents *= 2;
+    a->arr = (extent_info *) realloc(a->arr, a->max_extents * sizeof(extent_info));
+    if(!a->arr) {
+      fprintf(stderr, "Failed to grow the extent array. Aborting.\n");
+      exit(1);
     }
-    a->index++;
-  } else {
-    a->deleted--;
   }
 
-  /* Insert either into the deleted element or what a->index used to be */
-  a->arr[found].start = start;
-  a->arr[found].end = end;
-  a->arr[found].arena = arena;
+  /* Shift everything after the new extent up by one */
+  i = extent_arr_upper_bound(a, start);
+  memmove(&(a->arr[i + 1]), &(a->arr[i]), (a->index - i) * sizeof(extent_info));
+  a->arr[i].start = start;
+  a->arr[i].end = end;
+  a->arr[i].arena = arena;
+  a->index++;
 
   pthread_mutex_unlock(&a->mutex);
 }
@@ -105,20 +120,78 @@ static inline void extent_arr_delete(extent_arr *a, void *start) {
 
   pthread_mutex_lock(&a->mutex);
 
-  extent_arr_for(a, i) {
-    if(a->arr[i].start == start) {
-      a->arr[i].start = NULL;
-      a->arr[i].end = NULL;
-      a->arr[i].arena = NULL;
-      a->deleted++;
-      break;
+  i = extent_arr_upper_bound(a, start);
+  if((i > 0) && (a->arr[i - 1].start == start)) {
+    i--;
+    memmove(&(a->arr[i]), &(a->arr[i + 1]), (a->index - i - 1) * sizeof(extent_info));
+    a->index--;
+  }
+
+  pthread_mutex_unlock(&a->mutex);
+}
+
+/* Splits the extent that starts at `start` in two at `mid`. The second half
+ * keeps the arena of the original extent. Returns 0 on success, or -1 if
+ * there is no such extent or `mid` isn't inside it.
+ */
+static inline int extent_arr_split(extent_arr *a, void *start, void *mid) {
+  size_t i;
+  int ret;
+
+  pthread_mutex_lock(&a->mutex);
+
+  ret = -1;
+  i = extent_arr_upper_bound(a, start);
+  if((i > 0) && (a->arr[i - 1].start == start) &&
+     ((char *) mid > (char *) start) && ((char *) mid < (char *) a->arr[i - 1].end)) {
+    if(a->index == a->max_extents) {
+      a->max_extents *= 2;
+      a->arr = (extent_info *) realloc(a->arr, a->max_extents * sizeof(extent_info));
+      if(!a->arr) {
+        fprintf(stderr, "Failed to grow the extent array. Aborting.\n");
+        exit(1);
+      }
     }
+
+    memmove(&(a->arr[i + 1]), &(a->arr[i]), (a->index - i) * sizeof(extent_info));
+    a->arr[i].start = mid;
+    a->arr[i].end = a->arr[i - 1].end;
+    a->arr[i].arena = a->arr[i - 1].arena;
+    a->arr[i - 1].end = mid;
+    a->index++;
+    ret = 0;
+  }
+
+  pthread_mutex_unlock(&a->mutex);
+  return ret;
+}
+
+/* Merges the extent that starts at `start_b` into the one that starts at
+ * `start_a`, which must end where the second one starts. Returns 0 on
+ * success, or -1 if the extents aren't adjacent.
+ */
+static inline int extent_arr_merge(extent_arr *a, void *start_a, void *start_b) {
+  size_t i;
+  int ret;
+
+  pthread_mutex_lock(&a->mutex);
+
+  ret = -1;
+  i = extent_arr_upper_bound(a, start_a);
+  if((i > 0) && (i < a->index) && (a->arr[i - 1].start == start_a) &&
+     (a->arr[i - 1].end == start_b) && (a->arr[i].start == start_b)) {
+    a->arr[i - 1].end = a->arr[i].end;
+    memmove(&(a->arr[i]), &(a->arr[i + 1]), (a->index - i - 1) * sizeof(extent_info));
+    a->index--;
+    ret = 0;
   }
 
   pthread_mutex_unlock(&a->mutex);
+  return ret;
 }
 
 static inline void extent_arr_free(extent_arr *a) {
+  pthread_mutex_destroy(&a->mutex);
   free(a->arr);
   free(a);
 }
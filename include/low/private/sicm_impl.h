@@ -1,6 +1,7 @@
 #ifndef __SICMIMPL_H
 #define __SICMIMPL_H
 
+#include <stdint.h>
 #include <sys/types.h>
 
 #include <jemalloc/jemalloc.h>
@@ -79,6 +80,78 @@ extern int normal_page_size;
 
 typedef struct sarena sarena;
 
+/// Most stripes in one round of weighted interleaving.
+#define SICM_MAX_STRIPES 64
+
+/* Weighted interleaving. The arena's address space is cut into stripes of
+ * `size` bytes, and stripe i goes to nodes[i % count]; each node shows up in
+ * `nodes` as often as its weight. If the kernel's weighted interleave policy
+ * already uses the same weights it places and moves the pages itself, and
+ * the stripes are unused. */
+typedef struct sarena_stripes {
+    unsigned            count;		// 0 if the arena isn't striped
+    size_t              size;
+    int                 kernel;
+    int                 nodes[SICM_MAX_STRIPES];
+} sarena_stripes;
+
+/// Upper bound on jemalloc arena indices (see MALLCTL_ARENAS_ALL).
+#define SICM_MAX_ARENAS 4096
+
+
+/* One device of a fallback chain (sicm_arena_set_fallback) */
+typedef struct sarena_tier {
+    sicm_device*        dev;
+    struct bitmask*     nodemask;
+    size_t              budget;		// 0 is unlimited
+    size_t              used;		// bytes of extents on the device, including ones being allocated
+} sarena_tier;
+
+/* The tier of an extent is kept in the arena field of its entry in sa->extents */
+#define SARENA_TIER_TAG(tier)	((void *) (uintptr_t) ((tier) + 1))
+#define SARENA_TAG_TIER(tag)	((int) (uintptr_t) (tag) - 1)
+
+/* Identifies the header of a shared arena file ("SICMSHAR") */
+#define SARENA_SHARED_MAGIC	0x5349434d53484152ULL
+
+/// Most devices of a shared arena.
+#define SARENA_SHARED_DEVICES	64
+
+/* Header at the start of the file of a shared arena (sicm_arena_create_shared).
+ * The rest of the file is the arena's data, which every process maps at the
+ * same address so that pointers into it can be passed around. Extents are
+ * carved out of the data by bumping next, and the file is grown ahead of
+ * next with the mutex held. Offsets are never given back. */
+typedef struct sarena_shared {
+    uint64_t            magic;		// written last by the creator
+    pthread_mutex_t     mutex;		// robust and process-shared
+    uint64_t            base;		// address of the data in every process
+    uint64_t            size;		// of the data, the arena's maxsize
+    uint64_t            data;		// file offset of the data
+    uint64_t            next;		// first unused byte of the data
+    uint64_t            filesize;	// bytes of the data backed by the file
+    uint64_t            root;		// sicm_arena_set_root, 0 if unset
+    uint32_t            attached;	// processes using the arena
+    uint32_t            flags;
+    uint32_t            ndevs;
+    struct {
+        int32_t         tag;
+        int32_t         node;
+        int64_t         page_size;	// KiB
+    } devs[SARENA_SHARED_DEVICES];
+} sarena_shared;
+
+/* Region of a bump arena (SICM_ARENA_BUMP), reserved with sicm_device_alloc.
+ * Threads claim chunks of it by bumping next and then allocate from their
+ * chunk without touching the arena. */
+typedef struct sarena_bump {
+    void*               map;		// what sicm_device_alloc returned, NULL if the arena isn't a bump arena
+    size_t              mapsize;
+    char*               base;		// aligned to the granules of the address map
+    size_t              size;
+    size_t              next;		// offset of the first unclaimed byte, can run past size
+    unsigned            gen;		// bumped by sicm_arena_reset, threads drop their chunks
+} sarena_bump;
 
 /* Stores information about a jemalloc arena */
 struct sarena {
@@ -86,25 +159,129 @@ struct sarena {
     sicm_arena_flags	flags;
     sicm_device_list    devs;
     size_t              maxsize;	// 0 is unlimited
-    size_t              size;		// curent size of all extents
+    size_t              size;		// curent size of all extents, changed atomically with mutex held
     struct bitmask*	nodemask;
+    unsigned*           weights;	// per NUMA node for SICM_ALLOC_INTERLEAVE, NULL if they are all equal
+    sarena_stripes      stripes;	// derived from nodemask, weights and pgsz
+
+    /* Fallback chain: each extent goes to the first device with room in its
+     * budget. The arena's devices are all of the devices of the chain. */
+    int                 tiers;		// 0 if the arena doesn't have a chain
+    sarena_tier*        tier;
+    unsigned            tiers_gen;	// bumped whenever the chain is replaced
+    unsigned            mpol_gen;	// bumped whenever nodemask or pgsz change
+    size_t              pgsz;		// page size of the devices, in bytes
     sarena*             next;
 
     /* jemalloc related */
     unsigned            arena_ind;
     extent_hooks_t      hooks;
 
+    /* per-thread caches (SICM_ARENA_TCACHE) */
+    unsigned            serial;		// unique across the process, arena_ind is reused
+    unsigned            tcache_gen;	// bumped whenever cached objects should be flushed
+
     /* jemalloc extent ranges */
     extent_arr*         extents;
 
+    /* Huge page arenas can't unmap or purge arbitrary parts of their memory,
+     * so their extents are carved out of page aligned regions. Extents that
+     * jemalloc gives back become holes, which are reused first, and a region
+     * is unmapped once all of it is a hole */
+    int                 regions;
+    extent_arr*         maps;		// the regions
+    extent_arr*         holes;		// unused parts of the regions, before the tail
+    char*               tail;		// unused part of the last region
+    char*               tail_end;
+
+    /* The file header of a shared arena, NULL if the arena is private to
+     * the process. Extents that jemalloc allocates for itself while the
+     * arena is created are private either way. */
+    sarena_shared*      shared;
+    int                 persistent;	// sa->fd was opened by sicm_arena_open_persistent
+    int                 initref;	// the devices came from a sicm_init that is undone on destroy
+
+    sarena_bump         bump;
+
+    /* sicm_arena_set_events, read with mutex held */
+    sicm_extent_event_fn events_fn;
+    sicm_event_ring*    events_ring;
+    void*               cookie;
+
     int                 err;
     int                 fd;
 };
 
 extern sarena *sarena_ptr2sarena(void *ptr);
+
+/* Memory policy for the arena's extents, should be called with sa->mutex held */
+extern int sarena_mpol(sarena *sa, unsigned long **nodemaskp, unsigned long *maxnode);
+
+/* Bind [start, start + len) to the policy, stripe by stripe if stripes isn't NULL */
+extern int sarena_bind(void *start, size_t len, int mpol, unsigned long *nodemaskp, unsigned long maxnode,
+		       sarena_stripes *stripes, unsigned flags);
+
+/* Reserve room for an extent on the first tier that has it. Returns the
+ * tier, or -1 if all of them are full. Should be called with sa->mutex held */
+extern int sarena_tier_pick(sarena *sa, size_t size);
+
+/* Memory policy for the extents of a tier, should be called with sa->mutex held */
+extern int sarena_tier_mpol(sarena *sa, int tier, unsigned long **nodemaskp, unsigned long *maxnode);
+
+/* Carve size bytes aligned to alignment (at new_addr if it isn't NULL) out
+ * of the data of a shared arena, growing the file if needed. Returns the
+ * address, or NULL if the arena is full, see mmap.c */
+extern void *sarena_shared_reserve(sarena *sa, void *new_addr, size_t size, size_t alignment);
+
+/* Move the arena's memory onto pages of another size, see mmap.c */
+extern int sarena_remap(sarena *sa, size_t pgsz, int mpol, unsigned long *nodemaskp, unsigned long maxnode);
+
+/* Page size of the devices, in bytes */
+extern size_t sarena_pgsz(sicm_device_list *devs);
+
+/* Switch the arena to the devices without moving its memory; new extents
+ * go to the new devices right away. Returns the ranges that still have to
+ * be moved, or NULL if the devices can't be used */
+extern extent_arr *sarena_switch_devices(sarena *sa, sicm_device_list *devs);
+
+/* Move the arena's ranges to its current nodes, from the nodes in src (NULL
+ * if unknown), should be called with sa->mutex held */
+extern int sarena_move(sarena *sa, extent_arr *ranges, struct bitmask *src);
+
+/* Move the pages of the ranges that are populated to the nodes in dst with
+ * move_pages, spread over the migration threads. The pages go to the nodes
+ * of their stripes, or round robin if stripes is NULL. src_node is where
+ * the pages are now, -1 if unknown. Returns 0 or the first error */
+extern int sicm_move_ranges(extent_arr *ranges, size_t pgsz, struct bitmask *dst, int src_node, sarena_stripes *stripes);
+
+/* sicm_avail from the last snapshot, without taking a new one or waiting
+ * for one being taken; (size_t) -1 if that isn't known. Safe to call with
+ * an arena's mutex held */
+extern size_t sicm_avail_cached(sicm_device *device);
+
+/* Background migrations, see sicm_migrate.c */
+extern void sarena_migrations_cancel(sarena *sa);
+extern void sarena_migrations_forget(sarena *sa);
 extern int sicm_arena_init(void);
 
+/* Record/forget the address range of an extent so that pointers inside it
+ * can be mapped back to their arena without asking jemalloc */
+extern void sarena_map_add(sarena *sa, void *start, void *end);
+extern void sarena_map_remove(void *start, void *end);
+
+/* Deliver an extent event to the arena's listeners, should be called with
+ * sa->mutex held, see sicm_events.c */
+extern void sarena_event_send(sarena *sa, sicm_extent_event_type type, void *start, void *mid, void *end);
+
+static inline void sarena_event(sarena *sa, sicm_extent_event_type type, void *start, void *mid, void *end) {
+	if (sa->events_fn != NULL || sa->events_ring != NULL)
+		sarena_event_send(sa, type, start, mid, end);
+}
+
 /* Set by the user, called whenever an extent is allocated */
 extern void (*sicm_extent_alloc_callback)(void *start, void *end);
 
+/* Set by the user, called whenever an extent is given back */
+extern void (*sicm_extent_dalloc_callback)(void *start, void *end);
+
 #endif
@@ -81,9 +81,9 @@ public:
     }
 
     void
-    deallocate(value_type* p, std::size_t) noexcept  // Use pointer if pointer is not a value_type*
+    deallocate(value_type* p, std::size_t n) noexcept  // Use pointer if pointer is not a value_type*
     {
-        sicm_free(p);
+        sicm_arena_free_sized(*(arena.get()), p, n * sizeof(value_type));
     }
 
 //     value_type*
@@ -48,6 +48,10 @@ typedef enum sicm_arena_flags {
   SICM_ALLOC_MASK    = 7,	// lowest 3 bits
   SICM_ALLOC_STRICT  = 0,	// don't use any devices outside of the assigned
   SICM_ALLOC_RELAXED = 1,	// prefer the assigned devices, but use other memory too
+  SICM_ALLOC_INTERLEAVE = 2,	// spread pages over the assigned devices, see sicm_arena_set_weights
+  SICM_ARENA_TCACHE  = 8,	// cache small allocations per thread instead of locking the arena every time
+  SICM_ARENA_THP     = 16,	// align extents so that transparent huge pages can back them
+  SICM_ARENA_BUMP    = 32,	// hand out memory from one region, objects are only freed by sicm_arena_reset
 } sicm_arena_flags;
 
 /// Data specific to a DRAM device.
@@ -135,6 +139,19 @@ struct sicm_timing {
 /// Handle to an arena.
 typedef void* sicm_arena;
 
+/// Memory usage of an arena, see sicm_arena_stats.
+/**
+ * All sizes are in bytes.
+ */
+struct sicm_arena_stats {
+  size_t mapped;        ///< Memory the arena got from the system, same as sicm_arena_size.
+  size_t allocated;     ///< Memory in live allocations.
+  size_t active;        ///< Memory in pages that hold live allocations.
+  size_t dirty;         ///< Unused pages that haven't been given back to the system yet.
+  size_t* resident;     ///< Set by the caller: resident memory per NUMA node, or NULL.
+  int nodes;            ///< Set by the caller: number of entries in resident.
+};
+
 /// Explicitly-sized sicm_arena list.
 typedef struct sicm_arena_list {
 	unsigned int count;
@@ -182,17 +199,25 @@ sicm_arena_list *sicm_arenas_list();
 /// Create new arena
 /**
  * @param maxsize maximum size of the arena.
- * @param flags arena flags (currently unused)
+ * @param flags arena flags (see sicm_arena_flags)
  * @param devs devices that will be used for the arena's allocations
  * @return handle to the newly created arena, or ARENA_DEFAULT if the
  *         the function failed.
+ *
+ * With SICM_ARENA_BUMP, the arena doesn't go through jemalloc. maxsize
+ * bytes are reserved up front with sicm_device_alloc on the only device of
+ * devs, and each thread allocates by bumping a pointer through chunks that
+ * it claims from the region. Objects can't be freed one by one (freeing
+ * them does nothing) and the arena can't change its page size; all of its
+ * memory is reused after sicm_arena_reset. Each object is preceded by its
+ * size, and sicm_arena_realloc grows the thread's last object in place.
  */
 sicm_arena sicm_arena_create(size_t maxsize, sicm_arena_flags flags, sicm_device_list *devs);
 
 /// Create new mapped arena
 /**
  * @param maxsize maximum size of the arena.
- * @param flags arena flags (currently unused)
+ * @param flags arena flags (see sicm_arena_flags)
  * @param devs devices that will be used for the arena's allocations
  * @param fd A valid file descriptor to map the memory into
  * @param offset Starting offset within the file descriptor
@@ -204,6 +229,81 @@ sicm_arena sicm_arena_create(size_t maxsize, sicm_arena_flags flags, sicm_device
 sicm_arena sicm_arena_create_mmapped(size_t maxsize, sicm_arena_flags flags, sicm_device_list *devs, int fd,
 					off_t offset, int mutex_fd, off_t mutex_offset);
 
+/// Create new arena shared between processes
+/**
+ * @param maxsize maximum size of the arena, shared by all processes.
+ * @param flags arena flags (see sicm_arena_flags)
+ * @param devs devices that will be used for the arena's allocations
+ * @param fd file to keep the arena in, such as a file in /dev/shm or
+ *           hugetlbfs, or a memfd. Its previous contents are discarded.
+ * @return handle to the newly created arena, or NULL if the function
+ *         failed.
+ *
+ * The file starts with a header that other processes use to attach to
+ * the arena with sicm_arena_attach_shared, after this function returned.
+ * Every process maps the arena's memory at the same address, so pointers
+ * to objects in the arena can be passed between them and used as they
+ * are. Objects have to be freed by the process that allocated them. The
+ * arena's devices can't be changed.
+ */
+sicm_arena sicm_arena_create_shared(size_t maxsize, sicm_arena_flags flags, sicm_device_list *devs, int fd);
+
+/// Attach to an arena created by another process
+/**
+ * @param fd the file the arena was created in
+ * @return handle to the arena, or NULL if the file doesn't have a shared
+ *         arena or the arena's address range is already in use in this
+ *         process.
+ */
+sicm_arena sicm_arena_attach_shared(int fd);
+
+/// Stop using a shared arena in this process
+/**
+ * @param arena the arena
+ * @return the number of processes that are still attached to it, or
+ *         -EINVAL if arena is NULL
+ *
+ * Objects the process allocated in the arena stay in the file and can
+ * still be used by the other processes. sicm_arena_destroy does the same
+ * for shared arenas.
+ */
+int sicm_arena_detach(sicm_arena arena);
+
+/// Open an arena kept in a file across runs
+/**
+ * @param path the arena's file, created if it doesn't exist
+ * @param maxsize maximum size of the arena, if it is created
+ * @param flags arena flags (see sicm_arena_flags), if it is created
+ * @param devs devices that will be used for the arena's allocations, if
+ *             it is created. NULL only opens existing arenas.
+ * @return handle to the arena, or NULL if the function failed.
+ *
+ * This is a shared arena (see sicm_arena_create_shared) whose file is
+ * kept when the arena is detached. Opening it again, in the same or a
+ * later process, maps its memory back at the same address, so pointers
+ * stored in it stay valid. This fails if something else already uses
+ * that address range. Objects allocated before the arena was reopened
+ * can be used, but not freed. sicm_arena_set_root keeps track of where
+ * the data starts.
+ */
+sicm_arena sicm_arena_open_persistent(const char *path, size_t maxsize, sicm_arena_flags flags, sicm_device_list *devs);
+
+/// Remember an object of a shared or persistent arena
+/**
+ * @param arena the arena
+ * @param ptr the object, or NULL
+ * @return 0 on success, or -EINVAL if the arena isn't shared or the
+ *         object isn't in it
+ */
+int sicm_arena_set_root(sicm_arena arena, void *ptr);
+
+/// Get the object remembered by sicm_arena_set_root
+/**
+ * @param arena the arena
+ * @return the object, or NULL if none was set or the arena isn't shared
+ */
+void *sicm_arena_get_root(sicm_arena arena);
+
 /// Free up arena
 /**
  * @param handle to an arena you want to destroy
@@ -253,9 +353,188 @@ int sicm_arena_set_device_array(sicm_arena sa, sicm_device **devs, size_t count)
  * @param sa arena
  * @param devs list of devices assigned to the arena
  * @return zero if the operation is successful
+ *
+ * If the page size of the new devices differs from the arena's, the arena's
+ * memory is copied onto the new pages and remapped at the same addresses.
+ * The arena must not be used by other threads while that happens. Only the
+ * parts of the arena's memory that are aligned to the bigger of the two page
+ * sizes change pages; extents of at least a huge page are aligned for that
+ * when they are allocated. If the new pages can't be had, the arena is left
+ * as it was and an error is returned.
  */
 int sicm_arena_set_device_list(sicm_arena sa, sicm_device_list *devs);
 
+/// Handle to a migration running in the background
+typedef struct sicm_migration sicm_migration;
+
+/// Set the list of devices to be used for the arena's allocations without waiting for its memory to move
+/**
+ * @param sa arena
+ * @param devs list of devices assigned to the arena
+ * @return handle to the migration, or NULL if it couldn't be started
+ *
+ * New allocations in the arena go to the new devices as soon as this
+ * returns. The memory that the arena already has is moved by a background
+ * thread, a little at a time, so other threads can keep allocating from
+ * the arena in the meantime. Starting another migration of the same arena,
+ * or calling sicm_arena_set_device_list on it, cancels this one. Devices
+ * with another page size than the arena's are refused, because the memory
+ * would have to be copied while nobody uses it; change those with
+ * sicm_arena_set_device_list instead.
+ */
+sicm_migration *sicm_arena_set_device_list_async(sicm_arena sa, sicm_device_list *devs);
+
+/// Check on a background migration
+/**
+ * @param m migration
+ * @param done if not NULL, set to the number of bytes processed so far
+ * @param total if not NULL, set to the number of bytes to process
+ * @return 1 if the migration has finished, 0 if it is still running
+ */
+int sicm_migration_poll(sicm_migration *m, size_t *done, size_t *total);
+
+/// Wait for a background migration to finish
+/**
+ * @param m migration
+ * @return zero if all of the arena's memory was moved, -ECANCELED if the
+ *         migration was cancelled before it got there, or another negative
+ *         error code if some of the memory couldn't be moved
+ */
+int sicm_migration_wait(sicm_migration *m);
+
+/// Set how important a background migration is
+/**
+ * @param m migration
+ * @param priority higher goes first, migrations start at 0
+ * @return zero if the operation is successful
+ *
+ * The background thread moves one chunk at a time, always from the
+ * queued migration with the highest priority, so arenas that benefit
+ * the most from their new devices can be given a higher priority and
+ * get there before the others.
+ */
+int sicm_migration_set_priority(sicm_migration *m, double priority);
+
+/// Limit how fast background migrations move memory
+/**
+ * @param bytes_per_sec rate shared by all background migrations, 0 for no limit
+ * @return zero if the operation is successful
+ *
+ * With a limit, memory is moved in small chunks spread out over time so
+ * that migrations don't take the memory bandwidth that the application
+ * needs. Migrations that change the page size aren't limited.
+ */
+int sicm_set_migration_rate(size_t bytes_per_sec);
+
+/// Amount of memory that background migrations haven't moved yet
+/**
+ * @return bytes still to be moved by all unfinished, uncancelled migrations
+ */
+size_t sicm_migration_pending(void);
+
+/// Stop a background migration
+/**
+ * @param m migration
+ * @return zero if the operation is successful
+ *
+ * Memory that has already been moved stays on the new devices, and the
+ * arena keeps allocating from them.
+ */
+int sicm_migration_cancel(sicm_migration *m);
+
+/// Release a migration handle
+/**
+ * @param m migration
+ *
+ * The migration itself keeps running if it hasn't finished yet.
+ */
+void sicm_migration_free(sicm_migration *m);
+
+/// Set how much of an interleaved arena's memory goes to each device
+/**
+ * @param sa arena created with SICM_ALLOC_INTERLEAVE
+ * @param devs devices to set the weights of
+ * @param weights one per device, at least 1
+ * @return zero if the operation is successful, -EINVAL if the arena isn't
+ *         interleaved or a weight is 0
+ *
+ * Without weights, pages are interleaved evenly over the arena's devices.
+ * With weights, a device gets weight / (sum of weights) of the arena's
+ * memory, e.g. a bandwidth-bound array can be split between HBM and DRAM in
+ * proportion to their bandwidths. Devices that weren't given a weight have
+ * a weight of 1. The kernel's weighted interleaving is used if its weights
+ * have the same ratio, otherwise the arena's address space is split into
+ * stripes of a few megabytes that are bound to the devices in turn. Memory
+ * that the arena already has is moved to match.
+ */
+int sicm_arena_set_weights(sicm_arena sa, sicm_device_list *devs, unsigned *weights);
+
+/// Place the arena's memory on the first of a list of devices that has room
+/**
+ * @param sa arena
+ * @param devs devices in order of preference, e.g. HBM, local DRAM, remote DRAM
+ * @param budgets most bytes to put on each device, 0 for no limit, or NULL
+ *        for no limits at all
+ * @return zero if the operation is successful, -EINVAL if the devices don't
+ *         have the arena's page size or the arena uses huge pages
+ *
+ * Each new extent goes to the first device whose budget and free memory
+ * (as sicm_avail reports it) it fits in; the last device only has to have
+ * budget left. Allocations fail only once every budget is used up. Memory that the arena
+ * already has is placed the same way. Changing the arena's devices with
+ * sicm_arena_set_device_list gets rid of the list.
+ */
+int sicm_arena_set_fallback(sicm_arena sa, sicm_device_list *devs, size_t *budgets);
+
+/// Get how much of the arena's memory is on a device of its fallback list
+/**
+ * @param sa arena
+ * @param dev device
+ * @return bytes of extents on the device, 0 if the arena doesn't have a
+ *         fallback list
+ */
+size_t sicm_arena_device_size(sicm_arena sa, sicm_device *dev);
+
+/// Move memory back to the devices that come first in the fallback list
+/**
+ * @param sa arena
+ * @return number of bytes moved
+ *
+ * Extents that had to go further down the list are moved to the first
+ * device that has room for them now, e.g. after the memory that filled up
+ * the fast devices was freed.
+ */
+size_t sicm_arena_promote(sicm_arena sa);
+
+/// Set how quickly the arena gives unused memory back to the system
+/**
+ * @param sa arena
+ * @param dirty_decay_ms time in milliseconds after which unused dirty pages
+ *        are purged lazily (MADV_FREE), 0 to purge them immediately, or -1
+ *        to never purge them
+ * @param muzzy_decay_ms time in milliseconds after which lazily purged pages
+ *        are dropped (MADV_DONTNEED), with the same special values
+ * @return zero if the operation is successful
+ *
+ * Short decay times keep less memory resident on the arena's devices, at
+ * the cost of faulting pages in again when the arena grows back.
+ */
+int sicm_arena_set_decay(sicm_arena sa, ssize_t dirty_decay_ms, ssize_t muzzy_decay_ms);
+
+/// Free every object in an arena at once
+/**
+ * @param sa arena
+ * @param keep_extents nonzero to keep the arena's memory for the next
+ *        objects, zero to give its pages back to the system right away
+ * @return zero if the operation is successful
+ *
+ * None of the arena's objects may be used afterwards, and no other thread
+ * may use the arena while it is being reset. Kept memory stays mapped and
+ * on the arena's devices, so new objects don't need new extents; it is
+ * given back by decay like other unused memory (see sicm_arena_set_decay).
+ */
+int sicm_arena_reset(sicm_arena sa, int keep_extents);
+
 /// Get arena size
 /**
  * @param sa arena
@@ -267,6 +546,23 @@ int sicm_arena_set_device_list(sicm_arena sa, sicm_device_list *devs);
  */
 size_t sicm_arena_size(sicm_arena sa);
 
+/// Get the memory usage of an arena
+/**
+ * @param sa arena
+ * @param stats filled in with the arena's usage; resident and nodes have to
+ *        be set beforehand
+ * @return zero if the operation is successful
+ *
+ * allocated, active and dirty come from jemalloc's statistics, and are 0
+ * if jemalloc was built without them. If resident isn't NULL, the nodes of
+ * up to a few thousand pages spread evenly over the arena are looked up
+ * with move_pages, and each node gets the share of mapped memory that its
+ * pages stand for. Pages that were never touched aren't resident anywhere.
+ * The arena is only locked long enough to copy its list of extents, so
+ * calling this regularly doesn't hold up allocations.
+ */
+int sicm_arena_stats(sicm_arena sa, struct sicm_arena_stats *stats);
+
 /// Allocate memory region
 /**
  * @param sa arena that should be used for the allocation. ARENA_DEFAULT is allowed.
@@ -277,6 +573,20 @@ size_t sicm_arena_size(sicm_arena sa);
  */
 void *sicm_arena_alloc(sicm_arena sa, size_t sz);
 
+/// Allocate many memory regions of the same size
+/**
+ * @param sa arena that should be used for the allocations. ARENA_DEFAULT is allowed.
+ * @param sz size of each region
+ * @param n number of regions
+ * @param ptrs array of at least n pointers that receives the regions
+ * @return the number of regions allocated, less than n only if the
+ *         allocator ran out of memory.
+ *
+ * With jemalloc 5.3 or newer, small regions are taken from the same slabs
+ * in one call, so they are usually next to each other.
+ */
+size_t sicm_arena_alloc_batch(sicm_arena sa, size_t sz, size_t n, void **ptrs);
+
 /// Allocate aligned memory region
 /**
  * @param sa arena that should be used for the allocation. ARENA_DEFAULT is allowed.
@@ -294,9 +604,38 @@ void *sicm_arena_alloc_aligned(sicm_arena sa, size_t sz, size_t align);
  * @param ptr pointer to the memory to be resized
  * @param sz new size
  * @return pointer to the new allocation, or NULL if unable to reallocate
+ *
+ * ptr may belong to another arena. An object of a bump arena
+ * (SICM_ARENA_BUMP) is copied, and the old one stays until its arena is
+ * reset.
  */
 void *sicm_arena_realloc(sicm_arena sa, void *ptr, size_t sz);
 
+/// Resize a memory region without moving it
+/**
+ * @param sa arena the region belongs to, which is trusted rather than
+ *        looked up; passing another arena is undefined
+ * @param ptr pointer to the memory to be resized
+ * @param sz new size
+ * @return the usable size of the region afterwards, which is less than sz
+ *         if it couldn't grow in place, or 0 if ptr is NULL or belongs to
+ *         a bump arena (SICM_ARENA_BUMP)
+ */
+size_t sicm_arena_realloc_in_place(sicm_arena sa, void *ptr, size_t sz);
+
+/// Deallocate/free a memory region of a known arena and size
+/**
+ * @param sa arena the region was allocated in. ARENA_DEFAULT is allowed.
+ * @param ptr pointer to the memory to be deallocated
+ * @param sz the size the region was allocated with
+ *
+ * Unlike sicm_free, this doesn't have to find out where the region came
+ * from, so sa must be the region's arena: regions of a bump arena
+ * (SICM_ARENA_BUMP) passed with another arena are given to jemalloc, which
+ * doesn't own them. With their own arena, they are left alone.
+ */
+void sicm_arena_free_sized(sicm_arena sa, void *ptr, size_t sz);
+
 /// Allocate memory region
 /**
  * @param sz size of the region
@@ -324,11 +663,35 @@ void *sicm_alloc_aligned(size_t sz, size_t align);
  */
 void sicm_free(void *ptr);
 
+/// Deallocate/free a memory region of a known size
+/**
+ * @param ptr pointer to the memory to be deallocated
+ * @param sz the size the region was allocated with
+ */
+void sicm_free_sized(void *ptr, size_t sz);
+
+/// Deallocate/free many memory regions
+/**
+ * @param ptrs pointers to the memory to be deallocated, NULL entries are skipped
+ * @param n number of pointers
+ */
+void sicm_free_batch(void **ptrs, size_t n);
+
+/// Deallocate/free many memory regions of the same size
+/**
+ * @param ptrs pointers to the memory to be deallocated, NULL entries are skipped
+ * @param n number of pointers
+ * @param size the size the regions were allocated with
+ */
+void sicm_free_batch_sized(void **ptrs, size_t n, size_t size);
+
 /// Resize a memory region
 /**
  * @param ptr pointer to the memory to be resized
  * @param sz new size
  * @return pointer to the new allocation, or NULL if unable to reallocate
+ *
+ * Regions allocated in an arena stay in that arena.
  */
 void *sicm_realloc(void *ptr, size_t sz);
 
@@ -339,6 +702,86 @@ void *sicm_realloc(void *ptr, size_t sz);
  */
 sicm_arena sicm_arena_lookup(void *ptr);
 
+/// Kinds of extent events, see sicm_arena_set_events.
+typedef enum sicm_extent_event_type {
+  SICM_EXTENT_ALLOC,    ///< [start, end) was added to the arena.
+  SICM_EXTENT_DALLOC,   ///< [start, end) was given back.
+  SICM_EXTENT_SPLIT,    ///< [start, end) was split into [start, mid) and [mid, end).
+  SICM_EXTENT_MERGE,    ///< [start, mid) and [mid, end) were merged into [start, end).
+  SICM_EXTENT_MIGRATE,  ///< The pages of [start, end) were moved to the arena's current devices.
+} sicm_extent_event_type;
+
+/// Something that happened to an extent of an arena.
+typedef struct sicm_extent_event {
+  sicm_extent_event_type type;
+  sicm_arena arena;     ///< Arena that the extent belongs to.
+  void* cookie;         ///< Passed to sicm_arena_set_events.
+  void* start;
+  void* mid;            ///< Only set for SICM_EXTENT_SPLIT and SICM_EXTENT_MERGE.
+  void* end;
+} sicm_extent_event;
+
+/// Called for each extent event of an arena.
+typedef void (*sicm_extent_event_fn)(const sicm_extent_event* event);
+
+/// Bounded queue of extent events, filled by allocating threads and drained by one consumer.
+typedef struct sicm_event_ring sicm_event_ring;
+
+/// Create a queue of extent events
+/**
+ * @param capacity most events that the queue holds, rounded up to a power of two
+ * @return the queue, or NULL if the operation failed
+ */
+sicm_event_ring *sicm_event_ring_create(size_t capacity);
+
+/// Take events out of a queue
+/**
+ * @param ring queue
+ * @param events filled in with the oldest events
+ * @param max most events to take
+ * @return number of events taken
+ *
+ * Only one thread at a time may take events out of a queue.
+ */
+size_t sicm_event_ring_read(sicm_event_ring *ring, sicm_extent_event *events, size_t max);
+
+/// Number of events that didn't fit into a queue
+/**
+ * @param ring queue
+ * @return events dropped because the queue was full, since it was created
+ */
+size_t sicm_event_ring_dropped(sicm_event_ring *ring);
+
+/// Free a queue of extent events
+/**
+ * @param ring queue, no arena may still send events to it
+ */
+void sicm_event_ring_free(sicm_event_ring *ring);
+
+/// Get told about the extents of an arena
+/**
+ * @param sa arena
+ * @param fn called for each event, or NULL
+ * @param ring queue that each event is added to, or NULL
+ * @param cookie passed along with each event
+ * @return zero if the operation is successful
+ *
+ * fn is called by the thread that caused the event, with the arena locked,
+ * so it must not allocate from or change the arena. Events of an extent are
+ * delivered in order. Queued events are taken out by another thread with
+ * sicm_event_ring_read, off the allocation path; events that don't fit are
+ * dropped and counted. Extents that the arena already has aren't reported.
+ * Pass NULL for both fn and ring to stop the events.
+ */
+int sicm_arena_set_events(sicm_arena sa, sicm_extent_event_fn fn, sicm_event_ring *ring, void *cookie);
+
+/// Get the cookie passed to sicm_arena_set_events
+/**
+ * @param sa arena
+ * @return the cookie, or NULL if it isn't set
+ */
+void *sicm_arena_get_cookie(sicm_arena sa);
+
 /// Allocate memory on a SICM device.
 /**
  * @param[in] device Pointer to a sicm_device to allocate on.
@@ -348,7 +791,7 @@ sicm_arena sicm_arena_lookup(void *ptr);
  * If you allocate on huge pages, your allocation will be rounded up to
  * a multiple of the huge page size. Also, if you try to allocate on
  * huge pages and there aren't enough huge pages available, the
- * allocation will fail and return -1.
+ * allocation will fail and return -1 (MAP_FAILED).
  */
 void* sicm_device_alloc(struct sicm_device* device, size_t size);
 
@@ -427,6 +870,18 @@ int sicm_device_eq(sicm_device* dev1, sicm_device* dev2);
  */
 int sicm_move(sicm_device* src, sicm_device* dst, void* ptr, size_t size);
 
+/// Set how many threads move memory between devices.
+/**
+ * @param[in] threads Number of threads, at least 1.
+ * @return On success, returns 0. Otherwise returns -EINVAL.
+ *
+ * Used by sicm_move and when an arena's devices change. Big moves are
+ * split into batches of pages that the threads move in parallel, half of
+ * them running on the source node and half on the destination. Defaults to
+ * the SICM_MIGRATION_THREADS environment variable, or up to 4 threads.
+ */
+int sicm_set_migration_threads(int threads);
+
 /// Pins the current process to the processors closest to the memory.
 /**
  * @param[in] device Device to pin the process to.
@@ -446,10 +901,66 @@ size_t sicm_capacity(sicm_device* device);
  * @return Number of available kibibytes on the device.
  *
  * Note that this does not account for memory that has been allocated
- * but not yet touched.
+ * but not yet touched, and that the answer can be as old as the device
+ * snapshot interval (see sicm_set_snapshot_interval).
  */
 size_t sicm_avail(sicm_device* device);
 
+/// Memory counters of a device, see sicm_devices_snapshot.
+/**
+ * Sizes are in kibibytes. The meminfo, numastat and vmstat counters are
+ * those of the device's NUMA node, shared by all of its page sizes;
+ * numastat and vmstat count pages or events. Counters that the kernel
+ * doesn't have are zero.
+ */
+typedef struct sicm_device_snapshot {
+  sicm_device* device;
+  size_t capacity;          ///< Same as sicm_capacity.
+  size_t avail;             ///< Same as sicm_avail.
+  size_t huge_pages;        ///< Huge pages of the device's page size on the node, 0 for normal pages.
+  size_t huge_free;         ///< Free huge pages of the device's page size.
+  size_t mem_total;
+  size_t mem_free;
+  size_t mem_used;
+  size_t active;
+  size_t inactive;
+  size_t file_pages;
+  size_t anon_pages;
+  size_t shmem;
+  size_t slab;
+  size_t dirty;
+  size_t writeback;
+  size_t numa_hit;
+  size_t numa_miss;
+  size_t numa_foreign;
+  size_t local_node;
+  size_t other_node;
+  size_t pgpromote_success;
+  size_t pgdemote_kswapd;
+  size_t pgdemote_direct;
+} sicm_device_snapshot;
+
+/// Get the memory counters of all devices
+/**
+ * @param snap filled in with the counters of the devices that sicm_init
+ * returned, in the same order, or NULL to only count them
+ * @param max most devices to fill in
+ * @return number of devices
+ *
+ * All nodes are read in one pass. The result is cached and only read again
+ * once it's older than the interval set with sicm_set_snapshot_interval;
+ * sicm_capacity and sicm_avail are answered from the same cache.
+ */
+size_t sicm_devices_snapshot(sicm_device_snapshot *snap, size_t max);
+
+/// Set how long device snapshots are cached
+/**
+ * @param msec milliseconds, 0 reads the counters again on every query
+ *
+ * Defaults to the SICM_SNAPSHOT_INTERVAL environment variable, or 100.
+ */
+void sicm_set_snapshot_interval(unsigned int msec);
+
 /// Returns a distance metric based on general beliefs about the device/its location in the system.
 /**
  * @param[in] device Pointer to the sicm_device to query.
@@ -474,10 +985,83 @@ int sicm_model_distance(sicm_device* device);
  * @param[in] device Pointer to the sicm_device to query.
  * @return Boolean indicating whether the device is a near node.
  *
- * Always returns 0 if the device is not a NUMA device.
+ * A device is near if the kernel lists the calling thread's node as one of
+ * its nearest initiators. Without that data, it falls back to the usual
+ * NUMA distances of each device type. Always returns 0 if the device is
+ * not a NUMA device.
  */
 int sicm_is_near(sicm_device* device);
 
+/// Where the tier of a device comes from, see sicm_device_perf.
+typedef enum sicm_tier_source {
+  SICM_TIER_GUESS,      ///< Ranked by device type: HBM, then DRAM, then Optane.
+  SICM_TIER_HMAT,       ///< Ranked by the read latency that the firmware (HMAT) reports.
+  SICM_TIER_KERNEL,     ///< The kernel's memory tiers, /sys/devices/virtual/memory_tiering.
+} sicm_tier_source;
+
+/// Performance of a device's memory, as reported by the kernel.
+typedef struct sicm_device_perf {
+  int tier;                       ///< Rank of the device's tier, 0 is the fastest.
+  sicm_tier_source source;        ///< Where the tier comes from.
+  unsigned int read_bandwidth;    ///< MB/s from the nearest CPUs, 0 if unknown.
+  unsigned int write_bandwidth;   ///< MB/s from the nearest CPUs, 0 if unknown.
+  unsigned int read_latency;      ///< Nanoseconds from the nearest CPUs, 0 if unknown.
+  unsigned int write_latency;     ///< Nanoseconds from the nearest CPUs, 0 if unknown.
+} sicm_device_perf;
+
+/// Get the performance of a device's memory
+/**
+ * @param[in] device Pointer to the sicm_device to query.
+ * @param[out] perf Filled in with the device's tier, bandwidth and latency.
+ * @return zero if the operation is successful, -EINVAL if the device
+ * isn't a NUMA device
+ *
+ * The numbers come from the kernel's HMAT data, and the tier from its
+ * memory tiers. Without memory tiers, the devices are ranked by their HMAT
+ * latency, and without either, by their type. Every page size of a NUMA
+ * node has the same numbers.
+ */
+int sicm_get_device_perf(sicm_device* device, sicm_device_perf* perf);
+
+/// Get the rank of a device's memory tier
+/**
+ * @param[in] device Pointer to the sicm_device to query.
+ * @return 0 for the fastest tier, 1 for the next one, and so on, or -1 if
+ * the device isn't a NUMA device
+ */
+int sicm_device_tier(sicm_device* device);
+
+/// Measured performance of a device from the CPUs of one NUMA node, see sicm_device_characterize.
+typedef struct sicm_device_model {
+  double idle_latency;      ///< Nanoseconds per dependent load, with the node otherwise idle.
+  double loaded_latency;    ///< Nanoseconds per dependent load, with the node's other CPUs reading the device, 0 if it has none.
+  double read_bandwidth;    ///< GB/s with all of the node's CPUs reading.
+  double write_bandwidth;   ///< GB/s with all of the node's CPUs writing.
+} sicm_device_model;
+
+/// Measure every device from every NUMA node with CPUs
+/**
+ * @param force measure pairs that are already cached again
+ * @return zero if the operation is successful
+ *
+ * Slow: each pair of initiator node and device takes a second or so. The
+ * results are saved to a cache file named after the machine's topology, in
+ * SICM_MODEL_CACHE, $XDG_CACHE_HOME/sicm or ~/.cache/sicm, and later
+ * sicm_init calls load them from there. Devices that can't allocate the
+ * test buffer, like huge page sizes without reserved pages, are skipped.
+ */
+int sicm_device_characterize(int force);
+
+/// Get the measured performance of a device
+/**
+ * @param initiator NUMA node of the CPUs that access the device, or -1 for
+ * the calling thread's node
+ * @param device device to look up
+ * @param[out] model filled in with the measurements
+ * @return zero, or -ENOENT if the pair hasn't been measured
+ */
+int sicm_get_device_model(int initiator, sicm_device* device, sicm_device_model* model);
+
 /// Measure empirical latency of the device.
 /**
  * @param[in] device Pointer to the sicm_device to query.
@@ -489,10 +1073,113 @@ int sicm_is_near(sicm_device* device);
  * written to iter random positions in the allocation. Then, data are
  * read from iter random positions in the allocation. Finally, the
  * allocation is freed. The time to complete each process is recorded in
- * res.
+ * res. The random accesses overlap and include TLB misses; see
+ * sicm_latency_chase for the latency of a single access.
  */
 void sicm_latency(sicm_device* device, size_t size, int iter, struct sicm_timing* res);
 
+/// Latency of a device, see sicm_latency_chase.
+/**
+ * All times are in nanoseconds per access. The percentiles are over
+ * batches of 256 dependent accesses, which are timed together.
+ */
+typedef struct sicm_latency_stats {
+  double mean;
+  double min;
+  double p50;
+  double p90;
+  double p99;
+  double max;
+  double load_bandwidth;  ///< GB/s that the load threads read meanwhile, 0 without any.
+  int page_size;          ///< Page size that was measured, in kibibytes.
+} sicm_latency_stats;
+
+/// Measure the latency of a device by pointer chasing
+/**
+ * @param[in] device Device to measure.
+ * @param[in] size Bytes to allocate, well past the size of the caches.
+ * @param[in] accesses Number of dependent accesses to time.
+ * @param[in] load_threads Number of threads that read the device meanwhile.
+ * @param[out] res Filled in with the results.
+ * @return zero if the operation is successful
+ *
+ * Half of the allocation is linked into one random cycle of 64-byte lines,
+ * which the calling thread follows, so that every access waits for the one
+ * before it and prefetchers can't guess the next. The load threads run on
+ * the calling thread's node and stream through the other half. The
+ * allocation comes from the variant of the device with the biggest pages
+ * that has room for it, so that TLB misses don't count as latency.
+ */
+int sicm_latency_chase(sicm_device* device, size_t size, size_t accesses, int load_threads, sicm_latency_stats* res);
+
+/// Measure the latency of a device against increasing load
+/**
+ * @param[in] device Device to measure.
+ * @param[in] size Bytes to allocate, well past the size of the caches.
+ * @param[in] accesses Number of dependent accesses to time at each step.
+ * @param[in] max_threads Most load threads.
+ * @param[out] res Array of max_threads + 1 results, res[n] with n load threads.
+ * @return zero if the operation is successful
+ *
+ * Like sicm_latency_chase, with the same allocation for every step.
+ * Plotting the latencies against the load bandwidths gives the
+ * latency-versus-load curve of the device.
+ */
+int sicm_latency_curve(sicm_device* device, size_t size, size_t accesses, int max_threads, sicm_latency_stats* res);
+
+/// Access pattern of sicm_bandwidth, after the STREAM kernels.
+typedef enum sicm_bandwidth_op {
+  SICM_BW_READ,   ///< Sums the buffer.
+  SICM_BW_WRITE,  ///< Fills the buffer.
+  SICM_BW_COPY,   ///< Copies one half of the buffer to the other.
+  SICM_BW_TRIAD,  ///< a = b + scalar * c over thirds of the buffer.
+} sicm_bandwidth_op;
+
+/// Stores of sicm_bandwidth bypass the caches.
+#define SICM_BW_NONTEMPORAL 1
+
+/// Measure the bandwidth of a device from a NUMA node
+/**
+ * @param[in] device Device to measure.
+ * @param[in] node NUMA node whose CPUs run the kernel.
+ * @param[in] op Kernel to run.
+ * @param[in] flags SICM_BW_NONTEMPORAL or 0.
+ * @param[in] size Bytes to allocate, well past the size of the caches.
+ * @param[in] threads Number of threads, or 0 for one per CPU of node.
+ * @param[out] gbps Bytes read and written per nanosecond.
+ * @return zero if the operation is successful
+ *
+ * Every thread is pinned to a CPU of node and first touches its own slice
+ * of the allocation, then all of them run the kernel over their slices
+ * together. The kernels use the widest vectors that the CPU has, see
+ * sicm_bandwidth_isa. Copy counts both halves and triad all three
+ * thirds, like STREAM, without the reads for ownership of the stores.
+ */
+int sicm_bandwidth(sicm_device* device, int node, sicm_bandwidth_op op, int flags, size_t size, int threads, double* gbps);
+
+/// Measure the bandwidth of every device from every NUMA node
+/**
+ * @param[in] op Kernel to run.
+ * @param[in] flags SICM_BW_NONTEMPORAL or 0.
+ * @param[in] size Bytes to allocate for each measurement.
+ * @param[out] matrix (numa_max_node() + 1) rows of one column per device.
+ * @return zero if the operation is successful
+ *
+ * Row n holds the GB/s that sicm_bandwidth measures with all the CPUs of
+ * node n, and the columns follow the order of the devices that sicm_init
+ * returns. Nodes without CPUs and devices that couldn't be measured are
+ * left at 0.
+ */
+int sicm_bandwidth_matrix(sicm_bandwidth_op op, int flags, size_t size, double* matrix);
+
+/// Name of the instruction set of the sicm_bandwidth kernels
+/**
+ * One of "avx512", "avx2" or "sse2" on x86-64, and "scalar" elsewhere.
+ * The widest one that the CPU has is picked once, unless the
+ * SICM_BANDWIDTH_ISA environment variable names another that it has.
+ */
+const char *sicm_bandwidth_isa(void);
+
 /// Measure empirical bandwidth, using linear access on a kernel function of arity 2.
 /**
  * @param[in] device Pointer to the sicm_device to query.
@@ -1,4 +1,5 @@
 #include <fcntl.h>
+#include <limits.h>
 #include <numa.h>
 #include <stdlib.h>
 #include <sys/mman.h>
@@ -33,6 +34,7 @@ float profile_rss_rate;
 struct sicm_device *profile_one_device;
 struct sicm_device *online_device;
 ssize_t online_device_cap, online_device_packed_size;
+double online_ns_saved; /* Per access on the online device, from sicm_device_characterize */
 char *profile_one_event;
 char *profile_all_event;
 int max_sample_pages;
@@ -54,13 +56,28 @@ static int max_arenas, arenas_per_thread;
 int max_index;
 pthread_mutex_t arena_lock = PTHREAD_MUTEX_INITIALIZER;
 
+/* Bounds the number of arenas that we actually create. Arenas past the
+ * bound share the arena of their group instead. Room for every possible
+ * group is kept aside.
+ */
+static int max_physical_arenas, num_physical_arenas;
+int num_hotness_buckets;
+static arena_group *arena_groups;
+static int num_arena_groups, max_arena_groups;
+
 /* Associates a thread with an index (starting at 0) into the `arenas` array */
 static pthread_key_t thread_key;
 static int *thread_indices, *orig_thread_indices, *max_thread_indices, max_threads;
 static int num_static_sites;
 
-/* Passes an arena index to the extent hooks */
-static int *pending_indices;
+/* The site that this thread is allocating for. New extents of a group's
+ * arena are charged to it, since the arena alone doesn't say which site
+ * they're for. Extent events are sent by the allocating thread, before the
+ * allocation returns.
+ */
+static __thread arena_info *current_site;
+
+static void sh_extent_event(const sicm_extent_event *event);
 
 /* Takes a string as input and outputs which arena layout it is */
 enum arena_layout parse_layout(char *env) {
@@ -146,12 +163,22 @@ sicm_device *get_device_from_numa_node(int id) {
   return retval;
 }
 
+/* Latency of a measured device under load, if that could be measured */
+static double model_latency(sicm_device_model *model) {
+  if(model->loaded_latency > 0) {
+    return model->loaded_latency;
+  }
+  return model->idle_latency;
+}
 
 /* Gets environment variables and sets up globals */
 void set_options() {
   char *env, *str, *line, guidance, found_guidance;
   long long tmp_val;
+  size_t migration_rate, sz;
+  unsigned narenas;
   struct sicm_device *device;
+  sicm_device_model model, default_model;
   int i, node;
   FILE *guidance_file;
   ssize_t len;
@@ -169,6 +196,39 @@ void set_options() {
     printf("Doing online profiling, packing onto NUMA node %lld with a capacity of %zd.\n", tmp_val, online_device_cap);
   }
 
+  /* How fast should arenas be moved between devices? Either in bytes per second,
+   * or as a percentage of the measured bandwidth of the online device (e.g. "10%").
+   * Unlimited by default.
+   */
+  env = getenv("SH_MIGRATION_RATE");
+  migration_rate = 0;
+  if(env) {
+    tmp_val = strtoimax(env, &str, 10);
+    if((tmp_val <= 0) || ((*str == '%') && (tmp_val > 100))) {
+      printf("Invalid migration rate given. Not limiting migrations.\n");
+    } else if(*str == '%') {
+      device = online_device;
+      if(!device) {
+        device = get_device_from_numa_node(0);
+      }
+      if(sicm_get_device_model(-1, device, &model) == 0) {
+        /* GB/s is bytes per nanosecond */
+        migration_rate = model.read_bandwidth * 1000000000 / 100 * tmp_val;
+      } else {
+        /* Three 32MB arrays, sicm_bandwidth_linear3 returns bytes per microsecond */
+        migration_rate = sicm_bandwidth_linear3(device, 4 * 1024 * 1024, sicm_triad_kernel_linear) * 1000000 / 100 * tmp_val;
+      }
+    } else {
+      migration_rate = (size_t) tmp_val;
+    }
+  }
+  sicm_set_migration_rate(migration_rate);
+  if(migration_rate) {
+    printf("Migration rate: %zu bytes/s\n", migration_rate);
+  } else {
+    printf("Migration rate: unlimited\n");
+  }
+
   /* Get the arena layout */
   env = getenv("SH_ARENA_LAYOUT");
   if(env) {
@@ -210,6 +270,41 @@ void set_options() {
   }
   printf("Maximum arenas: %d\n", max_arenas);
 
+  /* Get max_physical_arenas.
+   * jemalloc's automatic arenas count towards its limit too, so by default
+   * we take what they leave. Past this, arenas are aggregated into groups.
+   */
+  sz = sizeof(unsigned);
+  if(je_mallctl("arenas.narenas", (void *) &narenas, &sz, NULL, 0) != 0) {
+    narenas = 0;
+  }
+  max_physical_arenas = SICM_MAX_ARENAS - 1 - (int) narenas;
+  env = getenv("SH_MAX_PHYSICAL_ARENAS");
+  if(env) {
+    tmp_val = strtoimax(env, NULL, 10);
+    if((tmp_val <= 0) || (tmp_val > max_physical_arenas)) {
+      printf("Invalid physical arena number given. Defaulting to %d.\n", max_physical_arenas);
+    } else {
+      max_physical_arenas = (int) tmp_val;
+    }
+  }
+  printf("Maximum physical arenas: %d\n", max_physical_arenas);
+
+  /* How many hotness buckets should aggregated sites be split into, per device?
+   * The online profiler moves sites between buckets as their accesses per byte change.
+   */
+  env = getenv("SH_HOTNESS_BUCKETS");
+  num_hotness_buckets = 1;
+  if(env) {
+    tmp_val = strtoimax(env, NULL, 10);
+    if((tmp_val <= 0) || (tmp_val > 64)) {
+      printf("Invalid number of hotness buckets given. Defaulting to %d.\n", num_hotness_buckets);
+    } else {
+      num_hotness_buckets = (int) tmp_val;
+    }
+  }
+  printf("Hotness buckets: %d\n", num_hotness_buckets);
+
   /* Should we profile all allocation sites using sampling-based profiling? */
   env = getenv("SH_PROFILE_ALL");
   should_profile_all = 0;
@@ -368,6 +463,17 @@ void set_options() {
   }
   printf("Default device: %s\n", sicm_device_tag_str(default_device->tag));
 
+  /* If both devices have been measured from this node, the profiler can
+   * tell how much time its choices save.
+   */
+  online_ns_saved = 0;
+  if(should_profile_online &&
+     (sicm_get_device_model(-1, online_device, &model) == 0) &&
+     (sicm_get_device_model(-1, default_device, &default_model) == 0)) {
+    online_ns_saved = model_latency(&default_model) - model_latency(&model);
+    printf("Latency saved per access: %f ns\n", online_ns_saved);
+  }
+
   /* Get arenas_per_thread */
   switch(layout) {
     case SHARED_ONE_ARENA:
@@ -499,8 +605,52 @@ int get_thread_index() {
   return *val;
 }
 
+/* Puts an arena into the group for the device and bucket, creating the
+ * group's arena if it doesn't exist yet. Call with arena_lock held.
+ */
+static void sh_join_group(arena_info *info, sicm_device *device, int bucket) {
+  sicm_device_list devs;
+  arena_group *group;
+  int i;
+
+  group = NULL;
+  for(i = 0; i < num_arena_groups; i++) {
+    if((arena_groups[i].device == device) && (arena_groups[i].bucket == bucket)) {
+      group = &arena_groups[i];
+      break;
+    }
+  }
+
+  if(!group) {
+    if(num_arena_groups == max_arena_groups) {
+      fprintf(stderr, "Maximum number of arena groups reached. Aborting.\n");
+      exit(1);
+    }
+    group = &arena_groups[num_arena_groups];
+    devs.count = 1;
+    devs.devices = &device;
+    /* Many sites and threads allocate from the same arena */
+    group->arena = sicm_arena_create(0, SICM_ARENA_TCACHE, &devs);
+    if(!group->arena) {
+      fprintf(stderr, "Failed to create an arena for a group. Aborting.\n");
+      exit(1);
+    }
+    sicm_arena_set_events(group->arena, &sh_extent_event, NULL, NULL);
+    group->device = device;
+    group->bucket = bucket;
+    group->sites = 0;
+    num_arena_groups++;
+  }
+
+  group->sites++;
+  info->group = group;
+  __atomic_store_n(&info->arena, group->arena, __ATOMIC_RELEASE);
+}
+
 /* Adds an arena to the `arenas` array. */
 void sh_create_arena(int index, int id, sicm_device *device) {
+  sicm_device_list devs;
+
   if(index > (max_arenas - 1)) {
     /* TODO: handle this more gracefully */
     fprintf(stderr, "Maximum number of arenas reached. Aborting.\n");
@@ -528,39 +678,207 @@ void sh_create_arena(int index, int id, sicm_device *device) {
   arenas[index]->id = id;
   arenas[index]->rss = 0;
   arenas[index]->peak_rss = 0;
-  arenas[index]->arena = sicm_arena_create(0, device);
+  arenas[index]->group = NULL;
+  arenas[index]->arena = NULL;
+
+  /* The arena gets one to itself as long as there's room left, and then its
+   * numbers are exact. In a group's arena, an extent is charged to the site
+   * whose allocation made the arena grow, through `current_site`. jemalloc
+   * shares slabs between the group's sites and reuses freed space for any of
+   * them, so the numbers of aggregated sites are only an approximation.
+   */
+  if(num_physical_arenas + max_arena_groups < max_physical_arenas) {
+    devs.count = 1;
+    devs.devices = &device;
+    arenas[index]->arena = sicm_arena_create(0, 0, &devs);
+  }
+  if(arenas[index]->arena) {
+    num_physical_arenas++;
+    sicm_arena_set_events(arenas[index]->arena, &sh_extent_event, NULL, arenas[index]);
+  } else {
+    sh_join_group(arenas[index], device, 0);
+  }
 }
 
-/* Adds an extent to the `extents` array. */
-void sh_create_extent(void *start, void *end) {
-  int thread_index, arena_index;
+/* Moves an arena to a device in the background, so that reconfiguring
+ * doesn't stall threads that allocate from it. Arenas with a higher
+ * priority are moved first.
+ */
+static void move_arena(sicm_arena arena, struct sicm_device *device, double priority) {
+  sicm_device_list devs;
+  sicm_migration *migration;
+
+  devs.count = 1;
+  devs.devices = &device;
+  migration = sicm_arena_set_device_list_async(arena, &devs);
+  if(!migration) {
+    /* Changing the page size can't be done in the background */
+    if(sicm_arena_set_device(arena, device) != 0) {
+      fprintf(stderr, "Failed to move an arena.\n");
+    }
+    return;
+  }
+  sicm_migration_set_priority(migration, priority);
+  sicm_migration_free(migration);
+}
 
-  /* Get this thread's current arena index from `pending_indices` */
-  thread_index = get_thread_index();
-  arena_index = pending_indices[thread_index];
+/* Removes every extent that's charged to a site from an extent array. */
+static void sh_remove_site(extent_arr *arr, arena_info *info) {
+  size_t i;
+
+  i = 0;
+  while(i < arr->index) {
+    if(arr->arr[i].arena == info) {
+      extent_arr_delete(arr, arr->arr[i].start);
+    } else {
+      i++;
+    }
+  }
+}
+
+/* Binds a site's arena to a device and hotness bucket. Arenas of their own
+ * are moved as a whole, and the bucket doesn't matter for them. Aggregated
+ * arenas switch groups, so that new allocations go to the new group. What
+ * they already allocated stays with the old group: its extents hold objects
+ * of the group's other sites too, and the old arena keeps reusing them. Those
+ * extents stop counting for the site, so that its profile only covers what
+ * it allocated in its current group.
+ */
+void sh_move_site(int index, sicm_device *device, int bucket, double priority) {
+  arena_info *info;
+  arena_group *old;
+  int moved;
+
+  info = arenas[index];
+  if(!info) {
+    return;
+  }
+
+  if(!info->group) {
+    move_arena(info->arena, device, priority);
+    return;
+  }
+
+  moved = 0;
+  pthread_mutex_lock(&arena_lock);
+  old = info->group;
+  if((old->device != device) || (old->bucket != bucket)) {
+    old->sites--;
+    sh_join_group(info, device, bucket);
+    moved = 1;
+  }
+  pthread_mutex_unlock(&arena_lock);
+
+  if(!moved) {
+    return;
+  }
 
-  /* A extent allocation is happening without an sh_alloc... */
-  if(arena_index == 0) {
-    fprintf(stderr, "Unknown extent allocation. Aborting.\n");
+  /* Creating the new group's arena can grow other arenas, so don't take
+   * the extents lock under arena_lock.
+   */
+  if(pthread_rwlock_wrlock(&extents_lock) != 0) {
+    fprintf(stderr, "Failed to acquire read/write lock. Aborting.\n");
+    exit(1);
+  }
+  sh_remove_site(extents, info);
+  if(rss_extents && (rss_extents != extents)) {
+    sh_remove_site(rss_extents, info);
+  }
+  if(pthread_rwlock_unlock(&extents_lock) != 0) {
+    fprintf(stderr, "Failed to unlock read/write lock. Aborting.\n");
     exit(1);
   }
+}
 
-  if(should_profile_rss && (arenas[arena_index]->id == should_profile_one)) {
+/* Adds an extent to the `extents` array. */
+void sh_create_extent(arena_info *info, void *start, void *end) {
+  if(should_profile_rss && (info->id == should_profile_one)) {
     /* If we're profiling RSS and this is the site that we're isolating */
-    extent_arr_insert(rss_extents, start, end, arenas[arena_index]);
+    extent_arr_insert(rss_extents, start, end, info);
   }
 
   if(pthread_rwlock_wrlock(&extents_lock) != 0) {
     fprintf(stderr, "Failed to acquire read/write lock. Aborting.\n");
     exit(1);
   }
-  extent_arr_insert(extents, start, end, arenas[arena_index]);
+  extent_arr_insert(extents, start, end, info);
   if(pthread_rwlock_unlock(&extents_lock) != 0) {
     fprintf(stderr, "Failed to unlock read/write lock. Aborting.\n");
     exit(1);
   }
 }
 
+/* Removes [start, end) from an extent array. jemalloc splits and merges
+ * extents without telling us, so the range can cover parts of several
+ * entries.
+ */
+static void sh_remove_range(extent_arr *arr, char *start, char *end) {
+  size_t i;
+
+  i = 0;
+  while(i < arr->index) {
+    if((char *) arr->arr[i].end <= start || (char *) arr->arr[i].start >= end) {
+      i++;
+      continue;
+    }
+
+    if((char *) arr->arr[i].start < start) {
+      extent_arr_split(arr, arr->arr[i].start, start);
+      i++;
+      continue;
+    }
+
+    if((char *) arr->arr[i].end > end) {
+      extent_arr_split(arr, arr->arr[i].start, end);
+    }
+    extent_arr_delete(arr, arr->arr[i].start);
+  }
+}
+
+/* Removes an extent that the arena allocator gave back from the `extents` array. */
+void sh_delete_extent(void *start, void *end) {
+  if(pthread_rwlock_wrlock(&extents_lock) != 0) {
+    fprintf(stderr, "Failed to acquire read/write lock. Aborting.\n");
+    exit(1);
+  }
+  sh_remove_range(extents, start, end);
+  if(rss_extents && (rss_extents != extents)) {
+    sh_remove_range(rss_extents, start, end);
+  }
+  if(pthread_rwlock_unlock(&extents_lock) != 0) {
+    fprintf(stderr, "Failed to unlock read/write lock. Aborting.\n");
+    exit(1);
+  }
+}
+
+/* Receives the extent events of every arena that we create. Only the
+ * allocations and frees matter to the profiler: splits and merges keep the
+ * range charged to the same site, and migrations don't change the site.
+ */
+static void sh_extent_event(const sicm_extent_event *event) {
+  arena_info *info;
+
+  switch(event->type) {
+    case SICM_EXTENT_ALLOC:
+      info = event->cookie;
+      if(!info) {
+        /* A group's arena: charge the site that this thread is allocating for */
+        info = current_site;
+      }
+      if(!info) {
+        /* jemalloc grew the arena for its own metadata */
+        return;
+      }
+      sh_create_extent(info, event->start, event->end);
+      break;
+    case SICM_EXTENT_DALLOC:
+      sh_delete_extent(event->start, event->end);
+      break;
+    default:
+      break;
+  }
+}
+
 /* Gets the device that this site should go onto from the site_nodes tree */
 sicm_device *get_site_device(int id) {
   sicm_device *device;
@@ -653,10 +971,10 @@ int get_arena_index(int id) {
       break;
   };
 
-  pending_indices[thread_index] = ret;
   pthread_mutex_lock(&arena_lock);
   sh_create_arena(ret, id, device);
   pthread_mutex_unlock(&arena_lock);
+  current_site = arenas[ret];
 
   return ret;
 }
@@ -669,7 +987,7 @@ void* sh_realloc(int id, void *ptr, size_t sz) {
     ret = realloc(ptr, sz);
   } else {
     index = get_arena_index(id);
-    ret = sicm_arena_realloc(arenas[index]->arena, ptr, sz);
+    ret = sicm_arena_realloc(__atomic_load_n(&arenas[index]->arena, __ATOMIC_ACQUIRE), ptr, sz);
   }
 
   if (should_run_rdspy) {
@@ -688,7 +1006,7 @@ void* sh_alloc(int id, size_t sz) {
     ret = je_malloc(sz);
   } else {
     index = get_arena_index(id);
-    ret = sicm_arena_alloc(arenas[index]->arena, sz);
+    ret = sicm_arena_alloc(__atomic_load_n(&arenas[index]->arena, __ATOMIC_ACQUIRE), sz);
   }
 
   if (should_run_rdspy) {
@@ -763,6 +1081,10 @@ void sh_init() {
         break;
     }
 
+    /* At most one group per device and hotness bucket */
+    max_arena_groups = device_list.count * num_hotness_buckets;
+    arena_groups = (arena_group *) calloc(max_arena_groups, sizeof(arena_group));
+
     /* Initialize the extents array.
      * If we're just doing MBI on one site, initialize a new array that has extents from just that site.
      * If we're profiling all sites, rss_extents is just all extents.
@@ -786,12 +1108,6 @@ void sh_init() {
     pthread_setspecific(thread_key, (void *) thread_indices);
     thread_indices++;
 
-    /* Stores an index into `arenas` for the extent hooks */
-    pending_indices = (int *) calloc(max_threads, sizeof(int));
-
-    /* Set the arena allocator's callback function */
-    sicm_extent_alloc_callback = &sh_create_extent;
-
     sh_start_profile_thread();
   }
   
@@ -817,12 +1133,17 @@ void sh_terminate() {
     /* Clean up the arenas */
     for(i = 0; i <= max_index; i++) {
       if(!arenas[i]) continue;
-      sicm_arena_destroy(arenas[i]->arena);
+      if(!arenas[i]->group) {
+        sicm_arena_destroy(arenas[i]->arena);
+      }
       free(arenas[i]);
     }
     free(arenas);
+    for(i = 0; i < num_arena_groups; i++) {
+      sicm_arena_destroy(arena_groups[i].arena);
+    }
+    free(arena_groups);
 
-    free(pending_indices);
     free(orig_thread_indices);
     extent_arr_free(extents);
   }
@@ -334,6 +334,45 @@ tree(unsigned, siteptr) get_thermos(tree(unsigned, siteptr) sites, size_t capaci
 	return ret;
 }
 
+/* Gets the first device on a NUMA node, which has the normal page size */
+static sicm_device *get_node_device(sicm_device_list *devs, int node) {
+  unsigned i;
+
+  for(i = 0; i < devs->count; i++) {
+    if((devs->devices[i]->tag != SICM_HIP) && (sicm_numa_id(devs->devices[i]) == node)) {
+      return devs->devices[i];
+    }
+  }
+  return NULL;
+}
+
+/* How much faster an access is on `node` than on the default node of the
+ * high-level runtime, according to sicm_device_characterize. Returns 0 if
+ * either device hasn't been measured.
+ */
+static double get_latency_saved(int node) {
+  sicm_device_list devs;
+  sicm_device *upper, *lower;
+  sicm_device_model upper_model, lower_model;
+  double saved;
+  char *env;
+
+  env = getenv("SH_DEFAULT_NODE");
+  devs = sicm_init();
+  upper = get_node_device(&devs, node);
+  lower = get_node_device(&devs, env ? (int) strtoimax(env, NULL, 10) : 0);
+
+  saved = 0;
+  if(upper && lower &&
+     (sicm_get_device_model(-1, upper, &upper_model) == 0) &&
+     (sicm_get_device_model(-1, lower, &lower_model) == 0)) {
+    saved = lower_model.idle_latency - upper_model.idle_latency;
+  }
+  sicm_fini();
+
+  return saved;
+}
+
 /* Reads in profiling information from stdin, then runs the packing algorithm
  * based on arguments. Prints the hotset to stdout.
  */
@@ -341,6 +380,8 @@ int main(int argc, char **argv) {
   char proftype, algo, captype, *endptr;
   size_t cap_bytes, total_weight;
   union metric total_value;
+  double latency_saved;
+  char *env;
   long long node;
   float cap_float;
   tree(unsigned, siteptr) sites, chosen_sites;
@@ -442,6 +483,16 @@ int main(int argc, char **argv) {
     printf("Capacity Ratio: %f\n", cap_float);
   }
   printf("Peak RSS: %zu bytes\n", info->site_peak_rss);
+  if(proftype == 1) {
+    latency_saved = get_latency_saved((int) node);
+    if(latency_saved != 0) {
+      /* Each sample stands for SH_SAMPLE_FREQ accesses, as in the runtime */
+      env = getenv("SH_SAMPLE_FREQ");
+      printf("Latency saved per access: %f ns\n", latency_saved);
+      printf("Expected time saved: %f s\n",
+             (double) total_value.acc * (env ? strtoimax(env, NULL, 10) : 2048) * latency_saved / 1000000000);
+    }
+  }
 
   /* Clean up */
   tree_traverse(info->sites, it) {
@@ -246,17 +246,37 @@ void sh_stop_profile_thread() {
   }
 }
 
+/* Which hotness bucket an arena goes into, by its accesses per byte
+ * relative to the hottest arena's.
+ */
+static int
+hotness_bucket(size_t i, double max_acc_per_byte) {
+  double acc_per_byte;
+  int bucket;
+
+  if(!arenas[i]->peak_rss || (max_acc_per_byte <= 0)) {
+    return 0;
+  }
+  acc_per_byte = ((double)arenas[i]->accesses) / ((double) arenas[i]->peak_rss);
+  bucket = (int) (acc_per_byte / max_acc_per_byte * num_hotness_buckets);
+  if(bucket >= num_hotness_buckets) {
+    bucket = num_hotness_buckets - 1;
+  }
+  return bucket;
+}
+
 /* Adds up accesses to the arenas */
 static void
 get_accesses() {
   uint64_t head, tail, buf_size;
   arena_info *arena;
+  extent_info *extent;
   void *addr;
   char *base, *begin, *end, break_next_site;
   size_t i, packed_size, total_value;
   struct sample *sample;
   struct perf_event_header *header;
-  double acc_per_byte;
+  double acc_per_byte, max_acc_per_byte;
   tree(double, size_t) sorted_arenas;
   tree(size_t, deviceptr) new_knapsack;
   tree_it(double, size_t) it;
@@ -300,12 +320,10 @@ get_accesses() {
     if(addr) {
       prof.total++;
       /* Search for which extent it goes into */
-      extent_arr_for(extents, i) {
-        if(!extents->arr[i].start && !extents->arr[i].end) continue;
-        arena = extents->arr[i].arena;
-        if((addr >= extents->arr[i].start) && (addr <= extents->arr[i].end)) {
-          arena->accesses++;
-        }
+      extent = extent_arr_lookup(extents, addr);
+      if(extent) {
+        arena = extent->arena;
+        arena->accesses++;
       }
     }
 
@@ -363,6 +381,19 @@ get_accesses() {
     printf("Total value: %zu\n", total_value);
     printf("Packed size: %zu\n", packed_size);
     printf("Capacity:    %zd\n", online_device_cap);
+    if(online_ns_saved != 0) {
+      /* Each sample stands for sample_freq accesses */
+      printf("Expected time saved: %f s\n", (double) total_value * sample_freq * online_ns_saved / 1000000000);
+    }
+
+    /* Sites that leave the upper tier make room for the ones that come in, so
+     * they go as early as the hottest of those. The others go hottest first.
+     */
+    max_acc_per_byte = 0;
+    it = tree_last(sorted_arenas);
+    if(tree_it_good(it)) {
+      max_acc_per_byte = tree_it_key(it);
+    }
 
     /* Get rid of sites that aren't in the new knapsack but are in the old */
     tree_traverse(site_nodes, sit) {
@@ -371,7 +402,7 @@ get_accesses() {
       if(!tree_it_good(kit)) {
         /* The site isn't in the new, so remove it from the upper tier */
         tree_delete(site_nodes, tree_it_key(sit));
-        sicm_arena_set_device(arenas[i]->arena, default_device);
+        sh_move_site(i, default_device, hotness_bucket(i, max_acc_per_byte), max_acc_per_byte);
         printf("Moving %u out of the MCDRAM\n", tree_it_key(sit));
       }
     }
@@ -383,11 +414,23 @@ get_accesses() {
       if(!tree_it_good(sit)) {
         /* This site is in the new but not the old */
         tree_insert(site_nodes, arenas[tree_it_key(kit)]->id, online_device);
-        sicm_arena_set_device(arenas[tree_it_key(kit)]->arena, online_device);
+        acc_per_byte = ((double)arenas[tree_it_key(kit)]->accesses) / ((double) arenas[tree_it_key(kit)]->peak_rss);
+        sh_move_site(tree_it_key(kit), online_device, hotness_bucket(tree_it_key(kit), max_acc_per_byte), acc_per_byte);
         printf("Moving %u into the MCDRAM\n", arenas[tree_it_key(kit)]->id);
       }
     }
 
+    /* Aggregated sites that stay on their device can still change buckets */
+    if(num_hotness_buckets > 1) {
+      tree_traverse(sorted_arenas, it) {
+        i = tree_it_val(it);
+        if(!arenas[i]->group) continue;
+        sh_move_site(i, arenas[i]->group->device, hotness_bucket(i, max_acc_per_byte), tree_it_key(it));
+      }
+    }
+
+    printf("Pending migrations: %zu bytes\n", sicm_migration_pending());
+
     tree_free(sorted_arenas);
   }
 }
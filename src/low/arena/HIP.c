@@ -68,6 +68,7 @@ success:
 
 	/* Add the extent to the array of extents */
 	extent_arr_insert(sa->extents, ret, (char *)ret + size, NULL);
+	sarena_event(sa, SICM_EXTENT_ALLOC, ret, NULL, (char *)ret + size);
 
 done:
 	if (hipSetDevice(prev) != hipSuccess) {
@@ -95,9 +96,10 @@ static bool sa_hip_dalloc(extent_hooks_t *h, void *addr, size_t size, bool commi
 	}
 	else {
 		extent_arr_delete(sa->extents, addr);
+		sarena_event(sa, SICM_EXTENT_DALLOC, addr, NULL, (char *)addr + size);
 		ret = false;
 	}
-	sa->size -= size;
+	__atomic_sub_fetch(&sa->size, size, __ATOMIC_RELAXED);
 	pthread_mutex_unlock(sa->mutex);
 	return ret;
 }
@@ -1,182 +1,953 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
 #include <numa.h>
 #include <numaif.h>
+#include <string.h>
+#include <dirent.h>
+#include <pthread.h>
 #include <unistd.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
+// https://www.mail-archive.com/devel@lists.open-mpi.org/msg20403.html
+#ifndef MAP_HUGE_SHIFT
+#include <linux/mman.h>
+#endif
 
 #include "sicm_impl.h"
 
 void (*sicm_extent_alloc_callback)(void *start, void *end) = NULL;
+void (*sicm_extent_dalloc_callback)(void *start, void *end) = NULL;
 
+// the file of a shared arena is grown at least this much at a time
+#define SA_SHARED_GROW (64 * 1024 * 1024)
+
+// extra mmap flags for private anonymous mappings backed by pages of size pgsz
+static int sa_mmap_flags(size_t pgsz) {
+	int shift;
+
+	if (pgsz <= (size_t) sysconf(_SC_PAGESIZE))
+		return 0;
+
+	for(shift = 0; ((size_t) 1 << shift) < pgsz; shift++);
+	return MAP_HUGETLB | (shift << MAP_HUGE_SHIFT);
+}
+
+// size of the transparent huge pages, if the kernel has them
+static size_t sa_thp_size() {
+	static size_t thp_size;
+	unsigned long sz;
+	FILE *f;
+
+	if (thp_size == 0) {
+		sz = 2 * 1024 * 1024;
+		f = fopen("/sys/kernel/mm/transparent_hugepage/hpage_pmd_size", "r");
+		if (f != NULL) {
+			if (fscanf(f, "%lu", &sz) != 1)
+				sz = 2 * 1024 * 1024;
+			fclose(f);
+		}
+		thp_size = sz;
+	}
+
+	return thp_size;
+}
+
+static size_t sa_huge_sizes[16];
+static int sa_huge_nsizes;
+static pthread_once_t sa_huge_once = PTHREAD_ONCE_INIT;
+
+static void sa_huge_init() {
+	struct dirent *entry;
+	unsigned long kb;
+	DIR *dir;
+
+	dir = opendir("/sys/kernel/mm/hugepages");
+	if (dir == NULL)
+		return;
+
+	while ((entry = readdir(dir)) != NULL && sa_huge_nsizes < 16) {
+		if (sscanf(entry->d_name, "hugepages-%lukB", &kb) == 1)
+			sa_huge_sizes[sa_huge_nsizes++] = kb * 1024;
+	}
+	closedir(dir);
+}
+
+// The biggest huge page size that the kernel has and that fits in size, or
+// 0. Big extents of base pages are aligned to it, so that sarena_remap can
+// later move them onto huge pages.
+static size_t sa_huge_align(size_t size) {
+	size_t best;
+	int i;
+
+	pthread_once(&sa_huge_once, sa_huge_init);
+
+	best = 0;
+	for(i = 0; i < sa_huge_nsizes; i++) {
+		if (sa_huge_sizes[i] <= size && sa_huge_sizes[i] > best)
+			best = sa_huge_sizes[i];
+	}
+
+	return best;
+}
+
+// Give back the whole pages of [addr, addr + size), which read back as
+// zeros. Huge pages can only be dropped by newer kernels; on older ones
+// they stay until their region is unmapped.
+static void sa_drop(void *addr, size_t size, size_t pgsz) {
+	uintptr_t start, end;
+
+	start = ((uintptr_t) addr + pgsz - 1) & ~((uintptr_t) pgsz - 1);
+	end = ((uintptr_t) addr + size) & ~((uintptr_t) pgsz - 1);
+	if (start < end)
+		madvise((void *) start, end - start, MADV_DONTNEED);
+}
+
+// fault in a fresh private anonymous extent after it was bound to its nodes
+static void sa_populate(void *addr, size_t size, size_t pgsz) {
+	char *p;
+
+#ifdef MADV_POPULATE_WRITE
+	// failures other than missing kernel support are fine, MAP_POPULATE ignored them too
+	if (madvise(addr, size, MADV_POPULATE_WRITE) == 0 || errno != EINVAL)
+		return;
+#endif
+
+	for(p = addr; p < (char *) addr + size; p += pgsz)
+		*(volatile char *) p = 0;
+}
+
+// Map size bytes aligned to alignment. Returns NULL on failure, quietly if
+// there just aren't enough free huge pages.
+static void *sa_map(void *new_addr, size_t size, size_t alignment, int mmflags, int fd, off_t offset) {
+	uintptr_t n, m;
+	void *ret, *base;
+
+	if (new_addr != NULL || alignment <= (size_t) sysconf(_SC_PAGESIZE)) {
+		ret = mmap(new_addr, size, PROT_READ | PROT_WRITE, mmflags, fd, offset);
+		if (ret == MAP_FAILED) {
+			if (!(mmflags & MAP_HUGETLB))
+				perror("mmap");
+			return NULL;
+		}
+
+		// if new_addr is set, we can't put the extent anywhere else
+		if ((new_addr != NULL && ret != new_addr) || (alignment != 0 && ((uintptr_t) ret)%alignment != 0)) {
+			munmap(ret, size);
+			return NULL;
+		}
+
+		return ret;
+	}
+
+	// reserve enough address space to find an aligned range in it,
+	// map the extent over that range and give back the rest
+	base = mmap(NULL, size + alignment, PROT_NONE, MAP_ANONYMOUS|MAP_PRIVATE|MAP_NORESERVE, -1, 0);
+	if (base == MAP_FAILED) {
+		perror("mmap");
+		return NULL;
+	}
+
+	n = (uintptr_t) base;
+	m = (n + alignment - 1) & ~((uintptr_t) alignment - 1);
+	if (m > n)
+		munmap(base, m - n);
+	if (n + alignment > m)
+		munmap((void *) (m + size), n + alignment - m);
+
+	ret = mmap((void *) m, size, PROT_READ | PROT_WRITE, mmflags | MAP_FIXED, fd, offset);
+	if (ret == MAP_FAILED) {
+		if (!(mmflags & MAP_HUGETLB))
+			perror("mmap2");
+		munmap((void *) m, size);
+		return NULL;
+	}
+
+	return ret;
+}
+
+// Take an extent out of a hole, or else out of the unused tail of the last
+// region. Sets *hole if it came from a hole, whose pages may still hold old
+// data. Should be called with sa->mutex held.
+static void *sa_carve(sarena *sa, void *new_addr, size_t size, size_t alignment, int *hole) {
+	extent_info h, *e;
+	uintptr_t p;
+	size_t i;
+
+	*hole = 0;
+	for(i = 0; i < sa->holes->index; i++) {
+		e = &sa->holes->arr[i];
+		if (new_addr != NULL) {
+			e = extent_arr_lookup(sa->holes, new_addr);
+			if (e == NULL)
+				break;
+		}
+
+		p = (new_addr != NULL)?(uintptr_t) new_addr:(uintptr_t) e->start;
+		if (alignment > 1)
+			p = (p + alignment - 1) & ~((uintptr_t) alignment - 1);
+		if ((new_addr != NULL && (uintptr_t) new_addr != p) || p + size > (uintptr_t) e->end) {
+			if (new_addr != NULL)
+				break;
+			continue;
+		}
+
+		// whatever is left on either side stays a hole
+		h = *e;
+		extent_arr_delete(sa->holes, h.start);
+		if (p > (uintptr_t) h.start)
+			extent_arr_insert(sa->holes, h.start, (void *) p, NULL);
+		if (p + size < (uintptr_t) h.end)
+			extent_arr_insert(sa->holes, (void *) (p + size), h.end, NULL);
+		*hole = 1;
+		return (void *) p;
+	}
+
+	if (sa->tail == NULL)
+		return NULL;
+
+	p = (uintptr_t) sa->tail;
+	if (alignment > 1)
+		p = (p + alignment - 1) & ~((uintptr_t) alignment - 1);
+
+	if ((new_addr != NULL && (uintptr_t) new_addr != p) || p + size > (uintptr_t) sa->tail_end)
+		return NULL;
+
+	sa->tail = (char *) p + size;
+	return (void *) p;
+}
+
+// Lock the header of a shared arena. A process that died with the lock held
+// may have grown the file without recording it, so the file itself says how
+// much of the data it covers.
+static int sa_shared_lock(sarena *sa) {
+	sarena_shared *sh;
+	struct stat st;
+	uint64_t filesize;
+	int err;
+
+	sh = sa->shared;
+	err = pthread_mutex_lock(&sh->mutex);
+	if (err == EOWNERDEAD) {
+		if (fstat(sa->fd, &st) == 0 && (uint64_t) st.st_size > sh->data) {
+			filesize = st.st_size - sh->data;
+			if (filesize > sh->size)
+				filesize = sh->size;
+			if (filesize > sh->filesize)
+				__atomic_store_n(&sh->filesize, filesize, __ATOMIC_RELEASE);
+		}
+		pthread_mutex_consistent(&sh->mutex);
+		err = 0;
+	}
+
+	return err;
+}
+
+// Make the file of a shared arena cover the first end bytes of the data.
+// fallocate reserves the memory right away, so running out of it (or of
+// huge pages) fails here instead of with a SIGBUS on first touch.
+static int sa_shared_grow(sarena *sa, uint64_t end) {
+	sarena_shared *sh;
+	uint64_t step, grow;
+	int err;
+
+	sh = sa->shared;
+	if (end <= __atomic_load_n(&sh->filesize, __ATOMIC_ACQUIRE))
+		return 0;
+
+	err = sa_shared_lock(sa);
+	if (err != 0)
+		return err;
+
+	if (end > sh->filesize) {
+		step = (sa->pgsz > SA_SHARED_GROW)?sa->pgsz:SA_SHARED_GROW;
+		grow = (end + step - 1) / step * step;
+		if (grow > sh->size)
+			grow = sh->size;
+
+		if (fallocate(sa->fd, 0, sh->data + sh->filesize, grow - sh->filesize) != 0) {
+			err = errno;
+			if ((err == EOPNOTSUPP || err == ENOSYS) && ftruncate(sa->fd, sh->data + grow) == 0)
+				err = 0;
+		}
+
+		if (err == 0)
+			__atomic_store_n(&sh->filesize, grow, __ATOMIC_RELEASE);
+	}
+
+	pthread_mutex_unlock(&sh->mutex);
+	return err;
+}
+
+void *sarena_shared_reserve(sarena *sa, void *new_addr, size_t size, size_t alignment) {
+	sarena_shared *sh;
+	uint64_t base, next, start, end;
+
+	sh = sa->shared;
+	base = sh->base;
+	next = __atomic_load_n(&sh->next, __ATOMIC_ACQUIRE);
+	do {
+		if (new_addr != NULL) {
+			// jemalloc wants to grow an extent in place, which only works at the end
+			start = (uintptr_t) new_addr - base;
+			if ((uintptr_t) new_addr < base || start != next)
+				return NULL;
+		} else {
+			start = base + next;
+			if (alignment > 1)
+				start = (start + alignment - 1) & ~((uint64_t) alignment - 1);
+			start -= base;
+		}
+
+		end = start + size;
+		if (end > sh->size)
+			return NULL;
+	} while (!__atomic_compare_exchange_n(&sh->next, &next, end, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
+
+	if (sa_shared_grow(sa, end) != 0) {
+		// give the range back, unless somebody already took what comes after it
+		__atomic_compare_exchange_n(&sh->next, &end, next, false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED);
+		return NULL;
+	}
+
+	return (void *) (uintptr_t) (base + start);
+}
+
+// The data of a shared arena is mapped and bound to the arena's nodes as a
+// whole, so an extent is just the next part of it. Its pages are fresh from
+// the file, offsets are never reused.
+static void *sa_alloc_shared(sarena *sa, void *new_addr, size_t size, size_t alignment, bool *zero, bool *commit) {
+	void *ret;
+
+	ret = sarena_shared_reserve(sa, new_addr, size, alignment);
+	if (ret == NULL)
+		return NULL;
+
+	pthread_mutex_lock(sa->mutex);
+	__atomic_add_fetch(&sa->size, size, __ATOMIC_RELAXED);
+	extent_arr_insert(sa->extents, ret, (char *)ret + size, NULL);
+	sarena_map_add(sa, ret, (char *)ret + size);
+	if(sicm_extent_alloc_callback) {
+		(*sicm_extent_alloc_callback)(ret, (char *)ret + size);
+	}
+	sarena_event(sa, SICM_EXTENT_ALLOC, ret, NULL, (char *)ret + size);
+	pthread_mutex_unlock(sa->mutex);
+
+	*zero = true;
+	*commit = true;
+	return ret;
+}
+
+// whether addr is in the data of a shared arena, rather than in one of the
+// private extents that jemalloc allocated while the arena was created
+static int sa_in_shared(sarena *sa, void *addr) {
+	return sa->shared != NULL && (uintptr_t) addr >= sa->shared->base &&
+		(uintptr_t) addr < sa->shared->base + sa->shared->size;
+}
+
+// The mutex is only held while reserving the space and while recording the
+// new extent. Mapping, binding and populating the extent happen in between,
+// so threads allocating extents in the same arena don't wait for each
+// other's syscalls. The thread's memory policy is never touched: the extent
+// is mbind-ed before any of its pages are faulted in.
 static void *sa_alloc(extent_hooks_t *h, void *new_addr, size_t size, size_t alignment, bool *zero, bool *commit, unsigned arena_ind) {
-	int mpol;
+	int mpol, mmflags, regions, hole;
 	unsigned long *nodemaskp, maxnode;
+	unsigned long nodemask[numa_num_possible_nodes() / (8 * sizeof(unsigned long)) + 1];
+	sarena_stripes stripes;
+	unsigned gen, tiers_gen;
+	int tier;
 	sarena *sa;
-	uintptr_t n, m;
-	int oldmode, mmflags;
+	off_t offset;
+	size_t pgsz, mapsz;
 	void *ret;
-	struct bitmask *oldnodemask;
-
-	*commit = 0;
 
-	ret = NULL;
 	sa = container_of(h, sarena, hooks);
+	if (sa->shared != NULL)
+		return sa_alloc_shared(sa, new_addr, size, alignment, zero, commit);
 
-	// TODO: figure out a way to prevent taking the mutex twice (sa_range_add also takes it)...
+	// the fallback chain checks the devices' free memory, which takes
+	// reading files that shouldn't be read with the mutex held
+	if (__atomic_load_n(&sa->tiers, __ATOMIC_RELAXED) > 0)
+		sicm_devices_snapshot(NULL, 0);
+
+again:
+	hole = 0;
+	tier = -1;
 	pthread_mutex_lock(sa->mutex);
-	if (sa->maxsize > 0 && sa->size + size > sa->maxsize) {
+	pgsz = sa->pgsz;
+	regions = sa->regions;
+	mapsz = size;
+	if (regions) {
+		ret = sa_carve(sa, new_addr, size, alignment, &hole);
+		if (ret != NULL) {
+			mmflags = 0;
+			goto record;
+		}
+
+		if (new_addr != NULL) {
+			pthread_mutex_unlock(sa->mutex);
+			return NULL;
+		}
+
+		// start a new region, the rest of it is used for the following extents
+		mapsz = (size + pgsz - 1) & ~(pgsz - 1);
+		if (alignment < pgsz)
+			alignment = pgsz;
+	} else {
+		if ((sa->flags & SICM_ARENA_THP) && size >= sa_thp_size() && alignment < sa_thp_size())
+			alignment = sa_thp_size();
+
+		// aligning costs only address space, and lets the arena move onto huge pages later
+		if (sa->fd == -1 && alignment < sa_huge_align(size))
+			alignment = sa_huge_align(size);
+	}
+
+	if (sa->maxsize > 0 && sa->size + mapsz > sa->maxsize) {
+		pthread_mutex_unlock(sa->mutex);
 		return NULL;
 	}
 
-	oldnodemask = numa_allocate_nodemask();
-	get_mempolicy(&oldmode, oldnodemask->maskp, oldnodemask->size + 1, NULL, 0);
-	switch (sa->flags & SICM_ALLOC_MASK) {
-	case SICM_ALLOC_STRICT:
-		mpol = MPOL_BIND;
-		nodemaskp = sa->nodemask->maskp;
-		maxnode = sa->nodemask->size + 1;
-		break;
+	// with a fallback chain, the extent goes to the first device that has room for it
+	tiers_gen = sa->tiers_gen;
+	if (sa->tiers > 0) {
+		tier = sarena_tier_pick(sa, mapsz);
+		if (tier < 0) {
+			pthread_mutex_unlock(sa->mutex);
+			return NULL;
+		}
+	}
 
-	case SICM_ALLOC_RELAXED:
-		// TODO: this will work only for single device, fix it
-		mpol = MPOL_PREFERRED;
-		nodemaskp = sa->nodemask->maskp;
-		maxnode = sa->nodemask->size + 1;
-		break;
+	offset = sa->size;
+	__atomic_add_fetch(&sa->size, mapsz, __ATOMIC_RELAXED);
 
-	default:
-		mpol = MPOL_DEFAULT;
-		nodemaskp = NULL;
-		maxnode = 0;
-		break;
+	if (sa->fd >= 0) {
+		// only extend file; do not shrink. The offsets are per process, so
+		// processes that need to share a file use sicm_arena_create_shared.
+		if (sa->size > lseek(sa->fd, 0, SEEK_END)) {
+			ftruncate(sa->fd, sa->size);
+			fsync(sa->fd);
+		}
 	}
 
-	if (set_mempolicy(mpol, nodemaskp, maxnode) < 0) {
-		perror("set_mempolicy");
-		goto free_nodemasks;
+	// take a copy, the arena's nodemask is replaced when its devices change
+	if (tier >= 0) {
+		mpol = sarena_tier_mpol(sa, tier, &nodemaskp, &maxnode);
+		stripes.count = 0;
+	} else {
+		mpol = sarena_mpol(sa, &nodemaskp, &maxnode);
+		stripes = sa->stripes;
+	}
+	if (nodemaskp != NULL) {
+		memcpy(nodemask, nodemaskp, (maxnode + 8 * sizeof(unsigned long) - 2) / (8 * sizeof(unsigned long)) * sizeof(unsigned long));
+		nodemaskp = nodemask;
 	}
+	gen = sa->mpol_gen;
+	pthread_mutex_unlock(sa->mutex);
 
 	if (sa->fd == -1)
-		mmflags = MAP_ANONYMOUS|MAP_PRIVATE|MAP_POPULATE;
+		mmflags = MAP_ANONYMOUS | MAP_PRIVATE | sa_mmap_flags(pgsz);
 	else
 		mmflags = MAP_SHARED;
 
-	ret = mmap(new_addr, size, PROT_READ | PROT_WRITE, mmflags, sa->fd, sa->size);
-	if (ret == MAP_FAILED) {
-		ret = NULL;
-		perror("mmap");
-		goto restore_mempolicy;
+	ret = sa_map(new_addr, mapsz, alignment, mmflags, sa->fd, offset);
+	if (ret == NULL && (mmflags & MAP_HUGETLB)) {
+		// the huge page pool is empty, let transparent huge pages back the region instead
+		mmflags &= ~(MAP_HUGETLB | (MAP_HUGE_MASK << MAP_HUGE_SHIFT));
+		ret = sa_map(new_addr, mapsz, alignment, mmflags, sa->fd, offset);
+		if (ret != NULL)
+			madvise(ret, mapsz, MADV_HUGEPAGE);
 	}
 
-	if (alignment == 0 || ((uintptr_t) ret)%alignment == 0) {
-		// we are lucky and got the right alignment
-		goto success;
+	if (ret == NULL)
+		goto fail;
+
+	// pages of a new private mapping haven't been faulted in yet, so binding
+	// is enough; pages of a shared file might already be in memory
+	if (sarena_bind(ret, mapsz, mpol, nodemaskp, maxnode, &stripes, (sa->fd == -1)?0:MPOL_MF_MOVE) < 0) {
+		perror("mbind");
+		munmap(ret, mapsz);
+		goto fail;
 	}
 
-	// the alignment didn't work out, munmap and try again
-	munmap(ret, size);
-	ret = NULL;
+	if ((sa->flags & SICM_ARENA_THP) && !regions)
+		madvise(ret, mapsz, MADV_HUGEPAGE);
 
-	// if new_addr is set, we can't fulfill the alignment, so just fail
-	if (new_addr != NULL)
-		goto restore_mempolicy;
+	pthread_mutex_lock(sa->mutex);
 
-	size += alignment;
-	ret = mmap(NULL, size, PROT_READ | PROT_WRITE, mmflags, sa->fd, sa->size);
-	if (ret == MAP_FAILED) {
-		perror("mmap2");
-		ret = NULL;
-		goto restore_mempolicy;
-	}
+	if (sa->mpol_gen != gen) {
+		// the arena switched to another page size while we weren't looking, start over
+		if (sa->pgsz != pgsz || sa->regions != regions) {
+			__atomic_sub_fetch(&sa->size, mapsz, __ATOMIC_RELAXED);
+			if (tier >= 0 && sa->tiers_gen == tiers_gen)
+				sa->tier[tier].used -= mapsz;
+			pthread_mutex_unlock(sa->mutex);
+			munmap(ret, mapsz);
+			goto again;
+		}
 
-success:
-	if (mbind(ret, size, mpol, nodemaskp, maxnode, MPOL_MF_MOVE) < 0) {
-		munmap(ret, size);
-		perror("mbind");
-		ret = NULL;
-		goto restore_mempolicy;
+		// the fallback chain was replaced, so was the reservation
+		if (sa->tiers_gen != tiers_gen) {
+			tier = -1;
+			if (sa->tiers > 0) {
+				tier = sarena_tier_pick(sa, mapsz);
+				if (tier < 0) {
+					// too late to fail, the last device goes over its budget
+					tier = sa->tiers - 1;
+					sa->tier[tier].used += mapsz;
+				}
+			}
+		}
+
+		// the arena was moved to other devices, follow it
+		if (tier >= 0) {
+			mpol = sarena_tier_mpol(sa, tier, &nodemaskp, &maxnode);
+			if (mbind(ret, mapsz, mpol, nodemaskp, maxnode, MPOL_MF_MOVE) < 0)
+				perror("mbind");
+		} else {
+			mpol = sarena_mpol(sa, &nodemaskp, &maxnode);
+			if (sarena_bind(ret, mapsz, mpol, nodemaskp, maxnode, &sa->stripes, MPOL_MF_MOVE) < 0)
+				perror("mbind");
+		}
 	}
 
-	if (!(alignment == 0 || ((uintptr_t) ret)%alignment == 0)) {
-		n = (uintptr_t) ret;
-		m = n + alignment - (n%alignment);
-		ret = (void *) m;
-		size -= alignment;
+	if (regions) {
+		extent_arr_insert(sa->maps, ret, (char *)ret + mapsz, NULL);
+		sa->tail = (char *)ret + size;
+		sa->tail_end = (char *)ret + mapsz;
 	}
 
+record:
 	/* Add the extent to the array of extents */
-	extent_arr_insert(sa->extents, ret, (char *)ret + size, NULL);
+	extent_arr_insert(sa->extents, ret, (char *)ret + size, (tier >= 0)?SARENA_TIER_TAG(tier):NULL);
+	sarena_map_add(sa, ret, (char *)ret + size);
 
 	/* Call the callback on this chunk if it's set */
 	if(sicm_extent_alloc_callback) {
 		(*sicm_extent_alloc_callback)(ret, (char *)ret + size);
 	}
+	sarena_event(sa, SICM_EXTENT_ALLOC, ret, NULL, (char *)ret + size);
 
-	if (sa->fd) {
-		sa->size += size;
+	pthread_mutex_unlock(sa->mutex);
 
-		// only extend file; do not shrink
-		// FIXME: how does that make sense, Jason???
-		if (sa->size > lseek(sa->fd, 0, SEEK_END)) {
-			ftruncate(sa->fd, sa->size);
-			fsync(sa->fd);
+	if (sa->fd == -1)
+		sa_populate(ret, size, pgsz);
+
+	// new anonymous memory is always zeroed, and so is the unused tail of a
+	// region; a hole may have kept parts of pages that couldn't be dropped
+	if (sa->fd == -1 && !hole)
+		*zero = true;
+	else if (*zero)
+		memset(ret, 0, size);
+
+	*commit = true;
+	return ret;
+
+fail:
+	pthread_mutex_lock(sa->mutex);
+	__atomic_sub_fetch(&sa->size, mapsz, __ATOMIC_RELAXED);
+	if (tier >= 0 && sa->tiers_gen == tiers_gen)
+		sa->tier[tier].used -= mapsz;
+	pthread_mutex_unlock(sa->mutex);
+	return NULL;
+}
+
+// Turn an extent of a region into a hole, after giving back its pages. A
+// region that is all hole then is unmapped. Should be called with sa->mutex
+// held, which is released.
+static void sa_region_dalloc(sarena *sa, void *addr, size_t size) {
+	extent_info *r, *e;
+	char *start, *end, *unmap;
+	size_t pgsz, len;
+	int last;
+
+	extent_arr_delete(sa->extents, addr);
+	sarena_map_remove(addr, (char *)addr + size);
+	sarena_event(sa, SICM_EXTENT_DALLOC, addr, NULL, (char *)addr + size);
+	pgsz = sa->pgsz;
+	pthread_mutex_unlock(sa->mutex);
+
+	// nobody can carve the range again before it is a hole
+	sa_drop(addr, size, pgsz);
+
+	pthread_mutex_lock(sa->mutex);
+	start = addr;
+	end = start + size;
+	unmap = NULL;
+	len = 0;
+	r = extent_arr_lookup(sa->maps, addr);
+	if (r != NULL) {
+		// join the holes next to it, without going past the region
+		if (start > (char *) r->start && (e = extent_arr_lookup(sa->holes, start - 1)) != NULL) {
+			start = e->start;
+			extent_arr_delete(sa->holes, e->start);
+		}
+		if (end < (char *) r->end && (e = extent_arr_lookup(sa->holes, end)) != NULL) {
+			end = e->end;
+			extent_arr_delete(sa->holes, e->start);
 		}
-	}
 
-restore_mempolicy:
-	set_mempolicy(oldmode, oldnodemask->maskp, oldnodemask->size + 1);
+		last = ((char *) r->end == sa->tail_end);
+		if (last && end == sa->tail) {
+			sa->tail = start;
+			end = sa->tail_end;
+		}
 
-free_nodemasks:
-	numa_free_nodemask(oldnodemask);
+		if (start == (char *) r->start && end == (char *) r->end) {
+			unmap = r->start;
+			len = (char *) r->end - (char *) r->start;
+			extent_arr_delete(sa->maps, r->start);
+			if (last) {
+				sa->tail = NULL;
+				sa->tail_end = NULL;
+			}
+			__atomic_sub_fetch(&sa->size, len, __ATOMIC_RELAXED);
+		} else if (end != sa->tail_end || !last) {
+			extent_arr_insert(sa->holes, start, end, NULL);
+		}
+	}
 	pthread_mutex_unlock(sa->mutex);
 
-	if (*zero) {
-		memset(ret, 0, size);
+	if (unmap != NULL && munmap(unmap, len) != 0)
+		fprintf(stderr, "munmap failed: %p %ld\n", unmap, len);
+
+	if(sicm_extent_dalloc_callback) {
+		(*sicm_extent_dalloc_callback)(addr, (char *)addr + size);
 	}
-	
-	return ret;
 }
 
 static bool sa_dalloc(extent_hooks_t *h, void *addr, size_t size, bool committed, unsigned arena_ind) {
 	sarena *sa;
-	bool ret;
+	extent_info *e;
+	void *tag;
 
-	ret = false;
+	// the data of a shared arena can't be given back
 	sa = container_of(h, sarena, hooks);
+	if (sa_in_shared(sa, addr))
+		return true;
+
 	pthread_mutex_lock(sa->mutex);
+	if (sa->regions) {
+		sa_region_dalloc(sa, addr, size);
+		return false;
+	}
+
+	e = extent_arr_lookup(sa->extents, addr);
+	tag = (e != NULL)?e->arena:NULL;
+	if (tag != NULL && SARENA_TAG_TIER(tag) < sa->tiers)
+		sa->tier[SARENA_TAG_TIER(tag)].used -= size;
 	extent_arr_delete(sa->extents, addr);
+	sarena_map_remove(addr, (char *)addr + size);
+	__atomic_sub_fetch(&sa->size, size, __ATOMIC_RELAXED);
+
+	// before the range can be mapped again, so that events of the same range stay in order
+	sarena_event(sa, SICM_EXTENT_DALLOC, addr, NULL, (char *)addr + size);
+	pthread_mutex_unlock(sa->mutex);
 
 	if (munmap(addr, size) != 0) {
 		fprintf(stderr, "munmap failed: %p %ld\n", addr, size);
-		extent_arr_insert(sa->extents, addr, (char *)addr + size, NULL);
-		ret = true;
+
+		// tell jemalloc to keep the extent
+		pthread_mutex_lock(sa->mutex);
+		if (tag != NULL && SARENA_TAG_TIER(tag) < sa->tiers)
+			sa->tier[SARENA_TAG_TIER(tag)].used += size;
+		extent_arr_insert(sa->extents, addr, (char *)addr + size, tag);
+		sarena_map_add(sa, addr, (char *)addr + size);
+		__atomic_add_fetch(&sa->size, size, __ATOMIC_RELAXED);
+		sarena_event(sa, SICM_EXTENT_ALLOC, addr, NULL, (char *)addr + size);
+		pthread_mutex_unlock(sa->mutex);
+		return true;
 	}
-	sa->size -= size;
-	pthread_mutex_unlock(sa->mutex);
-	return ret;
+
+	if(sicm_extent_dalloc_callback) {
+		(*sicm_extent_dalloc_callback)(addr, (char *)addr + size);
+	}
+
+	return false;
 }
 
 static void sa_destroy(extent_hooks_t *h, void *addr, size_t size, bool committed, unsigned arena_ind) {
+	sarena *sa;
+
+	sa = container_of(h, sarena, hooks);
+	if (sa_in_shared(sa, addr)) {
+		// sicm_arena_destroy unmaps the data of shared arenas
+		pthread_mutex_lock(sa->mutex);
+		extent_arr_delete(sa->extents, addr);
+		sarena_map_remove(addr, (char *)addr + size);
+		__atomic_sub_fetch(&sa->size, size, __ATOMIC_RELAXED);
+		sarena_event(sa, SICM_EXTENT_DALLOC, addr, NULL, (char *)addr + size);
+		pthread_mutex_unlock(sa->mutex);
+
+		if(sicm_extent_dalloc_callback) {
+			(*sicm_extent_dalloc_callback)(addr, (char *)addr + size);
+		}
+		return;
+	}
+
 	sa_dalloc(h, addr, size, committed, arena_ind);
 }
 
+// can pages of this arena be dropped one base page at a time?
+static bool sa_can_purge(sarena *sa) {
+	return sa->fd == -1 && sa->pgsz <= (size_t) sysconf(_SC_PAGESIZE);
+}
+
 static bool sa_commit(extent_hooks_t *h, void *addr, size_t size, size_t offset, size_t length, unsigned arena_ind) {
-	// no support for commit/decommit
+	// decommitted pages are still mapped, they are faulted back in on the next access
 	return false;
 }
 
 static bool sa_decommit(extent_hooks_t *h, void *addr, size_t size, size_t offset, size_t length, unsigned arena_ind) {
-	// no support for commit/decommit
+	sarena *sa;
+
+	// dropping pages of a shared mapping doesn't free the memory behind them,
+	// and huge pages can only be dropped whole
+	sa = container_of(h, sarena, hooks);
+	if (!sa_can_purge(sa))
+		return true;
+
+	return madvise((char *) addr + offset, length, MADV_DONTNEED) != 0;
+}
+
+static bool sa_purge_lazy(extent_hooks_t *h, void *addr, size_t size, size_t offset, size_t length, unsigned arena_ind) {
+	sarena *sa;
+
+	sa = container_of(h, sarena, hooks);
+	if (!sa_can_purge(sa))
+		return true;
+
+#ifdef MADV_FREE
+	return madvise((char *) addr + offset, length, MADV_FREE) != 0;
+#else
 	return true;
+#endif
+}
+
+static bool sa_purge_forced(extent_hooks_t *h, void *addr, size_t size, size_t offset, size_t length, unsigned arena_ind) {
+	sarena *sa;
+
+	// jemalloc expects forcibly purged pages to read back as zeros, which
+	// is only true for private anonymous mappings
+	sa = container_of(h, sarena, hooks);
+	if (!sa_can_purge(sa))
+		return true;
+
+	return madvise((char *) addr + offset, length, MADV_DONTNEED) != 0;
 }
 
+// Keep sa->extents in step with jemalloc's extents, so that sa_dalloc
+// always finds the exact range that it is given.
 static bool sa_split(extent_hooks_t *h, void *addr, size_t size, size_t size_a, size_t size_b, bool committed, unsigned arena_ind) {
-	// we don't really need to keep track of each extent, let's figure it out at alloc/dalloc time
-	return false;
+	sarena *sa;
+	bool ret;
+
+	sa = container_of(h, sarena, hooks);
+	pthread_mutex_lock(sa->mutex);
+	ret = extent_arr_split(sa->extents, addr, (char *) addr + size_a) != 0;
+	if (!ret)
+		sarena_event(sa, SICM_EXTENT_SPLIT, addr, (char *) addr + size_a, (char *) addr + size);
+	pthread_mutex_unlock(sa->mutex);
+	return ret;
 }
 
 static bool sa_merge(extent_hooks_t *h, void *addr_a, size_t size_a, void *addr_b, size_t size_b, bool committed, unsigned arena_ind) {
-	// we don't really need to keep track of each extent, let's figure it all out at alloc/dalloc time
-	return false;
+	sarena *sa;
+	extent_info *a, *b;
+	bool ret;
+
+	sa = container_of(h, sarena, hooks);
+	pthread_mutex_lock(sa->mutex);
+
+	// extents on different devices of a fallback chain are kept apart
+	a = extent_arr_lookup(sa->extents, addr_a);
+	b = extent_arr_lookup(sa->extents, addr_b);
+	if (a != NULL && b != NULL && a->arena != b->arena)
+		ret = true;
+	else
+		ret = extent_arr_merge(sa->extents, addr_a, addr_b) != 0;
+	if (!ret)
+		sarena_event(sa, SICM_EXTENT_MERGE, addr_a, addr_b, (char *) addr_b + size_b);
+	pthread_mutex_unlock(sa->mutex);
+	return ret;
+}
+
+// Build a copy of [addr, addr + len) on a new private mapping with the
+// given flags and policy, fully populated. Returns NULL on failure.
+static void *sa_remap_build(void *addr, size_t len, int flags, int mpol, unsigned long *nodemaskp, unsigned long maxnode) {
+	void *tmp;
+
+	tmp = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE | flags, -1, 0);
+	if (tmp == MAP_FAILED)
+		return NULL;
+
+	if (mbind(tmp, len, mpol, nodemaskp, maxnode, 0) < 0) {
+		munmap(tmp, len);
+		return NULL;
+	}
+
+	memcpy(tmp, addr, len);
+	return tmp;
+}
+
+// Put the copy tmp in place of [addr, addr + len). Not every kernel can move
+// huge page mappings, so the range may have to be mapped again and the copy
+// copied once more. If that can't be done with the new kind of pages, the
+// range goes back to the old kind, or at worst to base pages, and the data
+// is kept either way.
+static int sa_remap_swap(void *addr, size_t len, void *tmp, int flags, int mpol, unsigned long *nodemaskp, unsigned long maxnode,
+			 int oldflags, int oldmpol, unsigned long *oldnodemaskp, unsigned long oldmaxnode) {
+	int err;
+
+	if (mremap(tmp, len, len, MREMAP_MAYMOVE | MREMAP_FIXED, addr) != MAP_FAILED)
+		return 0;
+
+	err = 0;
+	if (mmap(addr, len, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE | MAP_FIXED | flags, -1, 0) == MAP_FAILED ||
+	    mbind(addr, len, mpol, nodemaskp, maxnode, 0) < 0) {
+		err = -errno;
+		if (mmap(addr, len, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE | MAP_FIXED | oldflags, -1, 0) == MAP_FAILED &&
+		    mmap(addr, len, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE | MAP_FIXED, -1, 0) == MAP_FAILED) {
+			// like extent_arr, there is no way on without memory
+			fprintf(stderr, "Can't map %p back after failing to remap it. Aborting.\n", addr);
+			exit(1);
+		}
+		mbind(addr, len, oldmpol, oldnodemaskp, oldmaxnode, 0);
+	}
+
+	memcpy(addr, tmp, len);
+	munmap(tmp, len);
+	return err;
+}
+
+// Copy all of the arena's memory onto pages of size pgsz bound with the
+// given policy, keeping its addresses. The contiguous runs of the arena's
+// memory (its regions, or its extents merged with their neighbors) are
+// replaced by new mappings, each from the first to the last address in it
+// that is aligned to both page sizes; sa_alloc aligns big extents so that
+// little is left out at the ends, which keep their pages. All of the copies
+// are built before any of them replaces the old memory, so if one can't be
+// built, the arena is left as it was. If one can't replace the old memory,
+// the parts that already did are put back on the old pages. Should be
+// called with sa->mutex held; nobody may use the arena's memory in the
+// meantime.
+int sarena_remap(sarena *sa, size_t pgsz, int mpol, unsigned long *nodemaskp, unsigned long maxnode) {
+	extent_arr *runs, *parts;
+	uintptr_t start, end;
+	size_t i, align, n, len;
+	int err, oldmpol, converted;
+	unsigned long *oldnodemaskp, oldmaxnode;
+	void *tmp;
+
+	if (sa->fd != -1)
+		return -EINVAL;
+
+	runs = extent_arr_init();
+	if (sa->regions) {
+		extent_arr_for(sa->maps, i) {
+			extent_arr_insert(runs, sa->maps->arr[i].start, sa->maps->arr[i].end, NULL);
+		}
+	} else {
+		extent_arr_for(sa->extents, i) {
+			n = runs->index;
+			if (n > 0 && runs->arr[n - 1].end == sa->extents->arr[i].start)
+				runs->arr[n - 1].end = sa->extents->arr[i].end;
+			else
+				extent_arr_insert(runs, sa->extents->arr[i].start, sa->extents->arr[i].end, NULL);
+		}
+	}
+
+	// the parts that change, each with its copy
+	err = 0;
+	parts = extent_arr_init();
+	align = (pgsz > sa->pgsz)?pgsz:sa->pgsz;
+	oldmpol = sarena_mpol(sa, &oldnodemaskp, &oldmaxnode);
+	extent_arr_for(runs, i) {
+		start = ((uintptr_t) runs->arr[i].start + align - 1) & ~((uintptr_t) align - 1);
+		end = (uintptr_t) runs->arr[i].end & ~((uintptr_t) align - 1);
+		if (start >= end)
+			continue;
+
+		tmp = sa_remap_build((void *) start, end - start, sa_mmap_flags(pgsz), mpol, nodemaskp, maxnode);
+		if (tmp == NULL) {
+			err = -ENOMEM;
+			break;
+		}
+		extent_arr_insert(parts, (void *) start, (void *) end, tmp);
+	}
+
+	if (err != 0) {
+		extent_arr_for(parts, i) {
+			munmap(parts->arr[i].arena, (char *) parts->arr[i].end - (char *) parts->arr[i].start);
+		}
+		goto out;
+	}
+
+	// the copies are used up, from now on arena marks the parts on the new pages
+	converted = 0;
+	extent_arr_for(parts, i) {
+		len = (char *) parts->arr[i].end - (char *) parts->arr[i].start;
+		if (sa_remap_swap(parts->arr[i].start, len, parts->arr[i].arena,
+				  sa_mmap_flags(pgsz), mpol, nodemaskp, maxnode,
+				  sa_mmap_flags(sa->pgsz), oldmpol, oldnodemaskp, oldmaxnode) != 0) {
+			parts->arr[i].arena = NULL;
+			err = -ENOMEM;
+			continue;
+		}
+		converted++;
+		sarena_event(sa, SICM_EXTENT_MIGRATE, parts->arr[i].start, NULL, parts->arr[i].end);
+	}
+
+	// a mix of page sizes would have the arena unmap and purge the wrong
+	// ranges, so what was converted goes back. That only fails without
+	// memory for the copies, and then the arena takes the bigger page size,
+	// which is safe for the smaller pages too.
+	if (err != 0) {
+		extent_arr_for(parts, i) {
+			if (parts->arr[i].arena == NULL)
+				continue;
+
+			len = (char *) parts->arr[i].end - (char *) parts->arr[i].start;
+			tmp = sa_remap_build(parts->arr[i].start, len, sa_mmap_flags(sa->pgsz), oldmpol, oldnodemaskp, oldmaxnode);
+			if (tmp == NULL)
+				continue;
+
+			// it ends up on the old pages or on base pages, both are fine
+			sa_remap_swap(parts->arr[i].start, len, tmp,
+				      sa_mmap_flags(sa->pgsz), oldmpol, oldnodemaskp, oldmaxnode,
+				      sa_mmap_flags(sa->pgsz), oldmpol, oldnodemaskp, oldmaxnode);
+			converted--;
+			sarena_event(sa, SICM_EXTENT_MIGRATE, parts->arr[i].start, NULL, parts->arr[i].end);
+		}
+	}
+
+	// huge pages can't be unmapped in pieces, so the memory stays in regions
+	if (converted > 0 && !sa->regions && pgsz > (size_t) sysconf(_SC_PAGESIZE)) {
+		extent_arr_free(sa->maps);
+		sa->maps = runs;
+		runs = NULL;
+		sa->regions = 1;
+		sa->tail = NULL;
+		sa->tail_end = NULL;
+	}
+
+	if (err == 0) {
+		// the copies filled in the holes too
+		extent_arr_for(sa->holes, i) {
+			sa_drop(sa->holes->arr[i].start, (char *) sa->holes->arr[i].end - (char *) sa->holes->arr[i].start, pgsz);
+		}
+	}
+
+	if (err == 0 || (converted > 0 && pgsz > sa->pgsz)) {
+		sa->pgsz = pgsz;
+		sa->mpol_gen++;
+	}
+
+out:
+	extent_arr_free(parts);
+	if (runs != NULL)
+		extent_arr_free(runs);
+	return err;
 }
 
 extent_hooks_t sicm_arena_mmap_hooks = {
@@ -185,8 +956,8 @@ extent_hooks_t sicm_arena_mmap_hooks = {
 	.destroy = sa_destroy,
 	.commit = sa_commit,
 	.decommit = sa_decommit,
-	.purge_lazy = NULL,
-	.purge_forced = NULL,
+	.purge_lazy = sa_purge_lazy,
+	.purge_forced = sa_purge_forced,
 	.split = sa_split,
 	.merge = sa_merge,
 };
@@ -6,6 +6,7 @@
 #include "detect_devices/HIP.h"
 #endif
 #include "detect_devices/DRAM.h"
+#include "detect_devices/tiers.h"
 
 static const node_mod_t node_mods[] = {
     #ifdef HIP
@@ -61,6 +62,8 @@ int detect_devices(int node_count, int *huge_page_sizes,
     struct bitmask* compute_nodes = get_compute_nodes(node_count);
     struct bitmask* non_dram_nodes = numa_bitmask_alloc(node_count);
 
+    detect_tiers(compute_nodes);
+
     int idx = 0;
     for(size_t i = 0; i < detector_count; i++) {
         detectors[i](compute_nodes, non_dram_nodes,
@@ -68,6 +71,8 @@ int detect_devices(int node_count, int *huge_page_sizes,
                      devices, &idx);
     }
 
+    rank_tiers(devices, idx);
+
     numa_bitmask_free(non_dram_nodes);
     numa_bitmask_free(compute_nodes);
 
@@ -0,0 +1,293 @@
+#include <dirent.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "detect_devices/tiers.h"
+
+typedef struct tier_node {
+  int mem;                     /* the node has memory */
+  int compute;                 /* the node has CPUs */
+  int kernel_tier;             /* N of the memory_tierN that the node is in, -1 if none */
+  struct bitmask *initiators;  /* nearest initiators according to HMAT */
+  sicm_device_perf perf;
+} tier_node;
+
+static tier_node *tier_nodes = NULL;
+static int tier_node_count = 0;
+
+static int read_uint(const char *path, unsigned int *value) {
+  FILE *f = fopen(path, "r");
+  if(!f) {
+    return -1;
+  }
+  int ret = (fscanf(f, "%u", value) == 1)?0:-1;
+  fclose(f);
+  return ret;
+}
+
+/*
+ * The kernel lists the nearest initiators of a node and the performance
+ * from them under access0 (any initiator) and access1 (CPUs only). We
+ * allocate from CPUs, so access1 comes first.
+ */
+static void read_hmat(int node, tier_node *tn) {
+  static const char *access[] = { "access1", "access0" };
+  char path[PATH_MAX];
+
+  for(size_t i = 0; i < sizeof(access) / sizeof(access[0]); i++) {
+    snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/%s/initiators/read_latency", node, access[i]);
+    if(read_uint(path, &tn->perf.read_latency) != 0) {
+      continue;
+    }
+    snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/%s/initiators/write_latency", node, access[i]);
+    read_uint(path, &tn->perf.write_latency);
+    snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/%s/initiators/read_bandwidth", node, access[i]);
+    read_uint(path, &tn->perf.read_bandwidth);
+    snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/%s/initiators/write_bandwidth", node, access[i]);
+    read_uint(path, &tn->perf.write_bandwidth);
+
+    /* the initiators are links named nodeN */
+    snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/%s/initiators", node, access[i]);
+    DIR *dir = opendir(path);
+    if(dir) {
+      struct dirent *entry;
+      while((entry = readdir(dir)) != NULL) {
+        int n;
+        if(sscanf(entry->d_name, "node%d", &n) == 1 && n >= 0 && n < tier_node_count) {
+          numa_bitmask_setbit(tn->initiators, n);
+        }
+      }
+      closedir(dir);
+    }
+    break;
+  }
+}
+
+/* nodelist looks like "0-1,3" */
+static void parse_nodelist(const char *list, int tier) {
+  const char *p = list;
+  char *end;
+
+  for(;;) {
+    long first = strtol(p, &end, 10);
+    if(end == p) {
+      break;
+    }
+    long last = first;
+    if(*end == '-') {
+      p = end + 1;
+      last = strtol(p, &end, 10);
+    }
+    for(long n = first; n <= last; n++) {
+      if(n >= 0 && n < tier_node_count) {
+        tier_nodes[n].kernel_tier = tier;
+      }
+    }
+    if(*end != ',') {
+      break;
+    }
+    p = end + 1;
+  }
+}
+
+/* memory_tierN holds the nodes of abstract distance N, lower is faster */
+static void read_memory_tiers(void) {
+  DIR *dir = opendir("/sys/devices/virtual/memory_tiering");
+  if(!dir) {
+    return;
+  }
+
+  struct dirent *entry;
+  while((entry = readdir(dir)) != NULL) {
+    int tier;
+    if(sscanf(entry->d_name, "memory_tier%d", &tier) != 1) {
+      continue;
+    }
+
+    char path[PATH_MAX];
+    char list[256];
+    snprintf(path, sizeof(path), "/sys/devices/virtual/memory_tiering/%s/nodelist", entry->d_name);
+    FILE *f = fopen(path, "r");
+    if(!f) {
+      continue;
+    }
+    if(fgets(list, sizeof(list), f)) {
+      parse_nodelist(list, tier);
+    }
+    fclose(f);
+  }
+  closedir(dir);
+}
+
+void detect_tiers(struct bitmask* compute_nodes) {
+  for(int i = 0; i < tier_node_count; i++) {
+    numa_bitmask_free(tier_nodes[i].initiators);
+  }
+  free(tier_nodes);
+
+  tier_node_count = numa_max_node() + 1;
+  tier_nodes = calloc(tier_node_count, sizeof(tier_node));
+  if(!tier_nodes) {
+    tier_node_count = 0;
+    return;
+  }
+
+  for(int i = 0; i < tier_node_count; i++) {
+    long size = -1;
+    tier_nodes[i].mem = (numa_node_size(i, &size) != -1) && size;
+    tier_nodes[i].compute = numa_bitmask_isbitset(compute_nodes, i);
+    tier_nodes[i].kernel_tier = -1;
+    tier_nodes[i].initiators = numa_bitmask_alloc(tier_node_count);
+    tier_nodes[i].perf.tier = -1;
+    read_hmat(i, &tier_nodes[i]);
+  }
+
+  read_memory_tiers();
+}
+
+/* today's guess, from the type of the node's devices */
+static unsigned int guess_tier(int node, struct sicm_device **devices, int count) {
+  for(int i = 0; i < count; i++) {
+    if(devices[i]->node != node) {
+      continue;
+    }
+    switch(devices[i]->tag) {
+      case SICM_KNL_HBM:
+      case SICM_POWERPC_HBM:
+        return 0;
+      case SICM_OPTANE:
+        return 2;
+      default:
+        return 1;
+    }
+  }
+  return 1;
+}
+
+static int compare_uint(const void *lhs, const void *rhs) {
+  unsigned int l = *(const unsigned int *) lhs;
+  unsigned int r = *(const unsigned int *) rhs;
+  return (l > r) - (l < r);
+}
+
+void rank_tiers(struct sicm_device **devices, int count) {
+  int have_kernel = 1, have_hmat = 1, mem_nodes = 0;
+
+  for(int i = 0; i < tier_node_count; i++) {
+    if(!tier_nodes[i].mem) {
+      continue;
+    }
+    mem_nodes++;
+    if(tier_nodes[i].kernel_tier < 0) {
+      have_kernel = 0;
+    }
+    if(!tier_nodes[i].perf.read_latency) {
+      have_hmat = 0;
+    }
+  }
+  if(!mem_nodes) {
+    return;
+  }
+
+  /*
+   * Every node gets a key from the same source, so that the ranks compare.
+   * Nodes with equal keys share a tier.
+   */
+  sicm_tier_source source = have_kernel?SICM_TIER_KERNEL:(have_hmat?SICM_TIER_HMAT:SICM_TIER_GUESS);
+  unsigned int *keys = malloc(tier_node_count * sizeof(unsigned int));
+  unsigned int *sorted = malloc(mem_nodes * sizeof(unsigned int));
+  if(!keys || !sorted) {
+    free(keys);
+    free(sorted);
+    return;
+  }
+
+  int n = 0;
+  for(int i = 0; i < tier_node_count; i++) {
+    if(!tier_nodes[i].mem) {
+      continue;
+    }
+    switch(source) {
+      case SICM_TIER_KERNEL:
+        keys[i] = tier_nodes[i].kernel_tier;
+        break;
+      case SICM_TIER_HMAT:
+        keys[i] = tier_nodes[i].perf.read_latency;
+        break;
+      case SICM_TIER_GUESS:
+        keys[i] = guess_tier(i, devices, count);
+        break;
+    }
+    sorted[n++] = keys[i];
+  }
+
+  qsort(sorted, n, sizeof(unsigned int), compare_uint);
+  int unique = 0;
+  for(int i = 0; i < n; i++) {
+    if(i == 0 || sorted[i] != sorted[unique - 1]) {
+      sorted[unique++] = sorted[i];
+    }
+  }
+
+  for(int i = 0; i < tier_node_count; i++) {
+    if(!tier_nodes[i].mem) {
+      continue;
+    }
+    unsigned int *rank = bsearch(&keys[i], sorted, unique, sizeof(unsigned int), compare_uint);
+    tier_nodes[i].perf.tier = rank - sorted;
+    tier_nodes[i].perf.source = source;
+  }
+
+  free(sorted);
+  free(keys);
+}
+
+int tiers_same_as_compute(int node) {
+  if(node < 0 || node >= tier_node_count) {
+    return 0;
+  }
+
+  const tier_node *tn = &tier_nodes[node];
+  int fastest = INT_MAX;
+  unsigned int slowest = 0;
+  for(int i = 0; i < tier_node_count; i++) {
+    if(!tier_nodes[i].compute || !tier_nodes[i].mem) {
+      continue;
+    }
+    if(tier_nodes[i].kernel_tier >= 0 && tier_nodes[i].kernel_tier < fastest) {
+      fastest = tier_nodes[i].kernel_tier;
+    }
+    if(tier_nodes[i].perf.read_latency > slowest) {
+      slowest = tier_nodes[i].perf.read_latency;
+    }
+  }
+
+  if(tn->kernel_tier >= 0 && fastest != INT_MAX) {
+    return tn->kernel_tier <= fastest;
+  }
+  if(tn->perf.read_latency && slowest) {
+    return tn->perf.read_latency <= slowest;
+  }
+  return 0;
+}
+
+int tiers_is_initiator(int node, int cpu_node) {
+  if(node < 0 || node >= tier_node_count || cpu_node < 0) {
+    return -1;
+  }
+  if(!numa_bitmask_weight(tier_nodes[node].initiators)) {
+    return -1;
+  }
+  return numa_bitmask_isbitset(tier_nodes[node].initiators, cpu_node);
+}
+
+int tiers_get_perf(int node, sicm_device_perf *perf) {
+  if(node < 0 || node >= tier_node_count || !tier_nodes[node].mem || !perf) {
+    return -EINVAL;
+  }
+  *perf = tier_nodes[node].perf;
+  return 0;
+}
@@ -1,4 +1,5 @@
 #include "detect_devices/x86.h"
+#include "detect_devices/tiers.h"
 
 #define X86_CPUID_MODEL_MASK        (0xf<<4)
 #define X86_CPUID_EXT_MODEL_MASK    (0xf<<16)
@@ -59,9 +60,11 @@ void detect_x86(struct bitmask* compute_nodes, struct bitmask* non_dram_nodes,
  } else {
    // Optane support
    // This is a bit of a hack: on x86_64 architecture that is not KNL,
-   // NUMA nodes without CPUs are assumed to be Optane nodes
+   // NUMA nodes without CPUs are assumed to be Optane nodes, unless the
+   // kernel puts them in the same tier as the compute nodes (e.g. SNC or
+   // CPU-less DRAM nodes), in which case they're left to detect_DRAM
    for(i = 0; i <= numa_max_node(); i++) {
-     if(!numa_bitmask_isbitset(compute_nodes, i)) {
+     if(!numa_bitmask_isbitset(compute_nodes, i) && !tiers_same_as_compute(i)) {
        long size = -1;
        if ((numa_node_size(i, &size) != -1) && size) {
          int compute_node = -1;
@@ -1,23 +1,107 @@
 #include <errno.h>
+#include <fcntl.h>
 #include <math.h>
 #include <numa.h>
 #include <numaif.h>
 #include <pthread.h>
 #include <stdio.h>
 #include <string.h>
+#include <sys/file.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
 #include <sys/time.h>
 #include <unistd.h>
 
 #include "sicm_low.h"
 #include "sicm_impl.h"
 
+#ifndef MPOL_PREFERRED_MANY
+#define MPOL_PREFERRED_MANY 5
+#endif
+#ifndef MPOL_WEIGHTED_INTERLEAVE
+#define MPOL_WEIGHTED_INTERLEAVE 6
+#endif
+
+// user-space weighted interleaving binds stripes this big to the nodes
+#define SICM_STRIPE (4 * 1024 * 1024)
+
+#ifndef MAP_FIXED_NOREPLACE
+#define MAP_FIXED_NOREPLACE 0x100000
+#endif
+
+// most pages whose nodes sicm_arena_stats looks up
+#define SA_STATS_SAMPLES 4096
+
+// bytes a thread claims from the region of a bump arena at a time
+#define SA_BUMP_CHUNK (64 * 1024)
+
+// alignment of objects from bump arenas, the same as malloc's
+#define SA_BUMP_ALIGN 16
+
+// objects of bump arenas are preceded by their size, for sicm_arena_realloc
+#define SA_BUMP_SIZE(p) (((size_t *) (p))[-1])
+
+// most bump arenas a thread allocates from without claiming new chunks
+#define SA_BUMP_CURSORS 8
+
 static pthread_mutex_t sa_mutex = PTHREAD_MUTEX_INITIALIZER;
 static int sa_num;
 static sarena *sa_list;
 static size_t sa_lookup_mib[2];
+static size_t sa_batch_mib[2];
+static size_t sa_batch_miblen;		// 0 if jemalloc can't allocate in batches
 static pthread_once_t sa_init = PTHREAD_ONCE_INIT;
 static pthread_key_t sa_default_key;
+static unsigned sa_serial;
+
+// arena_ind -> sarena, written in sicm_arena_new/sicm_arena_destroy, read without locks
+static sarena *sa_table[SICM_MAX_ARENAS];
+
+// Two-level address map: 64 KiB granule -> sarena. Granules that are only
+// partially covered by one of our extents are marked SA_MAP_MIXED, and
+// lookups in them fall back to asking jemalloc.
+#define SA_MAP_GRANULE_SHIFT	16
+#define SA_MAP_LEAF_BITS	16
+#define SA_MAP_ROOT_BITS	16
+#define SA_MAP_MIXED		((sarena *) 1)
+static sarena **sa_map[1 << SA_MAP_ROOT_BITS];
+
+// Per-thread explicit tcaches for SICM_ARENA_TCACHE arenas, indexed by
+// arena_ind. Every thread that used such an arena has a table on
+// sa_tcache_tables so that sicm_arena_destroy can get rid of the tcaches
+// that still hold objects from the arena. Both the list and the slots of
+// other threads are only touched with sa_mutex held.
+#define SA_TCACHE_NONE		((unsigned) -1)
+
+typedef struct sa_tcache_slot {
+	unsigned	serial;		// sarena serial, 0 if the slot is unused
+	unsigned	gen;		// sarena tcache_gen at the last flush
+	unsigned	tc;		// jemalloc tcache id, or SA_TCACHE_NONE
+} sa_tcache_slot;
+
+typedef struct sa_tcache_table {
+	struct sa_tcache_table	*next;
+	sa_tcache_slot		slots[SICM_MAX_ARENAS];
+} sa_tcache_table;
+
+static pthread_key_t sa_tcache_key;
+static sa_tcache_table *sa_tcache_tables;
+static void sa_tcache_table_free(void *p);
+static void sa_update_stripes(sarena *sa);
+static void sa_tiers_clear(sarena *sa);
+static sarena *sa_owner(void *ptr);
+
+// The current chunk of each bump arena that the thread allocates from, by
+// sarena serial. A pthread key would cost a call on every allocation.
+typedef struct sa_bump_cursor {
+	unsigned	serial;		// 0 if the cursor is unused
+	unsigned	gen;		// sarena bump.gen when the chunk was claimed
+	char		*cur;
+	char		*end;
+	char		*last;		// object that ends at cur, it can grow in place
+} sa_bump_cursor;
+
+static __thread sa_bump_cursor sa_bump_cursors[SA_BUMP_CURSORS];
 
 extern extent_hooks_t sicm_arena_mmap_hooks;
 
@@ -30,10 +114,198 @@ static void sarena_init() {
 	size_t miblen;
 
 	pthread_key_create(&sa_default_key, NULL);
+	pthread_key_create(&sa_tcache_key, sa_tcache_table_free);
 	miblen = 2;
 	err = je_mallctlnametomib("arenas.lookup", sa_lookup_mib, &miblen);
 	if (err != 0)
 		fprintf(stderr, "can't get mib: %d\n", err);
+
+	// only jemalloc 5.3 and newer have it
+	miblen = 2;
+	if (je_mallctlnametomib("experimental.batch_alloc", sa_batch_mib, &miblen) == 0)
+		sa_batch_miblen = miblen;
+}
+
+static sarena **sa_map_leaf(uintptr_t g, int create) {
+	uintptr_t r;
+	sarena **leaf, **new_leaf;
+
+	r = g >> SA_MAP_LEAF_BITS;
+	if (r >= (1 << SA_MAP_ROOT_BITS))
+		return NULL;
+
+	leaf = __atomic_load_n(&sa_map[r], __ATOMIC_ACQUIRE);
+	if (leaf == NULL && create) {
+		new_leaf = calloc(1 << SA_MAP_LEAF_BITS, sizeof(sarena *));
+		if (new_leaf == NULL)
+			return NULL;
+
+		if (__atomic_compare_exchange_n(&sa_map[r], &leaf, new_leaf, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+			leaf = new_leaf;
+		else
+			free(new_leaf);	// somebody else installed it first, leaf points to theirs
+	}
+
+	return leaf;
+}
+
+static void sa_map_set(uintptr_t g, sarena *sa) {
+	sarena **leaf;
+
+	leaf = sa_map_leaf(g, sa != NULL);
+	if (leaf != NULL)
+		__atomic_store_n(&leaf[g & ((1 << SA_MAP_LEAF_BITS) - 1)], sa, __ATOMIC_RELEASE);
+}
+
+void sarena_map_add(sarena *sa, void *start, void *end) {
+	uintptr_t s, e, g;
+
+	s = (uintptr_t) start;
+	e = (uintptr_t) end;
+	for(g = s >> SA_MAP_GRANULE_SHIFT; g <= (e - 1) >> SA_MAP_GRANULE_SHIFT; g++) {
+		if ((g << SA_MAP_GRANULE_SHIFT) < s || ((g + 1) << SA_MAP_GRANULE_SHIFT) > e)
+			sa_map_set(g, SA_MAP_MIXED);
+		else
+			sa_map_set(g, sa);
+	}
+}
+
+void sarena_map_remove(void *start, void *end) {
+	uintptr_t s, e, g;
+
+	// partially covered granules stay mixed
+	s = (uintptr_t) start;
+	e = (uintptr_t) end;
+	for(g = (s + (1 << SA_MAP_GRANULE_SHIFT) - 1) >> SA_MAP_GRANULE_SHIFT; ((g + 1) << SA_MAP_GRANULE_SHIFT) <= e; g++)
+		sa_map_set(g, NULL);
+}
+
+static sarena *sa_map_lookup(void *ptr) {
+	uintptr_t g;
+	sarena **leaf, *sa;
+
+	g = (uintptr_t) ptr >> SA_MAP_GRANULE_SHIFT;
+	leaf = sa_map_leaf(g, 0);
+	if (leaf == NULL)
+		return NULL;
+
+	// may return SA_MAP_MIXED
+	sa = __atomic_load_n(&leaf[g & ((1 << SA_MAP_LEAF_BITS) - 1)], __ATOMIC_ACQUIRE);
+	return sa;
+}
+
+static void sa_tcache_slot_destroy(sa_tcache_slot *s) {
+	if (s->tc != SA_TCACHE_NONE)
+		je_mallctl("tcache.destroy", NULL, NULL, (void *) &s->tc, sizeof(unsigned));
+
+	s->serial = 0;
+	s->tc = SA_TCACHE_NONE;
+}
+
+// pthread key destructor, called when a thread that used tcaches exits
+static void sa_tcache_table_free(void *p) {
+	sa_tcache_table *t, **prev;
+	size_t i;
+
+	t = p;
+	pthread_mutex_lock(&sa_mutex);
+	for(prev = &sa_tcache_tables; *prev != NULL; prev = &(*prev)->next) {
+		if (*prev == t) {
+			*prev = t->next;
+			break;
+		}
+	}
+
+	for(i = 0; i < SICM_MAX_ARENAS; i++) {
+		if (t->slots[i].serial != 0)
+			sa_tcache_slot_destroy(&t->slots[i]);
+	}
+	pthread_mutex_unlock(&sa_mutex);
+
+	free(t);
+}
+
+// destroy the tcaches of all threads for the arena, should be called with sa_mutex held
+static void sa_tcache_destroy_all(sarena *sa) {
+	sa_tcache_table *t;
+
+	if (sa->arena_ind >= SICM_MAX_ARENAS)
+		return;
+
+	for(t = sa_tcache_tables; t != NULL; t = t->next) {
+		if (t->slots[sa->arena_ind].serial == sa->serial)
+			sa_tcache_slot_destroy(&t->slots[sa->arena_ind]);
+	}
+}
+
+// returns the current thread's slot for the arena, creating the tcache if needed
+static sa_tcache_slot *sa_tcache_get(sarena *sa) {
+	sa_tcache_table *t;
+	sa_tcache_slot *s;
+	size_t i, tc_sz;
+
+	t = pthread_getspecific(sa_tcache_key);
+	if (t == NULL) {
+		t = malloc(sizeof(sa_tcache_table));
+		if (t == NULL)
+			return NULL;
+
+		for(i = 0; i < SICM_MAX_ARENAS; i++) {
+			t->slots[i].serial = 0;
+			t->slots[i].tc = SA_TCACHE_NONE;
+		}
+
+		pthread_setspecific(sa_tcache_key, t);
+		pthread_mutex_lock(&sa_mutex);
+		t->next = sa_tcache_tables;
+		sa_tcache_tables = t;
+		pthread_mutex_unlock(&sa_mutex);
+	}
+
+	s = &t->slots[sa->arena_ind];
+	if (s->serial != sa->serial) {
+		pthread_mutex_lock(&sa_mutex);
+		if (s->serial != 0)
+			sa_tcache_slot_destroy(s);
+
+		// jemalloc has a limited number of explicit tcaches, go without one if we run out
+		tc_sz = sizeof(unsigned);
+		if (je_mallctl("tcache.create", (void *) &s->tc, &tc_sz, NULL, 0) != 0)
+			s->tc = SA_TCACHE_NONE;
+
+		s->gen = __atomic_load_n(&sa->tcache_gen, __ATOMIC_ACQUIRE);
+		s->serial = sa->serial;
+		pthread_mutex_unlock(&sa_mutex);
+	}
+
+	return s;
+}
+
+// flush the current thread's tcache for the arena if the arena asked for it
+static void sa_tcache_sync(sa_tcache_slot *s, sarena *sa) {
+	unsigned gen;
+
+	gen = __atomic_load_n(&sa->tcache_gen, __ATOMIC_ACQUIRE);
+	if (s->gen != gen) {
+		if (s->tc != SA_TCACHE_NONE)
+			je_mallctl("tcache.flush", NULL, NULL, (void *) &s->tc, sizeof(unsigned));
+		s->gen = gen;
+	}
+}
+
+// MALLOCX_TCACHE* flags to use for allocations and deallocations in the arena
+static int sa_tcache_flags(sarena *sa) {
+	sa_tcache_slot *s;
+
+	if (!(sa->flags & SICM_ARENA_TCACHE) || sa->arena_ind >= SICM_MAX_ARENAS)
+		return MALLOCX_TCACHE_NONE;
+
+	s = sa_tcache_get(sa);
+	if (s == NULL || s->tc == SA_TCACHE_NONE)
+		return MALLOCX_TCACHE_NONE;
+
+	sa_tcache_sync(s, sa);
+	return MALLOCX_TCACHE(s->tc);
 }
 
 // check if all devices use NUMA and if they are have the same page size
@@ -123,7 +395,27 @@ static sarena *sicm_arena_new(size_t sz, sicm_arena_flags flags, sicm_device_lis
 	pthread_mutex_init(sa->mutex, &attr);
 	sa->size = 0;
 	sa->maxsize = sz;
+	sa->mpol_gen = 0;
+	sa->tcache_gen = 0;
+	sa->pgsz = sarena_pgsz(devs);
+	sa->regions = (fd == -1 && sa->pgsz > (size_t) sysconf(_SC_PAGESIZE));
+	sa->maps = extent_arr_init();
+	sa->holes = extent_arr_init();
+	sa->tail = NULL;
+	sa->tail_end = NULL;
 	sa->nodemask = nodemask;
+	sa->weights = NULL;
+	sa_update_stripes(sa);
+	sa->tiers = 0;
+	sa->tier = NULL;
+	sa->tiers_gen = 0;
+	sa->shared = NULL;
+	sa->persistent = 0;
+	sa->initref = 0;
+	sa->bump.map = NULL;
+	sa->events_fn = NULL;
+	sa->events_ring = NULL;
+	sa->cookie = NULL;
 	sa->fd = -1;	// DON'T TOUCH! sa_alloc depends on it being -1 when arenas.create is called.
 	sa->extents = extent_arr_init();
 	sa->hooks = sicm_arena_mmap_hooks;
@@ -138,6 +430,8 @@ static sarena *sicm_arena_new(size_t sz, sicm_arena_flags flags, sicm_device_lis
 	err = je_mallctl("arenas.create", (void *) &arena_ind, &arena_ind_sz, (void *)&new_hooks, sizeof(extent_hooks_t *));
 	if (err != 0) {
 		fprintf(stderr, "can't create an arena: %d\n", err);
+		extent_arr_free(sa->maps);
+		extent_arr_free(sa->holes);
 		pthread_mutex_destroy(sa->mutex);
 		munmap(sa->mutex, sizeof(pthread_mutex_t));
 		free(sa->devs.devices);
@@ -146,25 +440,113 @@ static sarena *sicm_arena_new(size_t sz, sicm_arena_flags flags, sicm_device_lis
 	}
 
 	sa->arena_ind = arena_ind;
+	if (arena_ind < SICM_MAX_ARENAS)
+		__atomic_store_n(&sa_table[arena_ind], sa, __ATOMIC_RELEASE);
 
 	// DON'T MOVE THESE TWO ASSIGNMENTS UP!
 	// The jemalloc code needs to allocate an extent or two for internal
 	// use and our extent allocation code checks if sa->fd is negative
 	// to decide whether to allocate private or shared region
-	sa->size = offset;	// FIXME: is this correct???
+	sa->size = offset;	// extents go at the end of what is already in the file
 	sa->fd = fd;
 
 	// add the arena to the global list of arenas
 	pthread_mutex_lock(&sa_mutex);
+	sa->serial = ++sa_serial;
+	sa->next = sa_list;
+	sa_list = sa;
+	sa_num++;
+	pthread_mutex_unlock(&sa_mutex);
+
+	return sa;
+}
+
+// Bump arenas don't have a jemalloc arena. Their region is their only
+// extent, so migrations and sicm_arena_stats treat it like any other.
+static sarena *sa_bump_new(size_t sz, sicm_arena_flags flags, sicm_device_list *devs) {
+	size_t granule, align;
+	struct bitmask *nodemask;
+	sarena *sa;
+	void *p;
+
+	pthread_once(&sa_init, sarena_init);
+
+	if (sz == 0 || devs == NULL || devs->count != 1)
+		return NULL;
+
+	nodemask = sicm_device_list_check_numa(devs);
+	if (nodemask == NULL)
+		return NULL;
+
+	sa = calloc(1, sizeof(sarena));
+	if (sa == NULL)
+		goto fail;
+
+	sa->devs.count = 1;
+	sa->devs.devices = malloc(sizeof(sicm_device *));
+	if (sa->devs.devices == NULL)
+		goto fail;
+	sa->devs.devices[0] = devs->devices[0];
+
+	// The region covers whole granules of the address map, so looking up
+	// its pointers never has to ask jemalloc. Huge pages are aligned to
+	// granules already, smaller ones need a spare granule to align it.
+	sa->pgsz = sarena_pgsz(devs);
+	granule = (size_t) 1 << SA_MAP_GRANULE_SHIFT;
+	align = (sa->pgsz > granule)?sa->pgsz:granule;
+	sa->bump.size = (sz + align - 1) / align * align;
+	sa->bump.mapsize = sa->bump.size + ((sa->pgsz < granule)?granule:0);
+	p = sicm_device_alloc(devs->devices[0], sa->bump.mapsize);
+	if (p == NULL || p == MAP_FAILED)
+		goto fail;
+	sa->bump.map = p;
+	sa->bump.base = (char *) (((uintptr_t) p + granule - 1) & ~((uintptr_t) granule - 1));
+	sa->bump.next = 0;
+	sa->bump.gen = 0;
+
+	sa->mutex = (pthread_mutex_t *) mmap(NULL, sizeof(pthread_mutex_t), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (sa->mutex == MAP_FAILED) {
+		sicm_device_free(devs->devices[0], p, sa->bump.mapsize);
+		goto fail;
+	}
+	pthread_mutex_init(sa->mutex, NULL);
+
+	// objects never go back to the arena, so there is nothing to cache
+	sa->flags = flags & ~SICM_ARENA_TCACHE;
+	sa->maxsize = sz;
+	sa->size = sa->bump.size;
+	sa->nodemask = nodemask;
+	sa->maps = extent_arr_init();
+	sa->holes = extent_arr_init();
+	sa->extents = extent_arr_init();
+	sa->arena_ind = (unsigned) -1;
+	sa->fd = -1;
+	sa_update_stripes(sa);
+
+	extent_arr_insert(sa->extents, sa->bump.base, sa->bump.base + sa->bump.size, NULL);
+	sarena_map_add(sa, sa->bump.base, sa->bump.base + sa->bump.size);
+
+	pthread_mutex_lock(&sa_mutex);
+	sa->serial = ++sa_serial;
 	sa->next = sa_list;
 	sa_list = sa;
 	sa_num++;
 	pthread_mutex_unlock(&sa_mutex);
 
 	return sa;
+
+fail:
+	if (sa != NULL)
+		free(sa->devs.devices);
+	free(sa);
+	numa_free_nodemask(nodemask);
+	return NULL;
 }
 
 sicm_arena sicm_arena_create(size_t sz, sicm_arena_flags flags, sicm_device_list *devs) {
+	if (flags & SICM_ARENA_BUMP)
+		return sa_bump_new(sz, flags, devs);
+
 	return sicm_arena_new(sz, flags, devs, -1, 0, -1, 0);
 }
 
@@ -173,24 +555,347 @@ sicm_arena sicm_arena_create_mmapped(size_t sz, sicm_arena_flags flags, sicm_dev
 	return sicm_arena_new(sz, flags, devs, fd, offset, mutex_fd, mutex_offset);
 }
 
-void sicm_arena_destroy(sicm_arena arena) {
-	sarena *sa = arena;
+// Map the data of a shared arena at sh->base and bind it to the arena's
+// nodes, then switch the arena over to it. All of the data is mapped up
+// front, but only the part that the file covers is ever touched. The
+// creator maps over its reservation, everybody else needs the range free.
+static int sa_shared_attach(sarena *sa, sarena_shared *sh, int fd, int replace) {
+	unsigned long *nodemaskp, maxnode;
+	void *p;
+	int mpol, err;
+
+	p = mmap((void *) (uintptr_t) sh->base, sh->size, PROT_READ | PROT_WRITE,
+		 MAP_SHARED | MAP_NORESERVE | (replace?MAP_FIXED:MAP_FIXED_NOREPLACE), fd, sh->data);
+	if (p == MAP_FAILED)
+		return -errno;
+
+	// older kernels take MAP_FIXED_NOREPLACE as a hint
+	if ((uintptr_t) p != sh->base) {
+		munmap(p, sh->size);
+		return -EEXIST;
+	}
+
+	pthread_mutex_lock(sa->mutex);
+	mpol = sarena_mpol(sa, &nodemaskp, &maxnode);
+	err = sarena_bind(p, sh->size, mpol, nodemaskp, maxnode, &sa->stripes, 0);
+	if (err < 0) {
+		err = -errno;
+		pthread_mutex_unlock(sa->mutex);
+		munmap(p, sh->size);
+		return err;
+	}
+
+	sa->shared = sh;
+	sa->size = 0;
+	pthread_mutex_unlock(sa->mutex);
+
+	__atomic_add_fetch(&sh->attached, 1, __ATOMIC_ACQ_REL);
+	return 0;
+}
+
+sicm_arena sicm_arena_create_shared(size_t maxsize, sicm_arena_flags flags, sicm_device_list *devs, int fd) {
+	pthread_mutexattr_t attr;
+	sarena_shared *sh;
+	size_t hdrsz, size;
+	uintptr_t base;
+	sarena *sa;
+	void *p;
+	int i;
+
+	if (maxsize == 0 || fd < 0 || devs == NULL || devs->count == 0 || devs->count > SARENA_SHARED_DEVICES)
+		return NULL;
+
+	sa = sicm_arena_new(maxsize, flags, devs, fd, 0, -1, 0);
+	if (sa == NULL)
+		return NULL;
+
+	// the file is mapped in pages of the devices' size, so the data starts
+	// at the first such page after the header
+	hdrsz = (sizeof(sarena_shared) + sa->pgsz - 1) / sa->pgsz * sa->pgsz;
+	size = (maxsize + sa->pgsz - 1) / sa->pgsz * sa->pgsz;
+
+	// start from an empty file, offsets that were never handed out read as zeros
+	if (ftruncate(fd, 0) != 0 || ftruncate(fd, hdrsz) != 0)
+		goto fail;
+
+	sh = mmap(NULL, hdrsz, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (sh == MAP_FAILED)
+		goto fail;
+
+	// pick an address for the data, the other processes have to map it there too
+	p = mmap(NULL, size + sa->pgsz, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if (p == MAP_FAILED)
+		goto fail_header;
+	base = ((uintptr_t) p + sa->pgsz - 1) & ~((uintptr_t) sa->pgsz - 1);
+	if (base > (uintptr_t) p)
+		munmap(p, base - (uintptr_t) p);
+	munmap((void *) (base + size), (uintptr_t) p + sa->pgsz - base);
+
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+	pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+	pthread_mutex_init(&sh->mutex, &attr);
+	pthread_mutexattr_destroy(&attr);
+
+	sh->base = base;
+	sh->size = size;
+	sh->data = hdrsz;
+	sh->next = 0;
+	sh->filesize = 0;
+	sh->root = 0;
+	sh->attached = 0;
+	sh->flags = flags;
+	sh->ndevs = devs->count;
+	for(i = 0; i < devs->count; i++) {
+		sh->devs[i].tag = devs->devices[i]->tag;
+		sh->devs[i].node = sicm_numa_id(devs->devices[i]);
+		sh->devs[i].page_size = sicm_device_page_size(devs->devices[i]);
+	}
+
+	if (sa_shared_attach(sa, sh, fd, 1) != 0) {
+		munmap((void *) base, size);
+		goto fail_header;
+	}
+
+	// the header is complete, other processes may attach now
+	__atomic_store_n(&sh->magic, SARENA_SHARED_MAGIC, __ATOMIC_RELEASE);
+	return sa;
+
+fail_header:
+	munmap(sh, hdrsz);
+fail:
+	sicm_arena_destroy(sa);
+	return NULL;
+}
+
+sicm_arena sicm_arena_attach_shared(int fd) {
+	sicm_device_list all, devs;
+	sicm_device *dev[SARENA_SHARED_DEVICES];
+	sarena_shared *sh;
+	size_t hdrsz;
+	sarena *sa;
+	unsigned i;
+	int j;
+
+	hdrsz = sysconf(_SC_PAGESIZE);
+	sh = mmap(NULL, hdrsz, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (sh == MAP_FAILED)
+		return NULL;
+
+	if (__atomic_load_n(&sh->magic, __ATOMIC_ACQUIRE) != SARENA_SHARED_MAGIC || sh->ndevs > SARENA_SHARED_DEVICES) {
+		munmap(sh, hdrsz);
+		return NULL;
+	}
+
+	if (sh->data != hdrsz) {
+		size_t data = sh->data;
+
+		munmap(sh, hdrsz);
+		hdrsz = data;
+		sh = mmap(NULL, hdrsz, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		if (sh == MAP_FAILED)
+			return NULL;
+	}
+
+	// device handles differ between processes, find ours by what they are
+	all = sicm_init();
+	for(i = 0; i < sh->ndevs; i++) {
+		dev[i] = NULL;
+		for(j = 0; j < all.count; j++) {
+			if (all.devices[j]->tag == sh->devs[i].tag && sicm_numa_id(all.devices[j]) == sh->devs[i].node &&
+			    sicm_device_page_size(all.devices[j]) == sh->devs[i].page_size) {
+				dev[i] = all.devices[j];
+				break;
+			}
+		}
+
+		if (dev[i] == NULL)
+			break;
+	}
+
+	sa = NULL;
+	if (i == sh->ndevs) {
+		devs.count = sh->ndevs;
+		devs.devices = dev;
+		sa = sicm_arena_new(sh->size, sh->flags, &devs, fd, 0, -1, 0);
+	}
+
+	if (sa == NULL) {
+		sicm_fini();
+		munmap(sh, hdrsz);
+		return NULL;
+	}
+
+	// the devices belong to the sicm_init above, keep them until the arena goes
+	sa->initref = 1;
+
+	if (sa_shared_attach(sa, sh, fd, 0) != 0) {
+		sicm_arena_destroy(sa);
+		munmap(sh, hdrsz);
+		return NULL;
+	}
+
+	return sa;
+}
+
+// Processes keep a shared lock on the file of a persistent arena while they
+// use it, and take an exclusive one to create the arena. Whoever gets the
+// exclusive lock on a file that already has an arena is the only one using
+// it, so the attach count left behind by earlier processes is stale.
+sicm_arena sicm_arena_open_persistent(const char *path, size_t maxsize, sicm_arena_flags flags, sicm_device_list *devs) {
+	struct stat st;
+	sarena *sa;
+	int fd, alone;
+
+	fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+	if (fd < 0)
+		return NULL;
+
+	alone = (flock(fd, LOCK_EX | LOCK_NB) == 0);
+	if (!alone)
+		flock(fd, LOCK_SH);
+
+	sa = NULL;
+	if (fstat(fd, &st) == 0 && st.st_size > 0) {
+		sa = sicm_arena_attach_shared(fd);
+		if (sa != NULL && alone)
+			__atomic_store_n(&sa->shared->attached, 1, __ATOMIC_RELEASE);
+	} else if (alone && devs != NULL) {
+		sa = sicm_arena_create_shared(maxsize, flags, devs, fd);
+	}
+
+	if (sa == NULL) {
+		close(fd);
+		return NULL;
+	}
+
+	flock(fd, LOCK_SH);
+	sa->persistent = 1;
+	return sa;
+}
+
+int sicm_arena_set_root(sicm_arena arena, void *ptr) {
+	sarena *sa;
+
+	sa = arena;
+	if (sa == NULL || sa->shared == NULL)
+		return -EINVAL;
+
+	if (ptr != NULL && ((uintptr_t) ptr < sa->shared->base || (uintptr_t) ptr >= sa->shared->base + sa->shared->size))
+		return -EINVAL;
+
+	__atomic_store_n(&sa->shared->root, (uintptr_t) ptr, __ATOMIC_RELEASE);
+	return 0;
+}
+
+void *sicm_arena_get_root(sicm_arena arena) {
+	sarena *sa;
+
+	sa = arena;
+	if (sa == NULL || sa->shared == NULL)
+		return NULL;
+
+	return (void *) (uintptr_t) __atomic_load_n(&sa->shared->root, __ATOMIC_ACQUIRE);
+}
+
+// Returns how many processes are still attached to the arena if it is shared
+static int sa_destroy_arena(sarena *sa) {
 	char str[32];
 	size_t arena_ind_sz;
+	sarena_shared *sh;
+	sarena *expected;
+	int attached, initref;
 
-	if (sa == NULL)
-		return;
+	sarena **prev;
+	size_t i;
+
+	// background migrations must not touch the arena anymore
+	sarena_migrations_forget(sa);
+
+	// remove the arena from the global list of arenas
+	pthread_mutex_lock(&sa_mutex);
+	for(prev = &sa_list; *prev != NULL; prev = &(*prev)->next) {
+		if (*prev == sa) {
+			*prev = sa->next;
+			sa_num--;
+			break;
+		}
+	}
+
+	// jemalloc requires all tcaches that cache objects from the arena to be flushed first
+	sa_tcache_destroy_all(sa);
+	pthread_mutex_unlock(&sa_mutex);
+
+	// before the destroy, after which a new arena can get the same index
+	if (sa->arena_ind < SICM_MAX_ARENAS) {
+		expected = sa;
+		__atomic_compare_exchange_n(&sa_table[sa->arena_ind], &expected, NULL, 0, __ATOMIC_RELEASE, __ATOMIC_RELAXED);
+	}
 
 	/* Free up the arena */
-	snprintf(str, sizeof(str), "arena.%u.destroy", sa->arena_ind);
-	arena_ind_sz = sizeof(unsigned);
-	je_mallctl(str, (void *) &sa->arena_ind, &arena_ind_sz, NULL, 0);
+	if (sa->bump.map != NULL) {
+		// the cursors of other threads are keyed by serial, which isn't reused
+		sicm_device_free(sa->devs.devices[0], sa->bump.map, sa->bump.mapsize);
+	} else {
+		snprintf(str, sizeof(str), "arena.%u.destroy", sa->arena_ind);
+		arena_ind_sz = sizeof(unsigned);
+		je_mallctl(str, (void *) &sa->arena_ind, &arena_ind_sz, NULL, 0);
+	}
 
+	// the destroy hooks should have removed everything, but don't leave dangling pointers
+	extent_arr_for(sa->extents, i) {
+		sarena_map_remove(sa->extents->arr[i].start, sa->extents->arr[i].end);
+	}
+
+	extent_arr_for(sa->maps, i) {
+		munmap(sa->maps->arr[i].start, (char *) sa->maps->arr[i].end - (char *) sa->maps->arr[i].start);
+	}
+
+	// the data of a shared arena stays in the file for the other processes
+	attached = 0;
+	sh = sa->shared;
+	if (sh != NULL) {
+		// the file outlives the process, make sure it has everything
+		if (sa->persistent) {
+			msync((void *) (uintptr_t) sh->base, __atomic_load_n(&sh->filesize, __ATOMIC_ACQUIRE), MS_SYNC);
+			msync(sh, sh->data, MS_SYNC);
+		}
+		munmap((void *) (uintptr_t) sh->base, sh->size);
+		attached = __atomic_sub_fetch(&sh->attached, 1, __ATOMIC_ACQ_REL);
+		munmap(sh, sh->data);
+	}
+
+	// closing the file drops the lock on it
+	if (sa->persistent)
+		close(sa->fd);
+
+	extent_arr_free(sa->maps);
+	extent_arr_free(sa->holes);
 	extent_arr_free(sa->extents);
 	munmap(sa->mutex, sizeof(pthread_mutex_t));
 	free(sa->devs.devices);
+	sa_tiers_clear(sa);
 	numa_free_nodemask(sa->nodemask);
+	free(sa->weights);
+	initref = sa->initref;
 	free(sa);
+
+	if (initref)
+		sicm_fini();
+
+	return attached;
+}
+
+void sicm_arena_destroy(sicm_arena arena) {
+	if (arena != NULL)
+		sa_destroy_arena(arena);
+}
+
+int sicm_arena_detach(sicm_arena arena) {
+	if (arena == NULL)
+		return -EINVAL;
+
+	return sa_destroy_arena(arena);
 }
 
 sicm_arena_list *sicm_arenas_list() {
@@ -229,37 +934,262 @@ sicm_device_list sicm_arena_get_devices(sicm_arena a) {
 	return ret;
 }
 
-// should be called with sa mutex held
-static void sicm_arena_range_move(void *aux, void *start, void *end) {
-	int err;
-	int mpol;
-	unsigned long *nodemaskp, maxnode;
-	sarena *sa = (sarena *) aux;
+// whether the kernel knows the memory policy, they are newer than libnuma's headers
+static int sa_mpol_supported(int mpol) {
+	static int supported[MPOL_WEIGHTED_INTERLEAVE + 1];
+	struct bitmask *allowed;
+	size_t pgsz;
+	void *p;
+	int ret;
+
+	ret = __atomic_load_n(&supported[mpol], __ATOMIC_RELAXED);
+	if (ret != 0)
+		return ret > 0;
+
+	ret = -1;
+	pgsz = sysconf(_SC_PAGESIZE);
+	p = mmap(NULL, pgsz, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (p != MAP_FAILED) {
+		allowed = numa_get_mems_allowed();
+		if (mbind(p, pgsz, mpol, allowed->maskp, allowed->size + 1, 0) == 0)
+			ret = 1;
+		numa_free_nodemask(allowed);
+		munmap(p, pgsz);
+	}
 
-	switch (sa->flags & SICM_ALLOC_MASK) {
-	case SICM_ALLOC_STRICT:
-		mpol = MPOL_BIND;
-		nodemaskp = sa->nodemask->maskp;
-		maxnode = sa->nodemask->size + 1;
-		break;
+	__atomic_store_n(&supported[mpol], ret, __ATOMIC_RELAXED);
+	return ret > 0;
+}
 
-	case SICM_ALLOC_RELAXED:
-		// TODO: this will work only for single device, fix it
-		mpol = MPOL_PREFERRED;
-		nodemaskp = sa->nodemask->maskp;
-		maxnode = sa->nodemask->size + 1;
-		break;
+// whether the kernel's weighted interleave uses the same ratio between the nodes
+static int sa_kernel_weights_match(unsigned *nodes, unsigned *weights, unsigned count) {
+	char path[128];
+	unsigned i, kw[count];
+	FILE *f;
+
+	if (!sa_mpol_supported(MPOL_WEIGHTED_INTERLEAVE))
+		return 0;
+
+	for(i = 0; i < count; i++) {
+		snprintf(path, sizeof(path), "/sys/kernel/mm/mempolicy/weighted_interleave/node%u", nodes[i]);
+		f = fopen(path, "r");
+		if (f == NULL)
+			return 0;
+		if (fscanf(f, "%u", &kw[i]) != 1)
+			kw[i] = 0;
+		fclose(f);
+
+		if (kw[i] == 0 || kw[i] * weights[0] != kw[0] * weights[i])
+			return 0;
+	}
+
+	return 1;
+}
+
+static unsigned sa_gcd(unsigned a, unsigned b) {
+	unsigned t;
+
+	while (b != 0) {
+		t = a % b;
+		a = b;
+		b = t;
+	}
+
+	return a;
+}
+
+// Work out the stripes from the nodemask, the weights and the page size.
+// should be called with sa mutex held
+static void sa_update_stripes(sarena *sa) {
+	unsigned nodes[SICM_MAX_STRIPES], weights[SICM_MAX_STRIPES], current[SICM_MAX_STRIPES];
+	unsigned i, count, total, g, best;
+	int node;
+
+	sa->stripes.count = 0;
+	sa->stripes.kernel = 0;
+	if ((sa->flags & SICM_ALLOC_MASK) != SICM_ALLOC_INTERLEAVE || sa->weights == NULL)
+		return;
+
+	count = 0;
+	for(node = 0; node < numa_num_possible_nodes() && count < SICM_MAX_STRIPES; node++) {
+		if (numa_bitmask_isbitset(sa->nodemask, node)) {
+			nodes[count] = node;
+			weights[count] = sa->weights[node]?sa->weights[node]:1;
+			count++;
+		}
+	}
+
+	// plain interleaving is good enough
+	if (count < 2)
+		return;
+
+	g = weights[0];
+	for(i = 1; i < count; i++)
+		g = sa_gcd(g, weights[i]);
+
+	total = 0;
+	for(i = 0; i < count; i++) {
+		weights[i] /= g;
+		total += weights[i];
+	}
+
+	// keep the ratio as well as a round of SICM_MAX_STRIPES stripes allows
+	if (total > SICM_MAX_STRIPES) {
+		g = total;
+		total = 0;
+		for(i = 0; i < count; i++) {
+			weights[i] = (unsigned) ((double) weights[i] * (SICM_MAX_STRIPES - count) / g) + 1;
+			total += weights[i];
+		}
+	}
+
+	if (sa_kernel_weights_match(nodes, weights, count)) {
+		sa->stripes.kernel = 1;
+		sa->stripes.size = sa->pgsz;
+	} else {
+		sa->stripes.size = (sa->pgsz > SICM_STRIPE)?sa->pgsz:SICM_STRIPE;
+	}
+
+	// smooth weighted round robin, so that the nodes take turns instead of
+	// each getting all of its stripes in a row
+	memset(current, 0, sizeof(current));
+	for(sa->stripes.count = 0; sa->stripes.count < total; sa->stripes.count++) {
+		best = 0;
+		for(i = 0; i < count; i++) {
+			current[i] += weights[i];
+			if (current[i] > current[best])
+				best = i;
+		}
+		current[best] -= total;
+		sa->stripes.nodes[sa->stripes.count] = nodes[best];
+	}
+}
+
+// should be called with sa mutex held
+int sarena_mpol(sarena *sa, unsigned long **nodemaskp, unsigned long *maxnode) {
+	int mpol;
+
+	switch (sa->flags & SICM_ALLOC_MASK) {
+	case SICM_ALLOC_STRICT:
+		mpol = MPOL_BIND;
+		*nodemaskp = sa->nodemask->maskp;
+		*maxnode = sa->nodemask->size + 1;
+		break;
+
+	case SICM_ALLOC_RELAXED:
+		// the kernel used to only prefer a single node, the first one in the mask
+		mpol = MPOL_PREFERRED;
+		if (numa_bitmask_weight(sa->nodemask) > 1 && sa_mpol_supported(MPOL_PREFERRED_MANY))
+			mpol = MPOL_PREFERRED_MANY;
+		*nodemaskp = sa->nodemask->maskp;
+		*maxnode = sa->nodemask->size + 1;
+		break;
+
+	case SICM_ALLOC_INTERLEAVE:
+		// stripes are bound one by one to their own nodes by sarena_bind
+		mpol = MPOL_INTERLEAVE;
+		if (sa->stripes.kernel)
+			mpol = MPOL_WEIGHTED_INTERLEAVE;
+		else if (sa->stripes.count > 0)
+			mpol = MPOL_BIND;
+		*nodemaskp = sa->nodemask->maskp;
+		*maxnode = sa->nodemask->size + 1;
+		break;
 
 	default:
 		mpol = MPOL_DEFAULT;
-		nodemaskp = NULL;
-		maxnode = 0;
+		*nodemaskp = NULL;
+		*maxnode = 0;
 		break;
 	}
 
-	err = mbind((void *) start, (char*) end - (char*) start, mpol, nodemaskp, maxnode, MPOL_MF_MOVE);
-	if (err < 0 && sa->err == 0)
-		sa->err = err;
+	return mpol;
+}
+
+int sarena_bind(void *start, size_t len, int mpol, unsigned long *nodemaskp, unsigned long maxnode,
+		sarena_stripes *stripes, unsigned flags) {
+	char *p, *end, *next;
+	int node;
+	struct bitmask *mask;
+
+	if (stripes == NULL || stripes->count == 0 || stripes->kernel)
+		return mbind(start, len, mpol, nodemaskp, maxnode, flags);
+
+	// neighbouring stripes on the same node are bound together
+	mask = numa_allocate_nodemask();
+	end = (char *) start + len;
+	for(p = start; p < end; p = next) {
+		node = stripes->nodes[((uintptr_t) p / stripes->size) % stripes->count];
+		next = p;
+		do {
+			next = (char *) (((uintptr_t) next / stripes->size + 1) * stripes->size);
+		} while (next < end && stripes->nodes[((uintptr_t) next / stripes->size) % stripes->count] == node);
+		if (next > end)
+			next = end;
+
+		numa_bitmask_clearall(mask);
+		numa_bitmask_setbit(mask, node);
+		if (mbind(p, next - p, MPOL_BIND, mask->maskp, mask->size + 1, flags) < 0) {
+			numa_free_nodemask(mask);
+			return -1;
+		}
+	}
+
+	numa_free_nodemask(mask);
+	return 0;
+}
+
+// first node of the mask, -1 if there isn't one
+static int sa_first_node(struct bitmask *nodemask) {
+	int node;
+
+	for(node = 0; node < numa_num_possible_nodes(); node++) {
+		if (numa_bitmask_isbitset(nodemask, node))
+			return node;
+	}
+
+	return -1;
+}
+
+// Move the ranges to the arena's nodes. The policy is set first so that
+// pages that haven't been touched yet end up in the right place too; the
+// pages that are there already are moved with sicm_move_ranges. The kernel's
+// weighted interleaving places pages by their offset in the mapping, which
+// only the kernel knows, so it moves those pages itself.
+// should be called with sa mutex held
+int sarena_move(sarena *sa, extent_arr *ranges, struct bitmask *src) {
+	int err, mpol;
+	size_t i;
+	unsigned long *nodemaskp, maxnode;
+	unsigned flags;
+
+	err = 0;
+	mpol = sarena_mpol(sa, &nodemaskp, &maxnode);
+	flags = sa->stripes.kernel?MPOL_MF_MOVE:0;
+	extent_arr_for(ranges, i) {
+		if (sarena_bind(ranges->arr[i].start, (char *) ranges->arr[i].end - (char *) ranges->arr[i].start, mpol, nodemaskp, maxnode, &sa->stripes, flags) < 0) {
+			err = -errno;
+			break;
+		}
+	}
+
+	if (err != 0 || nodemaskp == NULL)
+		return err;
+
+	if (!sa->stripes.kernel)
+		err = sicm_move_ranges(ranges, sa->pgsz, sa->nodemask, (src != NULL)?sa_first_node(src):-1, &sa->stripes);
+
+	// relaxed arenas are fine with what didn't fit
+	if ((mpol == MPOL_PREFERRED || mpol == MPOL_PREFERRED_MANY) && err == -ENOMEM)
+		err = 0;
+
+	if (err == 0) {
+		extent_arr_for(ranges, i) {
+			sarena_event(sa, SICM_EXTENT_MIGRATE, ranges->arr[i].start, NULL, ranges->arr[i].end);
+		}
+	}
+
+	return err;
 }
 
 int sicm_arena_set_device(sicm_arena sa, sicm_device *dev) {
@@ -273,101 +1203,815 @@ int sicm_arena_set_device_array(sicm_arena sa, sicm_device **devs, size_t count)
     return sicm_arena_set_device_list(sa, &list);
 }
 
-// FIXME: doesn't support moving to huge pages
-int sicm_arena_set_device_list(sicm_arena a, sicm_device_list *devs) {
-	int err, node, oldnumaid;
+size_t sarena_pgsz(sicm_device_list *devs) {
+	size_t pgsz;
+
+	pgsz = sicm_device_page_size(devs->devices[0]) * 1024;
+	if (pgsz < (size_t) sysconf(_SC_PAGESIZE))
+		pgsz = sysconf(_SC_PAGESIZE);
+
+	return pgsz;
+}
+
+// Objects cached by other threads live in the extents that are moved, so
+// they end up on the new devices too. Each thread flushes its own tcache
+// the next time it uses the arena; explicit tcaches can't be flushed from
+// another thread while it might be using them.
+static void sa_tcache_invalidate(sarena *sa) {
+	if (sa->flags & SICM_ARENA_TCACHE) {
+		__atomic_add_fetch(&sa->tcache_gen, 1, __ATOMIC_ACQ_REL);
+		sa_tcache_flags(sa);
+	}
+}
+
+extent_arr *sarena_switch_devices(sarena *sa, sicm_device_list *devs) {
 	size_t i;
+	struct bitmask *nodemask;
+	extent_arr *ranges, *live;
+
+	nodemask = sicm_device_list_check_numa(devs);
+	if (nodemask == NULL)
+		return NULL;
+
+	sa_tcache_invalidate(sa);
+
+	ranges = extent_arr_init();
+	pthread_mutex_lock(sa->mutex);
+	sa_tiers_clear(sa);
+	numa_free_nodemask(sa->nodemask);
+	sa->nodemask = nodemask;
+	sa_update_stripes(sa);
+	sa->mpol_gen++;
+
+	sa->devs.count = devs->count;
+	sa->devs.devices = realloc(sa->devs.devices, devs->count * sizeof(sicm_device *));
+	memcpy(sa->devs.devices, devs->devices, devs->count * sizeof(sicm_device *));
+
+	// regions include memory that jemalloc hasn't asked for yet
+	live = sa->regions?sa->maps:sa->extents;
+	extent_arr_for(live, i) {
+		extent_arr_insert(ranges, live->arr[i].start, live->arr[i].end, NULL);
+	}
+	pthread_mutex_unlock(sa->mutex);
+
+	return ranges;
+}
+
+int sicm_arena_set_device_list(sicm_arena a, sicm_device_list *devs) {
+	int err, mpol;
+	size_t pgsz;
 	sarena *sa;
 	struct bitmask *nodemask, *oldnodemask;
+	unsigned long *nodemaskp, maxnode;
+	extent_arr *ranges;
 
+	// the policy of a shared arena's data is shared by all of its processes
 	sa = a;
-	if (sa == NULL)
+	if (sa == NULL || sa->shared != NULL)
 		return -EINVAL;
 
 	nodemask = sicm_device_list_check_numa(devs);
 	if (nodemask == NULL)
 		return -EINVAL;
 
-	if (sicm_device_page_size(devs->devices[0]) != sicm_device_page_size(sa->devs.devices[0]))
+	// the region of a bump arena can't be remapped onto other pages
+	pgsz = sarena_pgsz(devs);
+	if (sa->bump.map != NULL && pgsz != sa->pgsz) {
+		numa_free_nodemask(nodemask);
 		return -EINVAL;
+	}
+
+	// this supersedes any migration that is still running in the background
+	sarena_migrations_cancel(sa);
+	sa_tcache_invalidate(sa);
 
 	err = 0;
 	pthread_mutex_lock(sa->mutex);
+	sa_tiers_clear(sa);
 	oldnodemask = sa->nodemask;
-	sa->nodemask = nodemask;
-	sa->err = 0;
-	extent_arr_for(sa->extents, i) {
-		if(!sa->extents->arr[i].start && !sa->extents->arr[i].end) continue;
-		sicm_arena_range_move(sa, sa->extents->arr[i].start, sa->extents->arr[i].end);
-	}
 
-	if (sa->err) {
-		// at least one extent wasn't moved, try to roll back the ones that succeeded
-		err = sa->err;
+	if (pgsz != sa->pgsz) {
+		// the memory has to be copied onto the new pages, which puts it on the new devices too
+		sa->nodemask = nodemask;
+		sa_update_stripes(sa);
+		mpol = sarena_mpol(sa, &nodemaskp, &maxnode);
 		sa->nodemask = oldnodemask;
-		sa->err = 0;
-		extent_arr_for(sa->extents, i) {
-			if(!sa->extents->arr[i].start && !sa->extents->arr[i].end) continue;
-			sicm_arena_range_move(sa, sa->extents->arr[i].start, sa->extents->arr[i].end);
+		sa_update_stripes(sa);
+		err = sarena_remap(sa, pgsz, mpol, nodemaskp, maxnode);
+		if (err == 0) {
+			sa->nodemask = nodemask;
+			sa_update_stripes(sa);
+
+			// the copy was bound to all of the nodes, spread it over them
+			if (sa->stripes.count > 0 && !sa->stripes.kernel)
+				sarena_move(sa, sa->regions?sa->maps:sa->extents, NULL);
 		}
-		// TODO: not sure what to do if moving back fails
-		numa_free_nodemask(nodemask);
-		err = sa->err;
 	} else {
+		// regions include memory that jemalloc hasn't asked for yet
+		ranges = sa->regions?sa->maps:sa->extents;
+
+		sa->nodemask = nodemask;
+		sa_update_stripes(sa);
+		sa->mpol_gen++;
+		err = sarena_move(sa, ranges, oldnodemask);
+		if (err) {
+			// some of the memory wasn't moved, try to roll back the rest
+			sa->nodemask = oldnodemask;
+			sa_update_stripes(sa);
+			sa->mpol_gen++;
+			sarena_move(sa, ranges, nodemask);
+			// TODO: not sure what to do if moving back fails
+		}
+	}
+
+	if (err == 0) {
 		sa->devs.count = devs->count;
 		sa->devs.devices = realloc(sa->devs.devices, devs->count * sizeof(sicm_device *));
 		memcpy(sa->devs.devices, devs->devices, devs->count * sizeof(sicm_device *));
 		numa_free_nodemask(oldnodemask);
+	} else {
+		numa_free_nodemask(nodemask);
+	}
+
+	pthread_mutex_unlock(sa->mutex);
+
+	return err;
+}
+
+int sicm_arena_set_weights(sicm_arena a, sicm_device_list *devs, unsigned *weights) {
+	sarena *sa;
+	size_t i;
+	int node, err;
+	unsigned *w;
+
+	sa = a;
+	if (sa == NULL || devs == NULL || weights == NULL || (sa->flags & SICM_ALLOC_MASK) != SICM_ALLOC_INTERLEAVE ||
+	    sa->shared != NULL)
+		return -EINVAL;
+
+	for(i = 0; i < devs->count; i++) {
+		if (sicm_numa_id(devs->devices[i]) < 0 || weights[i] == 0)
+			return -EINVAL;
+	}
+
+	w = calloc(numa_num_possible_nodes(), sizeof(unsigned));
+	if (w == NULL)
+		return -ENOMEM;
+
+	// this supersedes any migration that is still running in the background
+	sarena_migrations_cancel(sa);
+
+	pthread_mutex_lock(sa->mutex);
+	if (sa->weights != NULL)
+		memcpy(w, sa->weights, numa_num_possible_nodes() * sizeof(unsigned));
+	for(i = 0; i < devs->count; i++) {
+		node = sicm_numa_id(devs->devices[i]);
+		w[node] = weights[i];
 	}
+	free(sa->weights);
+	sa->weights = w;
+	sa_update_stripes(sa);
+	sa->mpol_gen++;
 
+	// regions include memory that jemalloc hasn't asked for yet
+	err = sarena_move(sa, sa->regions?sa->maps:sa->extents, NULL);
 	pthread_mutex_unlock(sa->mutex);
 
 	return err;
 }
 
+// A device has room if the extent fits in its budget and in its free
+// memory. Free memory comes from the last snapshot, which sa_alloc
+// refreshes before taking the mutex, so it can be a bit stale; the last
+// device only checks its budget, since there is nowhere left to spill to.
+// should be called with sa mutex held
+static int sa_tier_has_room(sarena *sa, int tier, size_t size) {
+	size_t avail;
+
+	if (sa->tier[tier].budget != 0 && sa->tier[tier].used + size > sa->tier[tier].budget)
+		return 0;
+	if (tier == sa->tiers - 1)
+		return 1;
+
+	avail = sicm_avail_cached(sa->tier[tier].dev);
+	return avail == (size_t) -1 || avail * 1024 >= size;
+}
+
+// should be called with sa mutex held
+int sarena_tier_pick(sarena *sa, size_t size) {
+	int tier;
+
+	for(tier = 0; tier < sa->tiers; tier++) {
+		if (sa_tier_has_room(sa, tier, size)) {
+			sa->tier[tier].used += size;
+			return tier;
+		}
+	}
+
+	return -1;
+}
+
+// should be called with sa mutex held
+int sarena_tier_mpol(sarena *sa, int tier, unsigned long **nodemaskp, unsigned long *maxnode) {
+	*nodemaskp = sa->tier[tier].nodemask->maskp;
+	*maxnode = sa->tier[tier].nodemask->size + 1;
+
+	// each tier is a single device, so there is nothing to interleave
+	return ((sa->flags & SICM_ALLOC_MASK) == SICM_ALLOC_RELAXED)?MPOL_PREFERRED:MPOL_BIND;
+}
+
+// Forget the fallback chain, the extents stay where they are.
+// should be called with sa mutex held
+static void sa_tiers_clear(sarena *sa) {
+	size_t i;
+	int tier;
+
+	if (sa->tiers == 0)
+		return;
+
+	for(tier = 0; tier < sa->tiers; tier++)
+		numa_free_nodemask(sa->tier[tier].nodemask);
+	free(sa->tier);
+	sa->tier = NULL;
+	sa->tiers = 0;
+	sa->tiers_gen++;
+
+	extent_arr_for(sa->extents, i) {
+		sa->extents->arr[i].arena = NULL;
+	}
+}
+
+// should be called with sa mutex held
+static int sa_tier_move(sarena *sa, int tier, void *start, void *end) {
+	int err, mpol;
+	unsigned long *nodemaskp, maxnode;
+	extent_info one = { .start = start, .end = end };
+	extent_arr range = { .max_extents = 1, .index = 1, .arr = &one };
+
+	mpol = sarena_tier_mpol(sa, tier, &nodemaskp, &maxnode);
+	if (mbind(start, (char *) end - (char *) start, mpol, nodemaskp, maxnode, 0) < 0)
+		return -errno;
+
+	err = sicm_move_ranges(&range, sa->pgsz, sa->tier[tier].nodemask, -1, NULL);
+	if (mpol == MPOL_PREFERRED && err == -ENOMEM)
+		err = 0;
+
+	if (err == 0)
+		sarena_event(sa, SICM_EXTENT_MIGRATE, start, NULL, end);
+
+	return err;
+}
+
+int sicm_arena_set_fallback(sicm_arena a, sicm_device_list *devs, size_t *budgets) {
+	sarena *sa;
+	sarena_tier *tier;
+	struct bitmask *nodemask;
+	extent_info *e;
+	size_t i, len;
+	int t, err;
+
+	sa = a;
+	if (sa == NULL || devs == NULL || devs->count == 0 || sa->regions || sa->shared != NULL || sa->bump.map != NULL)
+		return -EINVAL;
+
+	nodemask = sicm_device_list_check_numa(devs);
+	if (nodemask == NULL)
+		return -EINVAL;
+
+	if (sarena_pgsz(devs) != sa->pgsz) {
+		numa_free_nodemask(nodemask);
+		return -EINVAL;
+	}
+
+	tier = calloc(devs->count, sizeof(sarena_tier));
+	if (tier == NULL) {
+		numa_free_nodemask(nodemask);
+		return -ENOMEM;
+	}
+
+	for(i = 0; i < devs->count; i++) {
+		tier[i].dev = devs->devices[i];
+		tier[i].nodemask = numa_allocate_nodemask();
+		numa_bitmask_setbit(tier[i].nodemask, sicm_numa_id(devs->devices[i]));
+		tier[i].budget = (budgets != NULL)?budgets[i]:0;
+	}
+
+	// this supersedes any migration that is still running in the background
+	sarena_migrations_cancel(sa);
+	sa_tcache_invalidate(sa);
+
+	// the devices' free memory is only read from the snapshot with the mutex held
+	sicm_devices_snapshot(NULL, 0);
+
+	pthread_mutex_lock(sa->mutex);
+	sa_tiers_clear(sa);
+	sa->tier = tier;
+	sa->tiers = devs->count;
+	sa->tiers_gen++;
+
+	numa_free_nodemask(sa->nodemask);
+	sa->nodemask = nodemask;
+	sa_update_stripes(sa);
+	sa->mpol_gen++;
+
+	sa->devs.count = devs->count;
+	sa->devs.devices = realloc(sa->devs.devices, devs->count * sizeof(sicm_device *));
+	memcpy(sa->devs.devices, devs->devices, devs->count * sizeof(sicm_device *));
+
+	// place what the arena already has as if it was allocated now
+	err = 0;
+	extent_arr_for(sa->extents, i) {
+		e = &sa->extents->arr[i];
+		len = (char *) e->end - (char *) e->start;
+		t = sarena_tier_pick(sa, len);
+		if (t < 0) {
+			t = sa->tiers - 1;
+			sa->tier[t].used += len;
+		}
+		e->arena = SARENA_TIER_TAG(t);
+
+		if (sa_tier_move(sa, t, e->start, e->end) != 0 && err == 0)
+			err = -EIO;
+	}
+	pthread_mutex_unlock(sa->mutex);
+
+	return err;
+}
+
+size_t sicm_arena_device_size(sicm_arena a, sicm_device *dev) {
+	sarena *sa;
+	size_t size;
+	int tier;
+
+	sa = a;
+	if (sa == NULL)
+		return 0;
+
+	size = 0;
+	pthread_mutex_lock(sa->mutex);
+	for(tier = 0; tier < sa->tiers; tier++) {
+		if (sa->tier[tier].dev == dev)
+			size += sa->tier[tier].used;
+	}
+	pthread_mutex_unlock(sa->mutex);
+
+	return size;
+}
+
+size_t sicm_arena_promote(sicm_arena a) {
+	sarena *sa;
+	extent_info *e;
+	size_t i, len, moved;
+	int from, to;
+
+	sa = a;
+	if (sa == NULL)
+		return 0;
+
+	moved = 0;
+	sicm_devices_snapshot(NULL, 0);
+	pthread_mutex_lock(sa->mutex);
+	extent_arr_for(sa->extents, i) {
+		e = &sa->extents->arr[i];
+		if (e->arena == NULL)
+			continue;
+
+		from = SARENA_TAG_TIER(e->arena);
+		len = (char *) e->end - (char *) e->start;
+		for(to = 0; to < from; to++) {
+			if (sa_tier_has_room(sa, to, len))
+				break;
+		}
+		if (to == from)
+			continue;
+
+		if (sa_tier_move(sa, to, e->start, e->end) != 0) {
+			// put back whatever made it
+			sa_tier_move(sa, from, e->start, e->end);
+			continue;
+		}
+
+		sa->tier[from].used -= len;
+		sa->tier[to].used += len;
+		e->arena = SARENA_TIER_TAG(to);
+		moved += len;
+	}
+	pthread_mutex_unlock(sa->mutex);
+
+	return moved;
+}
+
+int sicm_arena_set_decay(sicm_arena a, ssize_t dirty_decay_ms, ssize_t muzzy_decay_ms) {
+	sarena *sa;
+	char str[64];
+	int err;
+
+	sa = a;
+	if (sa == NULL || sa->bump.map != NULL)
+		return -EINVAL;
+
+	snprintf(str, sizeof(str), "arena.%u.dirty_decay_ms", sa->arena_ind);
+	err = je_mallctl(str, NULL, NULL, (void *) &dirty_decay_ms, sizeof(ssize_t));
+	if (err != 0)
+		return -err;
+
+	snprintf(str, sizeof(str), "arena.%u.muzzy_decay_ms", sa->arena_ind);
+	err = je_mallctl(str, NULL, NULL, (void *) &muzzy_decay_ms, sizeof(ssize_t));
+	if (err != 0)
+		return -err;
+
+	return 0;
+}
+
+int sicm_arena_reset(sicm_arena a, int keep_extents) {
+	sarena *sa;
+	char str[64];
+	int err;
+
+	sa = a;
+	if (sa == NULL)
+		return -EINVAL;
+
+	// Threads drop their chunks the next time they allocate. The pages of
+	// the region stay bound to the arena's nodes when they are given back.
+	if (sa->bump.map != NULL) {
+		__atomic_add_fetch(&sa->bump.gen, 1, __ATOMIC_ACQ_REL);
+		__atomic_store_n(&sa->bump.next, 0, __ATOMIC_RELEASE);
+		if (!keep_extents && madvise(sa->bump.base, sa->bump.size, MADV_DONTNEED) != 0)
+			return -errno;
+
+		return 0;
+	}
+
+	// jemalloc requires all tcaches that cache objects from the arena to be flushed first
+	pthread_mutex_lock(&sa_mutex);
+	sa_tcache_destroy_all(sa);
+	pthread_mutex_unlock(&sa_mutex);
+
+	// The objects are gone, but their extents stay with jemalloc as dirty
+	// extents: still mapped and bound, and sa->extents still has them.
+	// Decay gives their pages back over time like for any other free memory.
+	snprintf(str, sizeof(str), "arena.%u.reset", sa->arena_ind);
+	err = je_mallctl(str, NULL, NULL, NULL, 0);
+	if (err != 0)
+		return -err;
+
+	if (keep_extents)
+		return 0;
+
+	snprintf(str, sizeof(str), "arena.%u.purge", sa->arena_ind);
+	err = je_mallctl(str, NULL, NULL, NULL, 0);
+	if (err != 0)
+		return -err;
+
+	return 0;
+}
+
 size_t sicm_arena_size(sicm_arena a) {
-	size_t ret;
 	sarena *sa;
 
 	sa = a;
+	return __atomic_load_n(&sa->size, __ATOMIC_RELAXED);
+}
+
+// one of jemalloc's statistics for the arena, 0 if it doesn't keep them
+static size_t sa_je_stat(sarena *sa, const char *name) {
+	char str[64];
+	size_t val, sz;
+
+	snprintf(str, sizeof(str), "stats.arenas.%u.%s", sa->arena_ind, name);
+	sz = sizeof(size_t);
+	if (je_mallctl(str, (void *) &val, &sz, NULL, 0) != 0)
+		return 0;
+
+	return val;
+}
+
+// Add up where the pages of the arena are, from a sample of at most
+// SA_STATS_SAMPLES pages (plus one per extent) spread over its extents.
+static int sa_resident(sarena *sa, size_t *resident, int nodes) {
+	extent_info *ranges;
+	size_t i, n, total, stride, count, pgsz;
+	char *p;
+	void **pages;
+	size_t *weights;
+	int *status, err;
+
+	// only hold the mutex while copying, the lookups can take a while
 	pthread_mutex_lock(sa->mutex);
-	ret = sa->size;
+	n = sa->extents->index;
+	pgsz = sa->pgsz;
+	ranges = malloc((n + 1) * sizeof(extent_info));
+	if (ranges != NULL)
+		memcpy(ranges, sa->extents->arr, n * sizeof(extent_info));
 	pthread_mutex_unlock(sa->mutex);
 
-	return ret;
+	if (ranges == NULL)
+		return -ENOMEM;
+
+	total = 0;
+	for(i = 0; i < n; i++)
+		total += (char *) ranges[i].end - (char *) ranges[i].start;
+
+	stride = total / pgsz / SA_STATS_SAMPLES;
+	if (stride == 0)
+		stride = 1;
+	stride *= pgsz;
+
+	pages = malloc((SA_STATS_SAMPLES + n) * sizeof(void *));
+	weights = malloc((SA_STATS_SAMPLES + n) * sizeof(size_t));
+	status = malloc((SA_STATS_SAMPLES + n) * sizeof(int));
+	err = -ENOMEM;
+	if (pages != NULL && weights != NULL && status != NULL) {
+		count = 0;
+		for(i = 0; i < n; i++) {
+			for(p = ranges[i].start; p < (char *) ranges[i].end && count < SA_STATS_SAMPLES + n; p += stride) {
+				pages[count] = p;
+				weights[count] = ((char *) ranges[i].end - p < (ssize_t) stride)?(size_t) ((char *) ranges[i].end - p):stride;
+				count++;
+			}
+		}
+
+		// with no nodes to move to, move_pages only says where the pages are
+		err = 0;
+		if (count > 0 && numa_move_pages(0, count, pages, NULL, status, 0) < 0)
+			err = -errno;
+
+		for(i = 0; err == 0 && i < count; i++) {
+			if (status[i] >= 0 && status[i] < nodes)
+				resident[status[i]] += weights[i];
+		}
+	}
+
+	free(status);
+	free(weights);
+	free(pages);
+	free(ranges);
+
+	return err;
+}
+
+int sicm_arena_stats(sicm_arena a, struct sicm_arena_stats *stats) {
+	sarena *sa;
+	uint64_t epoch;
+	size_t sz, page;
+	int node;
+
+	sa = a;
+	if (sa == NULL || stats == NULL)
+		return -EINVAL;
+
+	// jemalloc's statistics are only brought up to date when the epoch changes
+	epoch = 1;
+	sz = sizeof(epoch);
+	je_mallctl("epoch", (void *) &epoch, &sz, (void *) &epoch, sz);
+
+	sz = sizeof(size_t);
+	if (je_mallctl("arenas.page", (void *) &page, &sz, NULL, 0) != 0)
+		page = sysconf(_SC_PAGESIZE);
+
+	stats->mapped = __atomic_load_n(&sa->size, __ATOMIC_RELAXED);
+	if (sa->bump.map != NULL) {
+		// chunks that threads claimed count as allocated
+		stats->allocated = __atomic_load_n(&sa->bump.next, __ATOMIC_RELAXED);
+		if (stats->allocated > sa->bump.size)
+			stats->allocated = sa->bump.size;
+		stats->active = stats->allocated;
+		stats->dirty = 0;
+	} else {
+		stats->allocated = sa_je_stat(sa, "small.allocated") + sa_je_stat(sa, "large.allocated");
+		stats->active = sa_je_stat(sa, "pactive") * page;
+		stats->dirty = sa_je_stat(sa, "pdirty") * page;
+	}
+
+	if (stats->resident == NULL)
+		return 0;
+
+	for(node = 0; node < stats->nodes; node++)
+		stats->resident[node] = 0;
+
+	return sa_resident(sa, stats->resident, stats->nodes);
+}
+
+// Claim len bytes of the region of a bump arena. Returns NULL if the region
+// is full, got is less than len if only its end was left.
+static char *sa_bump_claim(sarena *sa, size_t len, size_t *got) {
+	size_t off;
+
+	// next runs past the end once the region is full, until the arena is reset
+	off = __atomic_fetch_add(&sa->bump.next, len, __ATOMIC_RELAXED);
+	if (off >= sa->bump.size)
+		return NULL;
+
+	*got = (sa->bump.size - off < len)?sa->bump.size - off:len;
+	return sa->bump.base + off;
+}
+
+// first address after cur that is aligned and leaves room for the size
+static inline char *sa_bump_place(char *cur, size_t align) {
+	return (char *) (((uintptr_t) cur + sizeof(size_t) + align - 1) & ~((uintptr_t) align - 1));
+}
+
+// the thread's cursor for the arena, NULL if its chunk is from before a reset
+static sa_bump_cursor *sa_bump_cursor_get(sarena *sa, unsigned gen) {
+	sa_bump_cursor *c;
+
+	c = &sa_bump_cursors[sa->serial % SA_BUMP_CURSORS];
+	if (c->serial != sa->serial || c->gen != gen)
+		return NULL;
+
+	return c;
+}
+
+static void *sa_bump_alloc(sarena *sa, size_t sz, size_t align) {
+	sa_bump_cursor *c;
+	unsigned gen;
+	size_t got;
+	char *p;
+
+	if (align < SA_BUMP_ALIGN)
+		align = SA_BUMP_ALIGN;
+
+	gen = __atomic_load_n(&sa->bump.gen, __ATOMIC_ACQUIRE);
+	c = sa_bump_cursor_get(sa, gen);
+	if (c != NULL) {
+		p = sa_bump_place(c->cur, align);
+		if (p <= c->end && sz <= (size_t) (c->end - p)) {
+			c->cur = p + sz;
+			c->last = p;
+			SA_BUMP_SIZE(p) = sz;
+			return p;
+		}
+	}
+
+	// big objects get their own part of the region so that the thread's
+	// chunk isn't wasted. Claims are multiples of SA_BUMP_ALIGN, so the
+	// size fits in front of the object without claiming more.
+	if (sz + align > SA_BUMP_CHUNK / 4) {
+		p = sa_bump_claim(sa, (sz + align + SA_BUMP_ALIGN - 1) / SA_BUMP_ALIGN * SA_BUMP_ALIGN, &got);
+		if (p == NULL || got < sz + align)
+			return NULL;
+
+		p = sa_bump_place(p, align);
+		SA_BUMP_SIZE(p) = sz;
+		return p;
+	}
+
+	// what is left of the old chunk is only reused after a reset
+	p = sa_bump_claim(sa, SA_BUMP_CHUNK, &got);
+	if (p == NULL)
+		return NULL;
+
+	c = &sa_bump_cursors[sa->serial % SA_BUMP_CURSORS];
+	c->serial = sa->serial;
+	c->gen = gen;
+	c->cur = p;
+	c->end = p + got;
+	c->last = NULL;
+
+	p = sa_bump_place(c->cur, align);
+	if (p > c->end || sz > (size_t) (c->end - p))
+		return NULL;
+
+	c->cur = p + sz;
+	c->last = p;
+	SA_BUMP_SIZE(p) = sz;
+	return p;
+}
+
+// The last object of the thread's chunk grows or shrinks in place, others
+// are copied to a new object
+static void *sa_bump_realloc(sarena *sa, void *ptr, size_t sz) {
+	sa_bump_cursor *c;
+	sarena *old;
+	size_t len;
+	void *p;
+
+	c = sa_bump_cursor_get(sa, __atomic_load_n(&sa->bump.gen, __ATOMIC_ACQUIRE));
+	if (ptr != NULL && c != NULL && c->last == ptr && sz <= (size_t) (c->end - (char *) ptr)) {
+		c->cur = (char *) ptr + sz;
+		SA_BUMP_SIZE(ptr) = sz;
+		return ptr;
+	}
+
+	p = sa_bump_alloc(sa, sz, SA_BUMP_ALIGN);
+	if (p == NULL || ptr == NULL)
+		return p;
+
+	old = sa_owner(ptr);
+	if (old != NULL && old->bump.map != NULL)
+		len = SA_BUMP_SIZE(ptr);
+	else
+		len = je_sallocx(ptr, 0);
+
+	memcpy(p, ptr, (len < sz)?len:sz);
+	sicm_free(ptr);
+	return p;
 }
 
 void *sicm_arena_alloc(sicm_arena a, size_t sz) {
 	sarena *sa;
 	int flags;
 
+	sa = a;
+	if (sa != NULL && sa->bump.map != NULL)
+		return sa_bump_alloc(sa, sz, SA_BUMP_ALIGN);
+
 	if (sz == 0) {
 		return je_malloc(0);
 	}
 
-	sa = a;
 	flags = 0;
 	if (sa != NULL) {
-		flags = MALLOCX_ARENA(sa->arena_ind) | MALLOCX_TCACHE_NONE;
+		flags = MALLOCX_ARENA(sa->arena_ind) | sa_tcache_flags(sa);
 	}
 
 	return je_mallocx(sz, flags);
 }
 
+// argument of experimental.batch_alloc
+typedef struct sa_batch_packet {
+	void		**ptrs;
+	size_t		num;
+	size_t		size;
+	int		flags;
+} sa_batch_packet;
+
+size_t sicm_arena_alloc_batch(sicm_arena a, size_t sz, size_t n, void **ptrs) {
+	sa_batch_packet packet;
+	size_t filled, filled_sz;
+	sarena *sa;
+	int flags;
+
+	sa = a;
+	if (sa != NULL && sa->bump.map != NULL) {
+		for(filled = 0; filled < n; filled++) {
+			ptrs[filled] = sa_bump_alloc(sa, sz, SA_BUMP_ALIGN);
+			if (ptrs[filled] == NULL)
+				break;
+		}
+
+		return filled;
+	}
+
+	flags = 0;
+	if (sa != NULL)
+		flags = MALLOCX_ARENA(sa->arena_ind) | sa_tcache_flags(sa);
+
+	// jemalloc fills the batch from one slab at a time, so the objects
+	// come out next to each other with one trip through the allocator
+	filled = 0;
+	if (sz > 0 && sa_batch_miblen > 0) {
+		packet.ptrs = ptrs;
+		packet.num = n;
+		packet.size = sz;
+		packet.flags = flags;
+		filled_sz = sizeof(filled);
+		if (je_mallctlbymib(sa_batch_mib, sa_batch_miblen, &filled, &filled_sz, &packet, sizeof(packet)) != 0)
+			filled = 0;
+	}
+
+	for(; filled < n; filled++) {
+		ptrs[filled] = (sz == 0)?je_malloc(0):je_mallocx(sz, flags);
+		if (ptrs[filled] == NULL)
+			break;
+	}
+
+	return filled;
+}
+
 void *sicm_arena_alloc_aligned(sicm_arena a, size_t sz, size_t align) {
 	sarena *sa;
 	int flags;
 
 	sa = a;
+	if (sa != NULL && sa->bump.map != NULL)
+		return sa_bump_alloc(sa, sz, align);
+
 	flags = 0;
 	if (sa != NULL)
-		flags = MALLOCX_ARENA(sa->arena_ind) | MALLOCX_TCACHE_NONE | MALLOCX_ALIGN(align);
+		flags = MALLOCX_ARENA(sa->arena_ind) | sa_tcache_flags(sa) | MALLOCX_ALIGN(align);
 
 	return je_mallocx(sz, flags);
 }
 
+// Copy an object of a bump arena into another arena. jemalloc doesn't own
+// the old object, which stays until its arena is reset.
+static void *sa_bump_move(sarena *sa, void *ptr, size_t sz) {
+	size_t len;
+	void *p;
+
+	p = sicm_arena_alloc(sa, sz);
+	if (p == NULL)
+		return NULL;
+
+	len = SA_BUMP_SIZE(ptr);
+	memcpy(p, ptr, (len < sz)?len:sz);
+	return p;
+}
+
 void *sicm_arena_realloc(sicm_arena a, void *ptr, size_t sz) {
-	sarena *sa;
+	sarena *sa, *old;
 	int flags;
 
 	if (sz == 0) {
@@ -376,9 +2020,16 @@ void *sicm_arena_realloc(sicm_arena a, void *ptr, size_t sz) {
 	}
 
 	sa = a;
+	if (sa != NULL && sa->bump.map != NULL)
+		return sa_bump_realloc(sa, ptr, sz);
+
+	old = (ptr != NULL)?sa_owner(ptr):NULL;
+	if (old != NULL && old->bump.map != NULL)
+		return sa_bump_move(sa, ptr, sz);
+
 	flags = 0;
 	if (sa != NULL)
-		flags = MALLOCX_ARENA(sa->arena_ind) | MALLOCX_TCACHE_NONE;
+		flags = MALLOCX_ARENA(sa->arena_ind) | sa_tcache_flags(sa);
 
 	return je_rallocx(ptr, sz, flags);
 }
@@ -409,15 +2060,147 @@ void *sicm_alloc_aligned(size_t sz, size_t align) {
 	return ret;
 }
 
+// The arena of an object, NULL if it isn't from one of our arenas. Objects
+// from our arenas have to go back through the arena's tcache (or none), not
+// the thread's automatic one. Granules that were never part of our extents
+// can't contain such objects.
+static sarena *sa_owner(void *ptr) {
+	sarena *sa;
+
+	sa = sa_map_lookup(ptr);
+	if (sa == SA_MAP_MIXED)
+		sa = sarena_ptr2sarena(ptr);
+
+	return sa;
+}
+
+void sicm_free_sized(void *ptr, size_t sz) {
+	sarena *sa;
+
+	if (ptr == NULL)
+		return;
+
+	// objects of bump arenas are only freed by sicm_arena_reset
+	sa = sa_owner(ptr);
+	if (sa != NULL && sa->bump.map != NULL)
+		return;
+
+	je_sdallocx(ptr, sz, (sa != NULL)?sa_tcache_flags(sa):0);
+}
+
+void sicm_arena_free_sized(sicm_arena a, void *ptr, size_t sz) {
+	sarena *sa;
+
+	// the caller knows the arena, so there is nothing to look up
+	sa = a;
+	if (ptr != NULL && (sa == NULL || sa->bump.map == NULL))
+		je_sdallocx(ptr, sz, (sa != NULL)?sa_tcache_flags(sa):0);
+}
+
+// Free a batch of objects, size is 0 if it isn't known. Objects of a batch
+// usually come from the same granules and arenas, so the arena and its
+// tcache flags are only looked up again when the granule changes.
+static void sa_free_batch(void **ptrs, size_t n, size_t size) {
+	uintptr_t granule, g;
+	sarena *sa, *last;
+	size_t i;
+	int flags;
+
+	granule = UINTPTR_MAX;
+	sa = NULL;
+	last = NULL;
+	flags = 0;
+	for(i = 0; i < n; i++) {
+		if (ptrs[i] == NULL)
+			continue;
+
+		g = (uintptr_t) ptrs[i] >> SA_MAP_GRANULE_SHIFT;
+		if (g != granule) {
+			sa = sa_map_lookup(ptrs[i]);
+			granule = g;
+			if (sa == SA_MAP_MIXED) {
+				// other objects in the granule can belong to other arenas
+				sa = sarena_ptr2sarena(ptrs[i]);
+				granule = UINTPTR_MAX;
+			}
+
+			if (sa != last) {
+				flags = (sa != NULL)?sa_tcache_flags(sa):0;
+				last = sa;
+			}
+		}
+
+		if (sa != NULL && sa->bump.map != NULL)
+			continue;
+		else if (size > 0)
+			je_sdallocx(ptrs[i], size, flags);
+		else if (sa != NULL)
+			je_dallocx(ptrs[i], flags);
+		else
+			je_free(ptrs[i]);
+	}
+}
+
+void sicm_free_batch(void **ptrs, size_t n) {
+	sa_free_batch(ptrs, n, 0);
+}
+
+void sicm_free_batch_sized(void **ptrs, size_t n, size_t size) {
+	sa_free_batch(ptrs, n, size);
+}
+
 void sicm_free(void *ptr) {
-	je_free(ptr);
+	sarena *sa;
+
+	if (ptr == NULL)
+		return;
+
+	sa = sa_owner(ptr);
+	if (sa != NULL && sa->bump.map != NULL)
+		return;
+	else if (sa != NULL)
+		je_dallocx(ptr, sa_tcache_flags(sa));
+	else
+		je_free(ptr);
 }
 
 void *sicm_realloc(void *ptr, size_t sz) {
-	// TODO: should we include MALLOCX_ARENA(...)???
+	sarena *sa;
+
+	if (ptr == NULL)
+		return sicm_alloc(sz);
+
+	if (sz == 0) {
+		sicm_free(ptr);
+		return NULL;
+	}
+
+	// without MALLOCX_ARENA, jemalloc moves objects that don't fit anymore to the thread's arena
+	sa = sa_owner(ptr);
+	if (sa != NULL && sa->bump.map != NULL)
+		return sa_bump_realloc(sa, ptr, sz);
+	else if (sa != NULL)
+		return je_rallocx(ptr, sz, MALLOCX_ARENA(sa->arena_ind) | sa_tcache_flags(sa));
+
 	return je_rallocx(ptr, sz, MALLOCX_TCACHE_NONE);
 }
 
+size_t sicm_arena_realloc_in_place(sicm_arena a, void *ptr, size_t sz) {
+	sarena *sa;
+
+	// an object that doesn't move can't leave its arena
+	if (ptr == NULL || sz == 0)
+		return 0;
+
+	// the caller knows the arena, like with sicm_arena_free_sized; the
+	// sizes of objects of bump arenas aren't known
+	sa = a;
+	if (sa != NULL && sa->bump.map != NULL)
+		return 0;
+
+	return je_xallocx(ptr, sz, 0, 0);
+}
+
 void sicm_arena_set_default(sicm_arena sa) {
 	pthread_setspecific(sa_default_key, sa);
 }
@@ -435,7 +2218,13 @@ sarena *sarena_ptr2sarena(void *ptr) {
 	size_t ai_sz;
 	sarena *sa;
 
+	// pointers inside extents we allocated don't need to go through jemalloc
+	sa = sa_map_lookup(ptr);
+	if (sa != NULL && sa != SA_MAP_MIXED)
+		goto out;
+
 	sa = NULL;
+	pthread_once(&sa_init, sarena_init);
 	ai_sz = sizeof(unsigned);
 	err = je_mallctlbymib(sa_lookup_mib, 2, &arena_ind, &ai_sz, &ptr, sizeof(ptr));
 	if (err != 0) {
@@ -443,13 +2232,8 @@ sarena *sarena_ptr2sarena(void *ptr) {
 		goto out;
 	}
 
-	// TODO: make this lookup faster if this becomes bottleneck
-	pthread_mutex_lock(&sa_mutex);
-	for(sa = sa_list; sa != NULL; sa = sa->next) {
-		if (sa->arena_ind == arena_ind)
-			break;
-	}
-	pthread_mutex_unlock(&sa_mutex);
+	if (arena_ind < SICM_MAX_ARENAS)
+		sa = __atomic_load_n(&sa_table[arena_ind], __ATOMIC_ACQUIRE);
 
 out:
 	return sa;
@@ -0,0 +1,720 @@
+#include "sicm_low.h"
+
+#include <errno.h>
+#include <numa.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/mman.h>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+#include "sicm_bench.h"
+
+// every slice of the bandwidth kernels is a multiple of this many bytes,
+// two of the widest vectors
+#define SB_VEC 128
+// timed passes of sicm_bandwidth
+#define SB_PASSES 3
+
+static void *volatile sb_sink;
+static volatile double sb_sum;
+
+static double sb_ns(struct timespec *start, struct timespec *end) {
+	return (end->tv_sec - start->tv_sec) * 1e9 + (end->tv_nsec - start->tv_nsec);
+}
+
+static uint64_t sb_rand(uint64_t *state) {
+	// xorshift64
+	*state ^= *state << 13;
+	*state ^= *state >> 7;
+	*state ^= *state << 17;
+	return *state;
+}
+
+// The bandwidth kernels, stamped out for each instruction set. n is a
+// multiple of SB_VEC / sizeof(double), and the arrays are aligned to it.
+// With nt, the stores skip the caches and are fenced before returning.
+#define SB_KERNELS(isa, attr, vec, width, load, store, stream, add, mul, set1, zero, fence) \
+attr static double sb_read_##isa(const double *a, size_t n) { \
+	double t[width] __attribute__((aligned(64))); \
+	vec s0, s1; \
+	double sum; \
+	size_t i; \
+	int j; \
+\
+	s0 = zero(); \
+	s1 = zero(); \
+	for(i = 0; i < n; i += 2 * width) { \
+		s0 = add(s0, load(a + i)); \
+		s1 = add(s1, load(a + i + width)); \
+	} \
+	store(t, add(s0, s1)); \
+	sum = 0; \
+	for(j = 0; j < width; j++) \
+		sum += t[j]; \
+	return sum; \
+} \
+\
+attr static void sb_write_##isa(double *a, size_t n, double v, int nt) { \
+	vec x; \
+	size_t i; \
+\
+	x = set1(v); \
+	if (nt) { \
+		for(i = 0; i < n; i += width) \
+			stream(a + i, x); \
+		fence(); \
+	} else { \
+		for(i = 0; i < n; i += width) \
+			store(a + i, x); \
+	} \
+} \
+\
+attr static void sb_copy_##isa(double *a, const double *b, size_t n, int nt) { \
+	size_t i; \
+\
+	if (nt) { \
+		for(i = 0; i < n; i += width) \
+			stream(a + i, load(b + i)); \
+		fence(); \
+	} else { \
+		for(i = 0; i < n; i += width) \
+			store(a + i, load(b + i)); \
+	} \
+} \
+\
+attr static void sb_triad_##isa(double *a, const double *b, const double *c, size_t n, double s, int nt) { \
+	vec x; \
+	size_t i; \
+\
+	x = set1(s); \
+	if (nt) { \
+		for(i = 0; i < n; i += width) \
+			stream(a + i, add(load(b + i), mul(x, load(c + i)))); \
+		fence(); \
+	} else { \
+		for(i = 0; i < n; i += width) \
+			store(a + i, add(load(b + i), mul(x, load(c + i)))); \
+	} \
+}
+
+typedef struct sb_kernels {
+	const char*	name;
+	const char*	feature;	// for __builtin_cpu_supports, NULL if always there
+	double		(*read)(const double *a, size_t n);
+	void		(*write)(double *a, size_t n, double v, int nt);
+	void		(*copy)(double *a, const double *b, size_t n, int nt);
+	void		(*triad)(double *a, const double *b, const double *c, size_t n, double s, int nt);
+} sb_kernels;
+
+#define SB_ISA(isa, feature) { #isa, feature, sb_read_##isa, sb_write_##isa, sb_copy_##isa, sb_triad_##isa }
+
+#if defined(__x86_64__)
+#define SB_TARGET(isa) __attribute__((target(isa)))
+
+SB_KERNELS(avx512, SB_TARGET("avx512f"), __m512d, 8, _mm512_load_pd, _mm512_store_pd, _mm512_stream_pd,
+	_mm512_add_pd, _mm512_mul_pd, _mm512_set1_pd, _mm512_setzero_pd, _mm_sfence)
+SB_KERNELS(avx2, SB_TARGET("avx2"), __m256d, 4, _mm256_load_pd, _mm256_store_pd, _mm256_stream_pd,
+	_mm256_add_pd, _mm256_mul_pd, _mm256_set1_pd, _mm256_setzero_pd, _mm_sfence)
+// every x86-64 CPU has SSE2
+SB_KERNELS(sse2, , __m128d, 2, _mm_load_pd, _mm_store_pd, _mm_stream_pd,
+	_mm_add_pd, _mm_mul_pd, _mm_set1_pd, _mm_setzero_pd, _mm_sfence)
+
+// widest first
+static const sb_kernels sb_isas[] = {
+	SB_ISA(avx512, "avx512f"),
+	SB_ISA(avx2, "avx2"),
+	SB_ISA(sse2, NULL),
+};
+#else
+static inline double sb_load(const double *p) { return *p; }
+static inline void sb_store(double *p, double x) { *p = x; }
+static inline double sb_add(double x, double y) { return x + y; }
+static inline double sb_mul(double x, double y) { return x * y; }
+static inline double sb_set1(double x) { return x; }
+static inline double sb_zero(void) { return 0; }
+static inline void sb_fence(void) { __atomic_thread_fence(__ATOMIC_SEQ_CST); }
+
+// left for the compiler to vectorize, and without non-temporal stores
+SB_KERNELS(scalar, , double, 1, sb_load, sb_store, sb_store,
+	sb_add, sb_mul, sb_set1, sb_zero, sb_fence)
+
+static const sb_kernels sb_isas[] = {
+	SB_ISA(scalar, NULL),
+};
+#endif
+
+static const sb_kernels *sb_isa;
+static pthread_once_t sb_isa_once = PTHREAD_ONCE_INIT;
+
+static int sb_isa_supported(const sb_kernels *k) {
+#if defined(__x86_64__)
+	if (k->feature != NULL) {
+		__builtin_cpu_init();
+		// __builtin_cpu_supports only takes string literals
+		if (strcmp(k->feature, "avx512f") == 0)
+			return __builtin_cpu_supports("avx512f");
+		if (strcmp(k->feature, "avx2") == 0)
+			return __builtin_cpu_supports("avx2");
+		return 0;
+	}
+#endif
+	return 1;
+}
+
+// The widest kernels that the CPU runs, or SICM_BANDWIDTH_ISA's.
+static void sb_isa_pick(void) {
+	const char *env;
+	size_t i;
+
+	env = getenv("SICM_BANDWIDTH_ISA");
+	for(i = 0; env != NULL && i < sizeof(sb_isas) / sizeof(sb_isas[0]); i++) {
+		if (strcmp(env, sb_isas[i].name) == 0 && sb_isa_supported(&sb_isas[i])) {
+			sb_isa = &sb_isas[i];
+			return;
+		}
+	}
+
+	for(i = 0; i < sizeof(sb_isas) / sizeof(sb_isas[0]); i++) {
+		if (sb_isa_supported(&sb_isas[i])) {
+			sb_isa = &sb_isas[i];
+			return;
+		}
+	}
+}
+
+static const sb_kernels *sb_kernels_get(void) {
+	pthread_once(&sb_isa_once, sb_isa_pick);
+	return sb_isa;
+}
+
+const char *sicm_bandwidth_isa(void) {
+	return sb_kernels_get()->name;
+}
+
+// Parts of a slice that op works over: a copy reads one half into the
+// other, a triad reads two thirds into the last one.
+static int sb_parts(sicm_bandwidth_op op) {
+	switch(op) {
+		case SICM_BW_COPY:
+			return 2;
+		case SICM_BW_TRIAD:
+			return 3;
+		default:
+			return 1;
+	}
+}
+
+int sb_node_cpus(int node) {
+	struct bitmask *cpus;
+	int n;
+
+	cpus = numa_allocate_cpumask();
+	if (numa_node_to_cpus(node, cpus) != 0) {
+		numa_free_cpumask(cpus);
+		return 0;
+	}
+	n = numa_bitmask_weight(cpus);
+	numa_free_cpumask(cpus);
+
+	return n;
+}
+
+// CPUs of node, starting after the calling thread's so that it gets a
+// worker last. Returns how many there are, and the list in *list.
+static int sb_cpu_list(int node, int **list) {
+	struct bitmask *cpus;
+	int *found, n, i, self, first;
+
+	*list = NULL;
+	cpus = numa_allocate_cpumask();
+	if (numa_node_to_cpus(node, cpus) != 0) {
+		numa_free_cpumask(cpus);
+		return 0;
+	}
+
+	n = numa_bitmask_weight(cpus);
+	found = malloc(n * sizeof(int));
+	*list = malloc(n * sizeof(int));
+	if (found == NULL || *list == NULL) {
+		free(found);
+		free(*list);
+		*list = NULL;
+		numa_free_cpumask(cpus);
+		return 0;
+	}
+
+	self = sched_getcpu();
+	first = 0;
+	n = 0;
+	for(i = 0; i < (int) cpus->size; i++) {
+		if (!numa_bitmask_isbitset(cpus, i))
+			continue;
+		if (i == self)
+			first = n + 1;
+		found[n++] = i;
+	}
+	numa_free_cpumask(cpus);
+
+	for(i = 0; i < n; i++)
+		(*list)[i] = found[(first + i) % n];
+	free(found);
+
+	return n;
+}
+
+void **sb_chase_init(char *buf, size_t size, unsigned int seed) {
+	size_t *order, lines, i, j, tmp;
+	uint64_t state;
+
+	lines = size / SB_LINE;
+	if (lines == 0)
+		return NULL;
+
+	order = malloc(lines * sizeof(size_t));
+	if (order == NULL)
+		return NULL;
+
+	// a random permutation of the lines, visited in that order, is one
+	// cycle through all of them
+	state = seed | 1;
+	for(i = 0; i < lines; i++)
+		order[i] = i;
+	for(i = lines - 1; i > 0; i--) {
+		j = sb_rand(&state) % (i + 1);
+		tmp = order[i];
+		order[i] = order[j];
+		order[j] = tmp;
+	}
+
+	for(i = 0; i < lines; i++)
+		*(void **) (buf + order[i] * SB_LINE) = buf + order[(i + 1) % lines] * SB_LINE;
+
+	buf += order[0] * SB_LINE;
+	free(order);
+
+	return (void **) buf;
+}
+
+double sb_chase(void ***pos, size_t count) {
+	struct timespec start, end;
+	void **p;
+	size_t i;
+
+	p = *pos;
+	clock_gettime(CLOCK_MONOTONIC_RAW, &start);
+	for(i = 0; i < count; i++)
+		p = *p;
+	clock_gettime(CLOCK_MONOTONIC_RAW, &end);
+	sb_sink = p;
+	*pos = p;
+
+	return sb_ns(&start, &end) / count;
+}
+
+static int sb_compare(const void *lhs, const void *rhs) {
+	double l, r;
+
+	l = *(const double *) lhs;
+	r = *(const double *) rhs;
+	return (l > r) - (l < r);
+}
+
+int sb_latency(char *buf, size_t size, void ***pos, size_t count, int threads, int node, sicm_latency_stats *stats) {
+	sb_load *load;
+	double *ns, total;
+	size_t batches, i;
+
+	batches = (count + SB_BATCH - 1) / SB_BATCH;
+	ns = malloc(batches * sizeof(double));
+	if (ns == NULL)
+		return -ENOMEM;
+
+	memset(stats, 0, sizeof(sicm_latency_stats));
+	load = NULL;
+	if (threads > 0) {
+		load = sb_load_start(buf + size / 2, size / 2, node, threads);
+		if (load == NULL) {
+			free(ns);
+			return -ENOMEM;
+		}
+	}
+
+	// each batch is short enough that the clock is read often, and long
+	// enough that reading it doesn't count
+	total = 0;
+	for(i = 0; i < batches; i++) {
+		ns[i] = sb_chase(pos, SB_BATCH);
+		total += ns[i];
+	}
+
+	if (load != NULL)
+		stats->load_bandwidth = sb_load_stop(load);
+
+	qsort(ns, batches, sizeof(double), sb_compare);
+	stats->mean = total / batches;
+	stats->min = ns[0];
+	stats->p50 = ns[batches / 2];
+	stats->p90 = ns[batches * 9 / 10];
+	stats->p99 = ns[batches * 99 / 100];
+	stats->max = ns[batches - 1];
+	free(ns);
+
+	return 0;
+}
+
+// Devices backed by the memory of a NUMA node.
+static int sb_measurable(sicm_device *device) {
+	if (device == NULL)
+		return 0;
+
+	switch(device->tag) {
+		case SICM_DRAM:
+		case SICM_KNL_HBM:
+		case SICM_OPTANE:
+		case SICM_POWERPC_HBM:
+			return 1;
+		default:
+			return 0;
+	}
+}
+
+// The variant of a device with the biggest pages that still has room, so
+// that TLB misses don't count as latency.
+static sicm_device *sb_huge_variant(sicm_device_list *devs, sicm_device *device, size_t size) {
+	sicm_device *best, *d;
+	size_t avail;
+	unsigned int i;
+
+	best = device;
+	for(i = 0; i < devs->count; i++) {
+		d = devs->devices[i];
+		if (d->tag != device->tag || d->node != device->node || d->page_size <= best->page_size)
+			continue;
+		avail = sicm_avail(d);
+		if (avail == (size_t) -1 || avail * 1024 < size)
+			continue;
+		best = d;
+	}
+
+	return best;
+}
+
+static int sb_latency_run(sicm_device *device, size_t size, size_t accesses, int first, int last, sicm_latency_stats *res) {
+	sicm_device_list devs;
+	sicm_device *variant;
+	void **pos;
+	char *buf;
+	size_t pgsz;
+	int node, n, err;
+
+	if (!sb_measurable(device) || res == NULL || size < 2 * SB_LINE || accesses == 0 || first < 0 || last < first)
+		return -EINVAL;
+
+	devs = sicm_init();
+	variant = sb_huge_variant(&devs, device, size);
+	pgsz = (size_t) variant->page_size * 1024;
+	size = (size + pgsz - 1) / pgsz * pgsz;
+
+	buf = sicm_device_alloc(variant, size);
+	if (buf == NULL || buf == MAP_FAILED) {
+		sicm_fini();
+		return -ENOMEM;
+	}
+
+	err = -ENOMEM;
+	pos = sb_chase_init(buf, size / 2, (unsigned int) time(NULL));
+	if (pos != NULL) {
+		// once around, for the caches that hold the page tables
+		sb_chase(&pos, size / 2 / SB_LINE);
+
+		node = numa_node_of_cpu(sched_getcpu());
+		for(n = first; n <= last; n++) {
+			err = sb_latency(buf, size, &pos, accesses, n, node, &res[n - first]);
+			if (err != 0)
+				break;
+			res[n - first].page_size = variant->page_size;
+		}
+	}
+
+	sicm_device_free(variant, buf, size);
+	sicm_fini();
+
+	return err;
+}
+
+int sicm_latency_chase(sicm_device *device, size_t size, size_t accesses, int load_threads, sicm_latency_stats *res) {
+	return sb_latency_run(device, size, accesses, load_threads, load_threads, res);
+}
+
+int sicm_latency_curve(sicm_device *device, size_t size, size_t accesses, int max_threads, sicm_latency_stats *res) {
+	return sb_latency_run(device, size, accesses, 0, max_threads, res);
+}
+
+typedef struct sb_worker {
+	char*			buf;
+	size_t			size;
+	sicm_bandwidth_op	op;
+	int			flags;
+	int			cpu;		// -1 for any CPU of node
+	int			node;
+	int			passes;
+	int*			stop;		// for loads, NULL to do passes and return
+	int*			ready;		// counts the workers that are warmed up
+	int*			go;		// set once they all are
+	const sb_kernels*	kernels;
+	struct timespec		start, end;
+	pthread_t		thread;
+} sb_worker;
+
+static void sb_pass(sb_worker *w, int pass) {
+	double *a;
+	size_t n;
+	int nt;
+
+	a = (double *) w->buf;
+	n = w->size / sb_parts(w->op) / sizeof(double);
+	nt = w->flags & SICM_BW_NONTEMPORAL;
+
+	switch(w->op) {
+		case SICM_BW_READ:
+			sb_sum = w->kernels->read(a, n);
+			break;
+		case SICM_BW_WRITE:
+			w->kernels->write(a, n, pass, nt);
+			break;
+		case SICM_BW_COPY:
+			w->kernels->copy(a + n, a, n, nt);
+			break;
+		case SICM_BW_TRIAD:
+			w->kernels->triad(a + 2 * n, a, a + n, n, 3.0, nt);
+			break;
+	}
+}
+
+static void *sb_work(void *arg) {
+	sb_worker *w;
+	cpu_set_t set;
+	int i;
+
+	w = arg;
+	if (w->cpu >= 0) {
+		CPU_ZERO(&set);
+		CPU_SET(w->cpu, &set);
+		pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+	} else {
+		numa_run_on_node(w->node);
+	}
+
+	// every worker first touches its own slice, so that it's backed by
+	// pages and not by the zero page, then runs once untimed
+	memset(w->buf, 1, w->size);
+	sb_pass(w, 0);
+	__atomic_add_fetch(w->ready, 1, __ATOMIC_RELEASE);
+	while (!__atomic_load_n(w->go, __ATOMIC_ACQUIRE));
+
+	clock_gettime(CLOCK_MONOTONIC_RAW, &w->start);
+	if (w->stop != NULL) {
+		// passes counts the ones that finished before stop
+		while (!__atomic_load_n(w->stop, __ATOMIC_RELAXED)) {
+			sb_pass(w, 1);
+			if (!__atomic_load_n(w->stop, __ATOMIC_RELAXED))
+				w->passes++;
+		}
+	} else {
+		for(i = 0; i < w->passes; i++)
+			sb_pass(w, i + 1);
+	}
+	clock_gettime(CLOCK_MONOTONIC_RAW, &w->end);
+
+	return NULL;
+}
+
+// Splits buf between the workers, in slices of whole SB_VEC parts, pins
+// them to the CPUs of node in turn, and lets them go together once
+// they're all warmed up. Returns how many were started.
+static int sb_start(sb_worker *w, int threads, char *buf, size_t size, sicm_bandwidth_op op, int flags, int node, int passes, int *stop, int *ready, int *go) {
+	const sb_kernels *kernels;
+	size_t chunk, unit;
+	int *cpus, ncpus, i, started;
+
+	unit = (size_t) SB_VEC * sb_parts(op);
+	chunk = size / threads / unit * unit;
+	if (chunk == 0)
+		return 0;
+
+	kernels = sb_kernels_get();
+	ncpus = sb_cpu_list(node, &cpus);
+
+	for(i = 0; i < threads; i++) {
+		w[i].buf = buf + i * chunk;
+		w[i].size = chunk;
+		w[i].op = op;
+		w[i].flags = flags;
+		w[i].cpu = ncpus > 0 ? cpus[i % ncpus] : -1;
+		w[i].node = node;
+		w[i].passes = passes;
+		w[i].stop = stop;
+		w[i].ready = ready;
+		w[i].go = go;
+		w[i].kernels = kernels;
+		if (pthread_create(&w[i].thread, NULL, sb_work, &w[i]) != 0)
+			break;
+	}
+	started = i;
+	free(cpus);
+
+	while (__atomic_load_n(ready, __ATOMIC_ACQUIRE) < started);
+	__atomic_store_n(go, 1, __ATOMIC_RELEASE);
+
+	return started;
+}
+
+double sb_stream(char *buf, size_t size, sicm_bandwidth_op op, int flags, int node, int threads, int passes) {
+	struct timespec *first, *last;
+	sb_worker *w;
+	double bytes;
+	int i, started, ready, go;
+
+	if (threads < 1 || passes < 1)
+		return 0;
+
+	w = calloc(threads, sizeof(sb_worker));
+	if (w == NULL)
+		return 0;
+
+	ready = 0;
+	go = 0;
+	started = sb_start(w, threads, buf, size, op, flags, node, passes, NULL, &ready, &go);
+	for(i = 0; i < started; i++)
+		pthread_join(w[i].thread, NULL);
+	if (started < threads) {
+		free(w);
+		return 0;
+	}
+
+	// from the first thread that started to the last one that finished
+	first = &w[0].start;
+	last = &w[0].end;
+	for(i = 1; i < threads; i++) {
+		if (sb_ns(&w[i].start, first) > 0)
+			first = &w[i].start;
+		if (sb_ns(last, &w[i].end) > 0)
+			last = &w[i].end;
+	}
+
+	bytes = (double) w[0].size * threads * passes;
+	bytes /= sb_ns(first, last);
+	free(w);
+
+	return bytes;
+}
+
+struct sb_load {
+	int		stop;
+	int		ready;
+	int		go;
+	int		threads;
+	struct timespec	start;
+	sb_worker	w[];
+};
+
+sb_load *sb_load_start(char *buf, size_t size, int node, int threads) {
+	sb_load *load;
+
+	if (threads < 1)
+		return NULL;
+
+	load = calloc(1, sizeof(sb_load) + threads * sizeof(sb_worker));
+	if (load == NULL)
+		return NULL;
+
+	load->threads = sb_start(load->w, threads, buf, size, SICM_BW_READ, 0, node, 0, &load->stop, &load->ready, &load->go);
+	if (load->threads == 0) {
+		free(load);
+		return NULL;
+	}
+	clock_gettime(CLOCK_MONOTONIC_RAW, &load->start);
+
+	return load;
+}
+
+double sb_load_stop(sb_load *load) {
+	struct timespec end;
+	double bytes;
+	int i;
+
+	if (load == NULL)
+		return 0;
+
+	__atomic_store_n(&load->stop, 1, __ATOMIC_RELAXED);
+	clock_gettime(CLOCK_MONOTONIC_RAW, &end);
+
+	// passes that were cut short by stop don't count
+	bytes = 0;
+	for(i = 0; i < load->threads; i++) {
+		pthread_join(load->w[i].thread, NULL);
+		bytes += (double) load->w[i].size * load->w[i].passes;
+	}
+	bytes /= sb_ns(&load->start, &end);
+	free(load);
+
+	return bytes;
+}
+
+int sicm_bandwidth(sicm_device *device, int node, sicm_bandwidth_op op, int flags, size_t size, int threads, double *gbps) {
+	char *buf;
+	size_t pgsz;
+	int cpus;
+
+	if (!sb_measurable(device) || gbps == NULL || op < SICM_BW_READ || op > SICM_BW_TRIAD || node < 0 || node > numa_max_node())
+		return -EINVAL;
+
+	*gbps = 0;
+	cpus = sb_node_cpus(node);
+	if (cpus == 0)
+		return -EINVAL;
+	if (threads <= 0)
+		threads = cpus;
+	if (size / threads < (size_t) SB_VEC * sb_parts(op))
+		return -EINVAL;
+
+	pgsz = (size_t) device->page_size * 1024;
+	size = (size + pgsz - 1) / pgsz * pgsz;
+	buf = sicm_device_alloc(device, size);
+	if (buf == NULL || buf == MAP_FAILED)
+		return -ENOMEM;
+
+	*gbps = sb_stream(buf, size, op, flags, node, threads, SB_PASSES);
+	sicm_device_free(device, buf, size);
+
+	return *gbps > 0 ? 0 : -EAGAIN;
+}
+
+int sicm_bandwidth_matrix(sicm_bandwidth_op op, int flags, size_t size, double *matrix) {
+	sicm_device_list devs;
+	unsigned int i;
+	int node, nodes;
+
+	if (matrix == NULL)
+		return -EINVAL;
+
+	devs = sicm_init();
+	nodes = numa_max_node() + 1;
+	for(node = 0; node < nodes; node++) {
+		for(i = 0; i < devs.count; i++) {
+			matrix[node * devs.count + i] = 0;
+			if (sb_measurable(devs.devices[i]) && sb_node_cpus(node) > 0)
+				sicm_bandwidth(devs.devices[i], node, op, flags, size, 0, &matrix[node * devs.count + i]);
+		}
+	}
+	sicm_fini();
+
+	return 0;
+}
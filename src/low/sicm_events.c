@@ -0,0 +1,157 @@
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "sicm_low.h"
+#include "sicm_impl.h"
+
+// Bounded multi-producer queue: every slot has a sequence number that says
+// whose turn it is. A producer owns a slot once it moves tail past it, and
+// hands it over by setting seq to pos + 1. The consumer gives it back for
+// the next round by setting seq to pos + capacity.
+typedef struct se_slot {
+	size_t			seq;
+	sicm_extent_event	ev;
+} se_slot;
+
+struct sicm_event_ring {
+	size_t			mask;
+	size_t			head;		// only touched by the consumer
+	char			pad1[64];
+	size_t			tail;
+	char			pad2[64];
+	size_t			dropped;
+	se_slot*		slots;
+};
+
+sicm_event_ring *sicm_event_ring_create(size_t capacity) {
+	sicm_event_ring *ring;
+	size_t n, i;
+
+	for(n = 1; n < capacity; n <<= 1);
+
+	ring = calloc(1, sizeof(sicm_event_ring));
+	if (ring == NULL)
+		return NULL;
+
+	ring->slots = malloc(n * sizeof(se_slot));
+	if (ring->slots == NULL) {
+		free(ring);
+		return NULL;
+	}
+
+	for(i = 0; i < n; i++)
+		ring->slots[i].seq = i;
+	ring->mask = n - 1;
+
+	return ring;
+}
+
+void sicm_event_ring_free(sicm_event_ring *ring) {
+	if (ring == NULL)
+		return;
+
+	free(ring->slots);
+	free(ring);
+}
+
+// never waits, an event that doesn't fit is dropped
+static void se_ring_push(sicm_event_ring *ring, const sicm_extent_event *ev) {
+	se_slot *slot;
+	size_t pos, seq;
+
+	pos = __atomic_load_n(&ring->tail, __ATOMIC_RELAXED);
+	for(;;) {
+		slot = &ring->slots[pos & ring->mask];
+		seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+		if (seq == pos) {
+			if (__atomic_compare_exchange_n(&ring->tail, &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+				break;
+		} else if ((intptr_t) (seq - pos) < 0) {
+			// the consumer hasn't taken the event from the last round yet
+			__atomic_add_fetch(&ring->dropped, 1, __ATOMIC_RELAXED);
+			return;
+		} else {
+			pos = __atomic_load_n(&ring->tail, __ATOMIC_RELAXED);
+		}
+	}
+
+	slot->ev = *ev;
+	__atomic_store_n(&slot->seq, pos + 1, __ATOMIC_RELEASE);
+}
+
+size_t sicm_event_ring_read(sicm_event_ring *ring, sicm_extent_event *events, size_t max) {
+	se_slot *slot;
+	size_t n;
+
+	if (ring == NULL || events == NULL)
+		return 0;
+
+	for(n = 0; n < max; n++) {
+		slot = &ring->slots[ring->head & ring->mask];
+		if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != ring->head + 1)
+			break;
+
+		events[n] = slot->ev;
+		__atomic_store_n(&slot->seq, ring->head + ring->mask + 1, __ATOMIC_RELEASE);
+		ring->head++;
+	}
+
+	return n;
+}
+
+size_t sicm_event_ring_dropped(sicm_event_ring *ring) {
+	if (ring == NULL)
+		return 0;
+
+	return __atomic_load_n(&ring->dropped, __ATOMIC_RELAXED);
+}
+
+void sarena_event_send(sarena *sa, sicm_extent_event_type type, void *start, void *mid, void *end) {
+	sicm_extent_event ev;
+
+	ev.type = type;
+	ev.arena = sa;
+	ev.cookie = sa->cookie;
+	ev.start = start;
+	ev.mid = mid;
+	ev.end = end;
+
+	if (sa->events_fn != NULL)
+		sa->events_fn(&ev);
+
+	if (sa->events_ring != NULL)
+		se_ring_push(sa->events_ring, &ev);
+}
+
+int sicm_arena_set_events(sicm_arena a, sicm_extent_event_fn fn, sicm_event_ring *ring, void *cookie) {
+	sarena *sa;
+
+	sa = a;
+	if (sa == NULL)
+		return -EINVAL;
+
+	pthread_mutex_lock(sa->mutex);
+	sa->events_fn = fn;
+	sa->events_ring = ring;
+	sa->cookie = cookie;
+	pthread_mutex_unlock(sa->mutex);
+
+	return 0;
+}
+
+void *sicm_arena_get_cookie(sicm_arena a) {
+	sarena *sa;
+	void *cookie;
+
+	sa = a;
+	if (sa == NULL)
+		return NULL;
+
+	pthread_mutex_lock(sa->mutex);
+	cookie = sa->cookie;
+	pthread_mutex_unlock(sa->mutex);
+
+	return cookie;
+}
@@ -3,10 +3,12 @@
 #include <dirent.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
 #include <math.h>
 #include <numa.h>
 #include <numaif.h>
 #include <sched.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -19,6 +21,8 @@
 #endif
 #include "sicm_impl.h"
 #include "detect_devices.h"
+#include "detect_devices/tiers.h"
+#include "sicm_bench.h"
 
 #ifdef HIP
 #include <hip/hip_runtime.h>
@@ -154,6 +158,9 @@ struct sicm_device_list sicm_init() {
 
   sicm_default_device(0);
 
+  /* Measurements from earlier sicm_device_characterize calls */
+  sicm_model_load(&sicm_global_devices);
+
   sicm_init_count++;
 
   pthread_mutex_unlock(&sicm_init_count_mutex);
@@ -168,6 +175,8 @@ sicm_device *sicm_default_device(const unsigned int idx) {
     return sicm_default_device_ptr;
 }
 
+static void snapshot_clear();
+
 /* Frees memory up */
 void sicm_fini() {
   pthread_mutex_lock(&sicm_init_count_mutex);
@@ -177,6 +186,8 @@ void sicm_fini() {
           free(sicm_global_devices.devices);
           free(sicm_global_device_array);
           memset(&sicm_global_devices, 0, sizeof(sicm_global_devices));
+          snapshot_clear();
+          sicm_model_clear();
       }
   }
   pthread_mutex_unlock(&sicm_init_count_mutex);
@@ -230,7 +241,7 @@ void* sicm_device_alloc(struct sicm_device* device, size_t size) {
         nodemask_set_compat(&nodemask, sicm_numa_id(device));
         set_mempolicy(MPOL_BIND, nodemask.n, numa_max_node() + 2);
         void* ptr = mmap(NULL, size, PROT_READ | PROT_WRITE,
-          MAP_PRIVATE | MAP_ANONYMOUS | (shift << MAP_HUGE_SHIFT), -1, 0);
+          MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | (shift << MAP_HUGE_SHIFT), -1, 0);
         if(ptr == MAP_FAILED) {
           printf("huge page allocation error: %s\n", strerror(errno));
         }
@@ -386,7 +397,7 @@ void sicm_device_free(struct sicm_device* device, void* ptr, size_t size) {
         // Huge page allocation occurs in whole page chunks, so we need
         // to free (unmap) in whole page chunks.
         int page_size = sicm_device_page_size(device);
-        munmap(ptr, sicm_div_ceil(size, page_size * 1024) * 1024);
+        munmap(ptr, sicm_div_ceil(size, page_size * 1024) * page_size * 1024);
       }
       break;
     case SICM_HIP:
@@ -458,7 +469,23 @@ int sicm_move(struct sicm_device* src, struct sicm_device* dst, void* ptr, size_
       nodemask_t nodemask;
       nodemask_zero(&nodemask);
       nodemask_set_compat(&nodemask, dst_node);
-      return mbind(ptr, size, MPOL_BIND, nodemask.n, numa_max_node() + 2, MPOL_MF_MOVE);
+      // pages that haven't been touched yet just need the policy
+      if (mbind(ptr, size, MPOL_BIND, nodemask.n, numa_max_node() + 2, 0) < 0) {
+        return -1;
+      }
+
+      sicm_device_list devs = { .count = 1, .devices = &src };
+      size_t pgsz = sarena_pgsz(&devs);
+      extent_info range = {
+        .start = ptr,
+        .end = (char *) ptr + sicm_div_ceil(size, pgsz) * pgsz,
+      };
+      extent_arr ranges = { .max_extents = 1, .index = 1, .arr = &range };
+      struct bitmask *dst_nodes = numa_allocate_nodemask();
+      numa_bitmask_setbit(dst_nodes, dst_node);
+      int err = sicm_move_ranges(&ranges, pgsz, dst_nodes, sicm_numa_id(src), NULL);
+      numa_free_nodemask(dst_nodes);
+      return err?-1:0;
     }
   }
   return -1;
@@ -481,216 +508,341 @@ int sicm_pin(struct sicm_device* device) {
   return ret;
 }
 
-/**
- * @input     buf - sting with meminfo data
- * @input buf_len - length of buffer (buf)
- * @input   field - field looking for (e.g., "MemFree")
- * @inout   value - output result found in buf input
- *
- * @return: -1 (error), 0 (not found), 1 (found)
- *
- * @Notes:
- *  - Note this assumes you do not split meminfo lines up,
- *    or at least the fields you care about are fully contained
- *    in the input buffer (i.e., not split up between reads and
- *    get partial line of input in buf).
- *  - Field names look like "MemTotal"
- *  - Not very pretty, but gets the correct values from meminfo
- *    likely needs some more bounds checking (e.g., buf[i]).
+/* Device snapshots. Every node's meminfo, numastat, vmstat and huge page
+ * counters are read in one pass and kept for `snapshot_interval`
+ * milliseconds, so sicm_capacity and sicm_avail don't go to sysfs each time.
  */
-static int parse_meminfo(char *buf, int buf_len, char *field, size_t *value)
-{
-    char str[128];
-    int i;
-    int found = 0;
-
-    if (0 >= buf_len) {
-        fprintf (stderr, "Error: Bad parameter (bugus buf_len)\n");
-        return -1;
+#define SNAPSHOT_DEFAULT_INTERVAL 100
+
+static pthread_mutex_t snapshot_mutex = PTHREAD_MUTEX_INITIALIZER;
+static sicm_device_snapshot *snapshot = NULL;
+static size_t snapshot_count = 0;
+static int snapshot_valid = 0;
+static struct timespec snapshot_time;
+static int snapshot_interval = -1; /* -1 until set or read from the environment */
+
+typedef struct snapshot_field {
+  const char *name;
+  size_t offset;
+} snapshot_field;
+
+#define SNAPSHOT_FIELD(name, member) { name, offsetof(sicm_device_snapshot, member) }
+
+/* The names don't overlap between meminfo, numastat and vmstat */
+static const snapshot_field snapshot_fields[] = {
+  SNAPSHOT_FIELD("MemTotal", mem_total),
+  SNAPSHOT_FIELD("MemFree", mem_free),
+  SNAPSHOT_FIELD("MemUsed", mem_used),
+  SNAPSHOT_FIELD("Active", active),
+  SNAPSHOT_FIELD("Inactive", inactive),
+  SNAPSHOT_FIELD("FilePages", file_pages),
+  SNAPSHOT_FIELD("AnonPages", anon_pages),
+  SNAPSHOT_FIELD("Shmem", shmem),
+  SNAPSHOT_FIELD("Slab", slab),
+  SNAPSHOT_FIELD("Dirty", dirty),
+  SNAPSHOT_FIELD("Writeback", writeback),
+  SNAPSHOT_FIELD("numa_hit", numa_hit),
+  SNAPSHOT_FIELD("numa_miss", numa_miss),
+  SNAPSHOT_FIELD("numa_foreign", numa_foreign),
+  SNAPSHOT_FIELD("local_node", local_node),
+  SNAPSHOT_FIELD("other_node", other_node),
+  SNAPSHOT_FIELD("pgpromote_success", pgpromote_success),
+  SNAPSHOT_FIELD("pgdemote_kswapd", pgdemote_kswapd),
+  SNAPSHOT_FIELD("pgdemote_direct", pgdemote_direct),
+};
+
+/* Reads all of a file into *buf, growing it as needed.
+ * Returns the length read, or -1 if the file can't be read.
+ */
+static ssize_t snapshot_read(const char *path, char **buf, size_t *cap) {
+  ssize_t len, n;
+  char *tmp;
+  int fd;
+
+  fd = open(path, O_RDONLY);
+  if(fd < 0) {
+    return -1;
+  }
+
+  len = 0;
+  for(;;) {
+    if((size_t) len + 1 >= *cap) {
+      tmp = realloc(*buf, *cap * 2);
+      if(tmp == NULL) {
+        break;
+      }
+      *buf = tmp;
+      *cap *= 2;
+    }
+    n = read(fd, *buf + len, *cap - len - 1);
+    if(n <= 0) {
+      break;
     }
+    len += n;
+  }
+  close(fd);
 
-    if ((NULL == buf) || (NULL == field) || (NULL == value)) {
-        fprintf (stderr, "Error: Bad parameter\n");
-        return -1;
+  (*buf)[len] = '\0';
+  return len;
+}
+
+/* Parses lines of "key value", "key: value kB" or "Node N key: value kB" */
+static void snapshot_parse(char *buf, sicm_device_snapshot *snap) {
+  char *line, *next, *key, *end;
+  size_t i, keylen;
+
+  for(line = buf; line != NULL && *line != '\0'; line = next) {
+    next = strchr(line, '\n');
+    if(next != NULL) {
+      *next++ = '\0';
     }
 
-    for (i=0; i <= buf_len; i++) {
-        if (buf[i] == field[0]) {
-            char *s1 = &buf[i];
-            char *s2 = &field[0];
-            char tmp[128];
-            int k=0;
-            while (*s1++ == *s2++) {
-                i++;
-            }
-            if (buf[i] == ':') {
-                /* This is our line of info */
-
-                /* Move past colon */
-                i++;
-
-                /* Move past blank spaces (careful of buf_len) */
-                while ((i <= buf_len) && (buf[i] == ' ')) {
-                    i++;
-                }
-
-                /*
-                 * Grab digits before space and units, e.g.,
-                 *    Node 0 MemFree:         6348756 kB
-                 */
-                while ((i <= buf_len) && (buf[i] != ' ')) {
-                    tmp[k] = buf[i];
-                    k++;
-                    i++;
-                }
-                tmp[k] = '\0';
-
-                *value = strtol(tmp, NULL, 0);
-
-                /* Found, all done. */
-                found = 1;
-                break;
-            }
-            /* NOT our match, keep looking*/
-        }
+    key = line;
+    if(strncmp(key, "Node ", 5) == 0) {
+      key = strchr(key + 5, ' ');
+      if(key == NULL) {
+        continue;
+      }
+    }
+    while(*key == ' ') {
+      key++;
     }
 
-    return found;
+    keylen = strcspn(key, ": ");
+    for(i = 0; i < sizeof(snapshot_fields) / sizeof(snapshot_fields[0]); i++) {
+      if(strlen(snapshot_fields[i].name) == keylen && strncmp(key, snapshot_fields[i].name, keylen) == 0) {
+        end = key + keylen + strspn(key + keylen, ": ");
+        *(size_t *) ((char *) snap + snapshot_fields[i].offset) = strtoull(end, NULL, 10);
+        break;
+      }
+    }
+  }
 }
 
-size_t sicm_capacity(struct sicm_device* device) {
-  static const size_t path_len = 100;
-  char path[path_len];
-  int i;
-  switch(device->tag) {
-    case SICM_DRAM:
-    case SICM_KNL_HBM:
-    case SICM_OPTANE:
-    case SICM_POWERPC_HBM:;
-      int node = sicm_numa_id(device);
-      int page_size = sicm_device_page_size(device);
-      if(page_size == normal_page_size) {
-        snprintf(path, path_len, "/sys/devices/system/node/node%d/meminfo", node);
-        int fd = open(path, O_RDONLY);
-#if 0
-        char data[31];
-        if (read(fd, data, 31) != 31) {
-            close(fd);
-            return -1;
-        }
-        close(fd);
-        size_t res = 0;
-        size_t factor = 1;
-        for(i = 30; data[i] != ' '; i--) {
-          res += factor * (data[i] - '0');
-          factor *= 10;
-        }
-        return res;
-#else
-        char data[128];
-        if (read(fd, data, 128) != 128) {
-            close(fd);
-            return -1;
-        }
-        close(fd);
-        size_t res = 0;
-        int rc = 0;
-        /* TODO: More testing */
-        rc = parse_meminfo(data, 128, "MemTotal", &res);
-        if (rc <= 0) {
-            fprintf(stderr, "Error: failed to get available memory for node %d\n", node);
-            return -1;
-        }
-        return res;
-#endif
-      }
-      else {
-        snprintf(path, path_len, "/sys/devices/system/node/node%d/hugepages/hugepages-%dkB/nr_hugepages", node, page_size);
-        int fd = open(path, O_RDONLY);
-        int pages = 0;
-        char data[10];
-        while(read(fd, data, 10) > 0) {
-          for(i = 0; i < 10; i++) {
-            if(data[i] < '0' || data[i] > '9') break;
-            pages *= 10;
-            pages += data[i] - '0';
-          }
-        }
-        close(fd);
-        return pages * page_size;
+/* Reads the counters of a NUMA node into snap. Returns 0, or -1 if the
+ * node's meminfo can't be read.
+ */
+static int snapshot_node(int node, sicm_device_snapshot *snap, char **buf, size_t *cap) {
+  static const char *files[] = { "meminfo", "numastat", "vmstat" };
+  char path[100];
+  size_t i;
+  int ret;
+
+  memset(snap, 0, sizeof(sicm_device_snapshot));
+  ret = 0;
+  for(i = 0; i < sizeof(files) / sizeof(files[0]); i++) {
+    snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/%s", node, files[i]);
+    if(snapshot_read(path, buf, cap) < 0) {
+      if(i == 0) {
+        ret = -1;
       }
-    case INVALID_TAG:
-    default:
-      return -1;
+      continue;
+    }
+    snapshot_parse(*buf, snap);
   }
+
+  return ret;
 }
 
-size_t sicm_avail(struct sicm_device* device) {
-  static const size_t path_len = 100;
-  char path[path_len];
-  int i;
+static size_t snapshot_huge_pages(int node, int page_size, const char *file, char **buf, size_t *cap) {
+  char path[128];
+
+  snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/hugepages/hugepages-%dkB/%s", node, page_size, file);
+  if(snapshot_read(path, buf, cap) < 0) {
+    return 0;
+  }
+  return strtoull(*buf, NULL, 10);
+}
+
+/* Fills in a device's snapshot from the snapshot of its node */
+static void snapshot_device(sicm_device *device, const sicm_device_snapshot *node, int node_err,
+                            sicm_device_snapshot *snap, char **buf, size_t *cap) {
   switch(device->tag) {
     case SICM_DRAM:
     case SICM_KNL_HBM:
     case SICM_OPTANE:
-    case SICM_POWERPC_HBM:;
-      int node = sicm_numa_id(device);
-      int page_size = sicm_device_page_size(device);
-      if(page_size == normal_page_size) {
-        snprintf(path, path_len, "/sys/devices/system/node/node%d/meminfo", node);
-        int fd = open(path, O_RDONLY);
-#if 0
-        char data[66];
-        if (read(fd, data, 66) != 66) {
-            close(fd);
-            return -1;
-        }
-        close(fd);
-        size_t res = 0;
-        size_t factor = 1;
-        for(i = 65; data[i] != ' '; i--) {
-          res += factor * (data[i] - '0');
-          factor *= 10;
-        }
-#else
-        char data[128];
-        if (read(fd, data, 128) != 128) {
-            close(fd);
-            return -1;
-        }
-        close(fd);
-        size_t res = 0;
-        int rc = 0;
-        /* TODO: More testing */
-        rc = parse_meminfo(data, 128, "MemFree", &res);
-        if (rc <= 0) {
-            fprintf(stderr, "Error: failed to get available memory for node %d\n", node);
-            return -1;
-        }
-#endif
-        return res;
-      }
-      else {
-        snprintf(path, path_len, "/sys/devices/system/node/node%d/hugepages/hugepages-%dkB/free_hugepages", node, page_size);
-        int fd = open(path, O_RDONLY);
-        int pages = 0;
-        char data[10];
-        while(read(fd, data, 10) > 0) {
-          for(i = 0; i < 10; i++) {
-            if(data[i] < '0' || data[i] > '9') break;
-            pages *= 10;
-            pages += data[i] - '0';
-          }
-        }
-        close(fd);
-        return pages * page_size;
+    case SICM_POWERPC_HBM:
+      *snap = *node;
+      snap->device = device;
+      if(node_err) {
+        snap->capacity = -1;
+        snap->avail = -1;
+      } else if(device->page_size == normal_page_size) {
+        snap->capacity = snap->mem_total;
+        snap->avail = snap->mem_free;
+      } else {
+        snap->huge_pages = snapshot_huge_pages(device->node, device->page_size, "nr_hugepages", buf, cap);
+        snap->huge_free = snapshot_huge_pages(device->node, device->page_size, "free_hugepages", buf, cap);
+        snap->capacity = snap->huge_pages * device->page_size;
+        snap->avail = snap->huge_free * device->page_size;
       }
+      break;
+    case SICM_HIP:
     case INVALID_TAG:
     default:
-      return -1;
+      memset(snap, 0, sizeof(sicm_device_snapshot));
+      snap->device = device;
+      snap->capacity = -1;
+      snap->avail = -1;
+      break;
   }
 }
 
+/* Takes a new snapshot of the global devices if the last one is too old.
+ * Called with snapshot_mutex held.
+ */
+static void snapshot_refresh() {
+  sicm_device_snapshot node, *tmp;
+  struct timespec now;
+  size_t i, cap;
+  char *buf, *env;
+  int last, err;
+  long age;
+
+  if(snapshot_interval < 0) {
+    snapshot_interval = SNAPSHOT_DEFAULT_INTERVAL;
+    env = getenv("SICM_SNAPSHOT_INTERVAL");
+    if(env != NULL && atoi(env) >= 0) {
+      snapshot_interval = atoi(env);
+    }
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  if(snapshot_valid) {
+    age = (now.tv_sec - snapshot_time.tv_sec) * 1000 + (now.tv_nsec - snapshot_time.tv_nsec) / 1000000;
+    if(age < snapshot_interval) {
+      return;
+    }
+  }
+
+  if(snapshot_count < sicm_global_devices.count) {
+    tmp = realloc(snapshot, sicm_global_devices.count * sizeof(sicm_device_snapshot));
+    if(tmp == NULL) {
+      return;
+    }
+    snapshot = tmp;
+  }
+  snapshot_count = sicm_global_devices.count;
+
+  cap = 4096;
+  buf = malloc(cap);
+  if(buf == NULL) {
+    return;
+  }
+
+  /* The devices are sorted by node, so each node is read once */
+  last = -1;
+  err = 0;
+  for(i = 0; i < snapshot_count; i++) {
+    if(sicm_global_devices.devices[i]->node != last) {
+      last = sicm_global_devices.devices[i]->node;
+      err = snapshot_node(last, &node, &buf, &cap);
+    }
+    snapshot_device(sicm_global_devices.devices[i], &node, err, &snapshot[i], &buf, &cap);
+  }
+  free(buf);
+
+  snapshot_time = now;
+  snapshot_valid = 1;
+}
+
+/* Gets the snapshot of one device, from the cache if it's a known device */
+static void snapshot_lookup(sicm_device *device, sicm_device_snapshot *snap) {
+  sicm_device_snapshot node;
+  size_t i, cap;
+  char *buf;
+  int err;
+
+  pthread_mutex_lock(&snapshot_mutex);
+  snapshot_refresh();
+  for(i = 0; i < snapshot_count; i++) {
+    if(sicm_device_eq(snapshot[i].device, device)) {
+      *snap = snapshot[i];
+      snap->device = device;
+      pthread_mutex_unlock(&snapshot_mutex);
+      return;
+    }
+  }
+  pthread_mutex_unlock(&snapshot_mutex);
+
+  /* Not one of the devices that sicm_init found */
+  cap = 4096;
+  buf = malloc(cap);
+  if(buf == NULL) {
+    memset(snap, 0, sizeof(sicm_device_snapshot));
+    snap->capacity = -1;
+    snap->avail = -1;
+    return;
+  }
+  err = snapshot_node(device->node, &node, &buf, &cap);
+  snapshot_device(device, &node, err, snap, &buf, &cap);
+  free(buf);
+}
+
+/* Drops the snapshot once the global devices are gone */
+static void snapshot_clear() {
+  pthread_mutex_lock(&snapshot_mutex);
+  free(snapshot);
+  snapshot = NULL;
+  snapshot_count = 0;
+  snapshot_valid = 0;
+  pthread_mutex_unlock(&snapshot_mutex);
+}
+
+size_t sicm_avail_cached(sicm_device *device) {
+  size_t i, avail;
+
+  avail = -1;
+  if(pthread_mutex_trylock(&snapshot_mutex) != 0) {
+    return avail;
+  }
+  if(snapshot_valid) {
+    for(i = 0; i < snapshot_count; i++) {
+      if(sicm_device_eq(snapshot[i].device, device)) {
+        avail = snapshot[i].avail;
+        break;
+      }
+    }
+  }
+  pthread_mutex_unlock(&snapshot_mutex);
+
+  return avail;
+}
+
+size_t sicm_devices_snapshot(sicm_device_snapshot *snap, size_t max) {
+  size_t count;
+
+  pthread_mutex_lock(&snapshot_mutex);
+  snapshot_refresh();
+  count = snapshot_count;
+  if(snap != NULL) {
+    memcpy(snap, snapshot, ((max < count)?max:count) * sizeof(sicm_device_snapshot));
+  }
+  pthread_mutex_unlock(&snapshot_mutex);
+
+  return count;
+}
+
+void sicm_set_snapshot_interval(unsigned int msec) {
+  pthread_mutex_lock(&snapshot_mutex);
+  snapshot_interval = (msec > INT_MAX)?INT_MAX:msec;
+  pthread_mutex_unlock(&snapshot_mutex);
+}
+
+size_t sicm_capacity(struct sicm_device* device) {
+  sicm_device_snapshot snap;
+
+  snapshot_lookup(device, &snap);
+  return snap.capacity;
+}
+
+size_t sicm_avail(struct sicm_device* device) {
+  sicm_device_snapshot snap;
+
+  snapshot_lookup(device, &snap);
+  return snap.avail;
+}
+
 int sicm_model_distance(struct sicm_device* device) {
   switch(device->tag) {
     case SICM_DRAM:
@@ -706,9 +858,24 @@ int sicm_model_distance(struct sicm_device* device) {
 }
 
 int sicm_is_near(struct sicm_device* device) {
-  int dist;
+  int dist, cpu_node, near;
 
-  dist = numa_distance(sicm_numa_id(device), numa_node_of_cpu(sched_getcpu()));
+  cpu_node = numa_node_of_cpu(sched_getcpu());
+  switch(device->tag) {
+    case SICM_DRAM:
+    case SICM_KNL_HBM:
+    case SICM_OPTANE:
+    case SICM_POWERPC_HBM:
+      near = tiers_is_initiator(sicm_numa_id(device), cpu_node);
+      if(near >= 0) {
+        return near;
+      }
+      break;
+    default:
+      return 0;
+  }
+
+  dist = numa_distance(sicm_numa_id(device), cpu_node);
   switch(device->tag) {
     case SICM_DRAM:
       return dist == 10;
@@ -724,6 +891,29 @@ int sicm_is_near(struct sicm_device* device) {
   }
 }
 
+int sicm_get_device_perf(struct sicm_device* device, sicm_device_perf* perf) {
+  switch(device->tag) {
+    case SICM_DRAM:
+    case SICM_KNL_HBM:
+    case SICM_OPTANE:
+    case SICM_POWERPC_HBM:
+      return tiers_get_perf(sicm_numa_id(device), perf);
+    case SICM_HIP:
+    case INVALID_TAG:
+    default:
+      return -EINVAL;
+  }
+}
+
+int sicm_device_tier(struct sicm_device* device) {
+  sicm_device_perf perf;
+
+  if(sicm_get_device_perf(device, &perf) != 0) {
+    return -1;
+  }
+  return perf.tier;
+}
+
 void sicm_latency(struct sicm_device* device, size_t size, int iter, struct sicm_timing* res) {
   struct timespec start, end;
   int i;
@@ -755,12 +945,24 @@ void sicm_latency(struct sicm_device* device, size_t size, int iter, struct sicm
   res->free = (end.tv_sec - start.tv_sec) * 1000000 + (end.tv_nsec - start.tv_nsec) / 1000;
 }
 
+// Bytes per microsecond, timed in nanoseconds so that short kernels don't
+// round down to nothing or divide by zero.
+static size_t bandwidth_rate(size_t accesses, struct timespec *start, struct timespec *end) {
+  double ns;
+
+  ns = (end->tv_sec - start->tv_sec) * 1e9 + (end->tv_nsec - start->tv_nsec);
+  if (ns < 1)
+    ns = 1;
+
+  return (size_t) (accesses * 1e3 / ns);
+}
+
 size_t sicm_bandwidth_linear2(struct sicm_device* device, size_t size,
     size_t (*kernel)(double*, double*, size_t)) {
   struct timespec start, end;
   double* a = sicm_device_alloc(device, size * sizeof(double));
   double* b = sicm_device_alloc(device, size * sizeof(double));
-  unsigned int i;
+  size_t i;
   #pragma omp parallel for
   for(i = 0; i < size; i++) {
     a[i] = 1;
@@ -769,10 +971,9 @@ size_t sicm_bandwidth_linear2(struct sicm_device* device, size_t size,
   clock_gettime(CLOCK_MONOTONIC_RAW, &start);
   size_t accesses = kernel(a, b, size);
   clock_gettime(CLOCK_MONOTONIC_RAW, &end);
-  size_t delta = (end.tv_sec - start.tv_sec) * 1000000 + (end.tv_nsec - start.tv_nsec) / 1000;
   sicm_device_free(device, a, size * sizeof(double));
   sicm_device_free(device, b, size * sizeof(double));
-  return accesses / delta;
+  return bandwidth_rate(accesses, &start, &end);
 }
 
 size_t sicm_bandwidth_random2(struct sicm_device* device, size_t size,
@@ -781,7 +982,7 @@ size_t sicm_bandwidth_random2(struct sicm_device* device, size_t size,
   double* a = sicm_device_alloc(device, size * sizeof(double));
   double* b = sicm_device_alloc(device, size * sizeof(double));
   size_t* indexes = sicm_device_alloc(device, size * sizeof(size_t));
-  unsigned int i;
+  size_t i;
   #pragma omp parallel for
   for(i = 0; i < size; i++) {
     a[i] = 1;
@@ -791,11 +992,10 @@ size_t sicm_bandwidth_random2(struct sicm_device* device, size_t size,
   clock_gettime(CLOCK_MONOTONIC_RAW, &start);
   size_t accesses = kernel(a, b, indexes, size);
   clock_gettime(CLOCK_MONOTONIC_RAW, &end);
-  size_t delta = (end.tv_sec - start.tv_sec) * 1000000 + (end.tv_nsec - start.tv_nsec) / 1000;
   sicm_device_free(device, a, size * sizeof(double));
   sicm_device_free(device, b, size * sizeof(double));
   sicm_device_free(device, indexes, size * sizeof(size_t));
-  return accesses / delta;
+  return bandwidth_rate(accesses, &start, &end);
 }
 
 size_t sicm_bandwidth_linear3(struct sicm_device* device, size_t size,
@@ -804,7 +1004,7 @@ size_t sicm_bandwidth_linear3(struct sicm_device* device, size_t size,
   double* a = sicm_device_alloc(device, 3 * size * sizeof(double));
   double* b = &a[size];
   double* c = &a[size * 2];
-  unsigned int i;
+  size_t i;
   #pragma omp parallel for
   for(i = 0; i < size; i++) {
     a[i] = 1;
@@ -814,9 +1014,8 @@ size_t sicm_bandwidth_linear3(struct sicm_device* device, size_t size,
   clock_gettime(CLOCK_MONOTONIC_RAW, &start);
   size_t accesses = kernel(a, b, c, size);
   clock_gettime(CLOCK_MONOTONIC_RAW, &end);
-  size_t delta = (end.tv_sec - start.tv_sec) * 1000000 + (end.tv_nsec - start.tv_nsec) / 1000;
   sicm_device_free(device, a, 3 * size * sizeof(double));
-  return accesses / delta;
+  return bandwidth_rate(accesses, &start, &end);
 }
 
 size_t sicm_bandwidth_random3(struct sicm_device* device, size_t size,
@@ -826,7 +1025,7 @@ size_t sicm_bandwidth_random3(struct sicm_device* device, size_t size,
   double* b = sicm_device_alloc(device, size * sizeof(double));
   double* c = sicm_device_alloc(device, size * sizeof(double));
   size_t* indexes = sicm_device_alloc(device, size * sizeof(size_t));
-  unsigned int i;
+  size_t i;
   #pragma omp parallel for
   for(i = 0; i < size; i++) {
     a[i] = 1;
@@ -837,16 +1036,15 @@ size_t sicm_bandwidth_random3(struct sicm_device* device, size_t size,
   clock_gettime(CLOCK_MONOTONIC_RAW, &start);
   size_t accesses = kernel(a, b, c, indexes, size);
   clock_gettime(CLOCK_MONOTONIC_RAW, &end);
-  size_t delta = (end.tv_sec - start.tv_sec) * 1000000 + (end.tv_nsec - start.tv_nsec) / 1000;
   sicm_device_free(device, a, size * sizeof(double));
   sicm_device_free(device, b, size * sizeof(double));
   sicm_device_free(device, c, size * sizeof(double));
   sicm_device_free(device, indexes, size * sizeof(size_t));
-  return accesses / delta;
+  return bandwidth_rate(accesses, &start, &end);
 }
 
 size_t sicm_triad_kernel_linear(double* a, double* b, double* c, size_t size) {
-  int i;
+  size_t i;
   double scalar = 3.0;
   #pragma omp parallel for
   for(i = 0; i < size; i++) {
@@ -856,11 +1054,11 @@ size_t sicm_triad_kernel_linear(double* a, double* b, double* c, size_t size) {
 }
 
 size_t sicm_triad_kernel_random(double* a, double* b, double* c, size_t* indexes, size_t size) {
-  int i, idx;
+  size_t i;
   double scalar = 3.0;
   #pragma omp parallel for
   for(i = 0; i < size; i++) {
-    idx = indexes[i];
+    size_t idx = indexes[i];
     a[idx] = b[idx] + scalar * c[idx];
   }
   return size * (sizeof(size_t) + 3 * sizeof(double));
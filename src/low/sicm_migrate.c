@@ -0,0 +1,657 @@
+#include <errno.h>
+#include <limits.h>
+#include <numa.h>
+#include <numaif.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "sicm_low.h"
+#include "sicm_impl.h"
+
+// Pages are moved with move_pages, in batches that a pool of threads takes
+// turns picking up. Each thread copies the pages it moves itself, so a
+// single thread leaves most of the memory bandwidth unused on big moves.
+
+// pages per move_pages call
+#define SM_BATCH 1024
+// how many times pages that are busy (locked, under writeback, ...) are retried
+#define SM_RETRIES 3
+// less than this isn't worth starting threads for
+#define SM_THREADED_MIN (64 * 1024 * 1024)
+// used when SICM_MIGRATION_THREADS isn't set
+#define SM_DEFAULT_THREADS 4
+
+static int sm_threads;	// 0 until the first move
+
+typedef struct sm_move {
+	extent_arr*		ranges;
+	size_t			pgsz;
+	int*			nodes;		// the pages go round robin over these
+	int			node_count;
+	sarena_stripes*		stripes;	// NULL for round robin
+
+	pthread_mutex_t		mutex;		// for next and pos
+	size_t			next;		// first range that hasn't been handed out
+	char*			pos;		// how far into it we are
+
+	int			err;		// first error, set with mutex held
+} sm_move;
+
+typedef struct sm_mover {
+	sm_move*		mv;
+	int			node;		// to run on, -1 to stay where we are
+	pthread_t		thread;
+} sm_mover;
+
+int sicm_set_migration_threads(int threads) {
+	if (threads < 1)
+		return -EINVAL;
+
+	__atomic_store_n(&sm_threads, threads, __ATOMIC_RELAXED);
+	return 0;
+}
+
+static int sm_get_threads(void) {
+	int threads;
+	char *env;
+
+	threads = __atomic_load_n(&sm_threads, __ATOMIC_RELAXED);
+	if (threads > 0)
+		return threads;
+
+	threads = 0;
+	env = getenv("SICM_MIGRATION_THREADS");
+	if (env != NULL)
+		threads = atoi(env);
+
+	if (threads < 1) {
+		threads = sysconf(_SC_NPROCESSORS_ONLN);
+		if (threads > SM_DEFAULT_THREADS)
+			threads = SM_DEFAULT_THREADS;
+		if (threads < 1)
+			threads = 1;
+	}
+
+	__atomic_store_n(&sm_threads, threads, __ATOMIC_RELAXED);
+	return threads;
+}
+
+static void sm_move_error(sm_move *mv, int err) {
+	pthread_mutex_lock(&mv->mutex);
+	if (mv->err == 0)
+		mv->err = err;
+	pthread_mutex_unlock(&mv->mutex);
+}
+
+// Hand out the next batch. Returns the number of pages in it, 0 if there are none left.
+static size_t sm_move_next(sm_move *mv, char **start) {
+	extent_info *r;
+	char *s;
+	size_t count;
+
+	count = 0;
+	pthread_mutex_lock(&mv->mutex);
+	while (mv->next < mv->ranges->index) {
+		r = &mv->ranges->arr[mv->next];
+		s = (mv->pos > (char *) r->start)?mv->pos:(char *) r->start;
+		count = ((char *) r->end - s) / mv->pgsz;
+		if (count == 0) {
+			mv->next++;
+			continue;
+		}
+
+		if (count > SM_BATCH)
+			count = SM_BATCH;
+		mv->pos = s + count * mv->pgsz;
+		*start = s;
+		break;
+	}
+	pthread_mutex_unlock(&mv->mutex);
+
+	return count;
+}
+
+static void sm_move_batch(sm_move *mv, char *start, size_t count, void **pages, int *nodes, int *status) {
+	size_t i, busy;
+	int try;
+
+	for(i = 0; i < count; i++) {
+		pages[i] = start + i * mv->pgsz;
+		if (mv->stripes != NULL)
+			nodes[i] = mv->stripes->nodes[((uintptr_t) pages[i] / mv->stripes->size) % mv->stripes->count];
+		else
+			nodes[i] = mv->nodes[((uintptr_t) pages[i] / mv->pgsz) % mv->node_count];
+	}
+
+	for(try = 0; count > 0; try++) {
+		if (numa_move_pages(0, count, pages, nodes, status, MPOL_MF_MOVE) < 0) {
+			sm_move_error(mv, -errno);
+			return;
+		}
+
+		busy = 0;
+		for(i = 0; i < count; i++) {
+			switch (status[i]) {
+			case -EBUSY:
+			case -EAGAIN:
+				pages[busy] = pages[i];
+				nodes[busy] = nodes[i];
+				busy++;
+				break;
+
+			// not populated yet, the policy decides where they go
+			case -ENOENT:
+			case -EFAULT:
+			// shared with other processes, mbind leaves those alone too
+			case -EACCES:
+				break;
+
+			default:
+				if (status[i] < 0)
+					sm_move_error(mv, status[i]);
+				break;
+			}
+		}
+
+		count = busy;
+		if (count > 0 && try == SM_RETRIES) {
+			sm_move_error(mv, -EBUSY);
+			return;
+		}
+	}
+}
+
+// The node with CPUs that is closest to node, which may be node itself, or
+// -1 if there isn't any. Memory-only nodes (CXL, Optane, HBM) have none.
+static int sm_cpu_node(int node) {
+	struct bitmask *cpus;
+	int n, best, dist, bestdist;
+
+	cpus = numa_allocate_cpumask();
+	best = -1;
+	bestdist = 0;
+	for(n = 0; n <= numa_max_node(); n++) {
+		if (numa_node_to_cpus(n, cpus) != 0 || numa_bitmask_weight(cpus) == 0)
+			continue;
+
+		dist = numa_distance(node, n);
+		if (dist == 0)
+			dist = (n == node)?0:INT_MAX;
+		if (best < 0 || dist < bestdist) {
+			best = n;
+			bestdist = dist;
+		}
+	}
+	numa_free_cpumask(cpus);
+
+	return best;
+}
+
+static void *sm_move_worker(void *arg) {
+	sm_mover *w;
+	void **pages;
+	int *nodes, *status;
+	char *start;
+	size_t count;
+
+	w = arg;
+	start = NULL;
+	if (w->node >= 0 && numa_run_on_node(w->node) != 0)
+		perror("numa_run_on_node");
+
+	pages = malloc(SM_BATCH * sizeof(void *));
+	nodes = malloc(SM_BATCH * sizeof(int));
+	status = malloc(SM_BATCH * sizeof(int));
+	if (pages == NULL || nodes == NULL || status == NULL) {
+		sm_move_error(w->mv, -ENOMEM);
+	} else {
+		while ((count = sm_move_next(w->mv, &start)) > 0)
+			sm_move_batch(w->mv, start, count, pages, nodes, status);
+	}
+
+	free(status);
+	free(nodes);
+	free(pages);
+
+	return NULL;
+}
+
+int sicm_move_ranges(extent_arr *ranges, size_t pgsz, struct bitmask *dst, int src_node, sarena_stripes *stripes) {
+	sm_move mv;
+	sm_mover *workers;
+	size_t i, total;
+	int threads, started, node;
+
+	memset(&mv, 0, sizeof(mv));
+	mv.ranges = ranges;
+	mv.pgsz = pgsz;
+	mv.stripes = (stripes != NULL && stripes->count > 0)?stripes:NULL;
+	mv.nodes = malloc(numa_num_possible_nodes() * sizeof(int));
+	if (mv.nodes == NULL)
+		return -ENOMEM;
+	for(node = 0; node < numa_num_possible_nodes(); node++) {
+		if (numa_bitmask_isbitset(dst, node))
+			mv.nodes[mv.node_count++] = node;
+	}
+	if (mv.node_count == 0) {
+		free(mv.nodes);
+		return -EINVAL;
+	}
+	pthread_mutex_init(&mv.mutex, NULL);
+
+	total = 0;
+	extent_arr_for(ranges, i) {
+		total += (char *) ranges->arr[i].end - (char *) ranges->arr[i].start;
+	}
+
+	threads = sm_get_threads();
+	if (total < SM_THREADED_MIN)
+		threads = 1;
+
+	// half of the threads run near the memory they read, the other half near where they write
+	workers = calloc(threads, sizeof(sm_mover));
+	started = 0;
+	if (workers != NULL && threads > 1) {
+		for(started = 0; started < threads; started++) {
+			workers[started].mv = &mv;
+			node = ((started % 2) && src_node >= 0)?src_node:mv.nodes[started % mv.node_count];
+			workers[started].node = sm_cpu_node(node);
+			if (pthread_create(&workers[started].thread, NULL, sm_move_worker, &workers[started]) != 0)
+				break;
+		}
+	}
+
+	if (started == 0) {
+		// do it ourselves, without moving the calling thread around
+		sm_mover self = { .mv = &mv, .node = -1 };
+		sm_move_worker(&self);
+	}
+
+	for(i = 0; i < (size_t) started; i++)
+		pthread_join(workers[i].thread, NULL);
+
+	free(workers);
+	pthread_mutex_destroy(&mv.mutex);
+	free(mv.nodes);
+
+	return mv.err;
+}
+
+// Migrations run on a single background thread. The arena is switched to
+// its new devices as soon as a migration is queued, so new extents go
+// straight to the new devices; the worker then moves the existing memory a
+// chunk at a time, holding the arena's mutex only for as long as it takes
+// to move one chunk. Each chunk comes from the queued migration with the
+// highest priority, and if a rate is set the worker sleeps between chunks
+// so that migrations don't take more bandwidth than that.
+
+// how much memory is moved with the arena's mutex held
+#define SM_CHUNK (4 * 1024 * 1024)
+// with a rate set, chunks are small enough to move this many times a second
+#define SM_TICKS 10
+
+struct sicm_migration {
+	sarena*			sa;
+	extent_arr*		ranges;		// what has to be moved
+	size_t			next;		// first range that isn't done yet
+	char*			pos;		// how far into it we are
+	size_t			done, total;	// in bytes
+	double			priority;
+	int			err;
+	int			cancelled;
+	int			finished;
+	int			refs;		// the handle and the queue
+	sicm_migration*		next_migration;
+};
+
+static pthread_mutex_t sm_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t sm_work = PTHREAD_COND_INITIALIZER;	// something was queued
+static pthread_cond_t sm_done = PTHREAD_COND_INITIALIZER;	// something finished
+static sicm_migration *sm_head, *sm_tail;
+static sicm_migration *sm_current;
+static pthread_t sm_worker;
+static int sm_started;
+static size_t sm_rate;				// bytes per second, 0 is unlimited
+static struct timespec sm_next;			// when the worker may move the next chunk
+
+// should be called with sm_mutex held
+static void sm_unref(sicm_migration *m) {
+	m->refs--;
+	if (m->refs > 0)
+		return;
+
+	extent_arr_free(m->ranges);
+	free(m);
+}
+
+// Move the next chunk of the migration. Returns the number of bytes that
+// were taken care of, or 0 if there is nothing left.
+static size_t sm_step(sicm_migration *m, size_t step) {
+	sarena *sa;
+	extent_arr *live;
+	extent_info *r, *e;
+	char *start, *end;
+	extent_info one;
+	extent_arr chunk = { .max_extents = 1, .index = 1, .arr = &one };
+	size_t i;
+	int err;
+
+	sa = m->sa;
+	step = (step > sa->pgsz)?step / sa->pgsz * sa->pgsz:sa->pgsz;
+	while (m->next < m->ranges->index) {
+		r = &m->ranges->arr[m->next];
+		start = (m->pos > (char *) r->start)?m->pos:(char *) r->start;
+		if (start >= (char *) r->end) {
+			m->next++;
+			continue;
+		}
+
+		end = start + step;
+		if (end > (char *) r->end)
+			end = r->end;
+
+		pthread_mutex_lock(sa->mutex);
+
+		// jemalloc may have given some of the memory back since the
+		// migration started, only move what the arena still has
+		live = sa->regions?sa->maps:sa->extents;
+		e = extent_arr_lookup(live, start);
+		if (e != NULL) {
+			if ((char *) e->end < end)
+				end = e->end;
+
+			one.start = start;
+			one.end = end;
+			err = sarena_move(sa, &chunk, NULL);
+			if (err != 0 && m->err == 0)
+				m->err = err;
+		} else {
+			i = extent_arr_upper_bound(live, start);
+			if (i < live->index && (char *) live->arr[i].start < end)
+				end = live->arr[i].start;
+		}
+
+		pthread_mutex_unlock(sa->mutex);
+
+		m->pos = end;
+		return end - start;
+	}
+
+	return 0;
+}
+
+// Move the next chunk of the migration. Returns the number of bytes that
+// were moved, or 0 once the migration is over.
+static size_t sm_advance(sicm_migration *m, size_t step) {
+	size_t moved;
+
+	if (__atomic_load_n(&m->cancelled, __ATOMIC_ACQUIRE)) {
+		if (m->next < m->ranges->index)
+			m->err = -ECANCELED;
+		return 0;
+	}
+
+	moved = sm_step(m, step);
+	__atomic_add_fetch(&m->done, moved, __ATOMIC_RELEASE);
+	return moved;
+}
+
+static void sm_run(sicm_migration *m) {
+	while (sm_advance(m, SM_CHUNK) > 0)
+		;
+}
+
+// The queued migration with the highest priority, the oldest one if there
+// is a tie. Should be called with sm_mutex held.
+static sicm_migration *sm_pick(void) {
+	sicm_migration *m, *best;
+
+	best = sm_head;
+	for(m = sm_head; m != NULL; m = m->next_migration) {
+		if (m->priority > best->priority)
+			best = m;
+	}
+
+	return best;
+}
+
+// should be called with sm_mutex held
+static void sm_dequeue(sicm_migration *m) {
+	sicm_migration **p, *prev;
+
+	prev = NULL;
+	for(p = &sm_head; *p != m; p = &(*p)->next_migration)
+		prev = *p;
+
+	*p = m->next_migration;
+	if (sm_tail == m)
+		sm_tail = prev;
+}
+
+// Wait until moving another `moved` bytes keeps us under the rate. Should
+// be called with sm_mutex held, which is released while sleeping.
+static void sm_throttle(size_t moved) {
+	struct timespec now;
+	size_t rate;
+	long long ns;
+
+	rate = sm_rate;
+	if (rate == 0)
+		return;
+
+	// time that was spent idle doesn't count, otherwise it would all be spent in one burst
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	if (now.tv_sec > sm_next.tv_sec || (now.tv_sec == sm_next.tv_sec && now.tv_nsec > sm_next.tv_nsec))
+		sm_next = now;
+
+	ns = (long long) ((double) moved * 1e9 / rate);
+	sm_next.tv_sec += ns / 1000000000;
+	sm_next.tv_nsec += ns % 1000000000;
+	if (sm_next.tv_nsec >= 1000000000) {
+		sm_next.tv_sec++;
+		sm_next.tv_nsec -= 1000000000;
+	}
+
+	pthread_mutex_unlock(&sm_mutex);
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &sm_next, NULL) == EINTR)
+		;
+	pthread_mutex_lock(&sm_mutex);
+}
+
+static void *sm_worker_main(void *arg) {
+	sicm_migration *m;
+	size_t step, moved;
+
+	pthread_mutex_lock(&sm_mutex);
+	for(;;) {
+		while (sm_head == NULL)
+			pthread_cond_wait(&sm_work, &sm_mutex);
+
+		m = sm_pick();
+		sm_current = m;
+		step = SM_CHUNK;
+		if (sm_rate != 0 && sm_rate / SM_TICKS < step)
+			step = sm_rate / SM_TICKS;
+		pthread_mutex_unlock(&sm_mutex);
+
+		moved = sm_advance(m, step);
+
+		pthread_mutex_lock(&sm_mutex);
+		sm_current = NULL;
+		if (moved == 0) {
+			sm_dequeue(m);
+			m->finished = 1;
+			sm_unref(m);
+		}
+		pthread_cond_broadcast(&sm_done);
+
+		sm_throttle(moved);
+	}
+
+	return NULL;
+}
+
+int sicm_set_migration_rate(size_t bytes_per_sec) {
+	pthread_mutex_lock(&sm_mutex);
+	sm_rate = bytes_per_sec;
+	pthread_mutex_unlock(&sm_mutex);
+
+	return 0;
+}
+
+size_t sicm_migration_pending(void) {
+	sicm_migration *m;
+	size_t pending;
+
+	pending = 0;
+	pthread_mutex_lock(&sm_mutex);
+	for(m = sm_head; m != NULL; m = m->next_migration) {
+		if (!__atomic_load_n(&m->cancelled, __ATOMIC_ACQUIRE))
+			pending += m->total - __atomic_load_n(&m->done, __ATOMIC_ACQUIRE);
+	}
+	pthread_mutex_unlock(&sm_mutex);
+
+	return pending;
+}
+
+void sarena_migrations_cancel(sarena *sa) {
+	sicm_migration *m;
+
+	pthread_mutex_lock(&sm_mutex);
+	for(m = sm_head; m != NULL; m = m->next_migration) {
+		if (m->sa == sa)
+			__atomic_store_n(&m->cancelled, 1, __ATOMIC_RELEASE);
+	}
+	pthread_mutex_unlock(&sm_mutex);
+}
+
+void sarena_migrations_forget(sarena *sa) {
+	sarena_migrations_cancel(sa);
+
+	// cancelled migrations don't touch the arena, except for the one that is running
+	pthread_mutex_lock(&sm_mutex);
+	while (sm_current != NULL && sm_current->sa == sa)
+		pthread_cond_wait(&sm_done, &sm_mutex);
+	pthread_mutex_unlock(&sm_mutex);
+}
+
+sicm_migration *sicm_arena_set_device_list_async(sicm_arena a, sicm_device_list *devs) {
+	sarena *sa;
+	sicm_migration *m;
+	size_t i;
+
+	sa = a;
+	if (sa == NULL || devs == NULL || devs->count == 0 || sa->shared != NULL)
+		return NULL;
+
+	// changing the page size copies the arena's memory, which can't be used
+	// in the meantime; that is up to sicm_arena_set_device_list
+	if (sarena_pgsz(devs) != sa->pgsz)
+		return NULL;
+
+	m = calloc(1, sizeof(sicm_migration));
+	if (m == NULL)
+		return NULL;
+
+	m->sa = sa;
+	m->refs = 2;
+
+	// newer migrations of the same arena replace older ones
+	sarena_migrations_cancel(sa);
+
+	m->ranges = sarena_switch_devices(sa, devs);
+	if (m->ranges == NULL) {
+		free(m);
+		return NULL;
+	}
+
+	extent_arr_for(m->ranges, i) {
+		m->total += (char *) m->ranges->arr[i].end - (char *) m->ranges->arr[i].start;
+	}
+
+	pthread_mutex_lock(&sm_mutex);
+	if (!sm_started) {
+		if (pthread_create(&sm_worker, NULL, sm_worker_main, NULL) != 0) {
+			// no worker, do it ourselves
+			pthread_mutex_unlock(&sm_mutex);
+			sm_run(m);
+			m->finished = 1;
+			m->refs = 1;
+			return m;
+		}
+		pthread_detach(sm_worker);
+		sm_started = 1;
+	}
+
+	if (sm_tail != NULL)
+		sm_tail->next_migration = m;
+	else
+		sm_head = m;
+	sm_tail = m;
+	pthread_cond_signal(&sm_work);
+	pthread_mutex_unlock(&sm_mutex);
+
+	return m;
+}
+
+int sicm_migration_poll(sicm_migration *m, size_t *done, size_t *total) {
+	int finished;
+
+	if (m == NULL)
+		return -EINVAL;
+
+	pthread_mutex_lock(&sm_mutex);
+	finished = m->finished;
+	pthread_mutex_unlock(&sm_mutex);
+
+	if (done != NULL)
+		*done = __atomic_load_n(&m->done, __ATOMIC_ACQUIRE);
+	if (total != NULL)
+		*total = m->total;
+
+	return finished;
+}
+
+int sicm_migration_wait(sicm_migration *m) {
+	if (m == NULL)
+		return -EINVAL;
+
+	pthread_mutex_lock(&sm_mutex);
+	while (!m->finished)
+		pthread_cond_wait(&sm_done, &sm_mutex);
+	pthread_mutex_unlock(&sm_mutex);
+
+	return m->err;
+}
+
+int sicm_migration_set_priority(sicm_migration *m, double priority) {
+	if (m == NULL)
+		return -EINVAL;
+
+	pthread_mutex_lock(&sm_mutex);
+	m->priority = priority;
+	pthread_mutex_unlock(&sm_mutex);
+
+	return 0;
+}
+
+int sicm_migration_cancel(sicm_migration *m) {
+	if (m == NULL)
+		return -EINVAL;
+
+	__atomic_store_n(&m->cancelled, 1, __ATOMIC_RELEASE);
+	return 0;
+}
+
+void sicm_migration_free(sicm_migration *m) {
+	if (m == NULL)
+		return;
+
+	pthread_mutex_lock(&sm_mutex);
+	sm_unref(m);
+	pthread_mutex_unlock(&sm_mutex);
+}
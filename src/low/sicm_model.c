@@ -0,0 +1,409 @@
+#include "sicm_low.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <numa.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "sicm_bench.h"
+
+// Measured performance of each (initiator node, device) pair. Measuring
+// takes a while, so the results are saved to a cache file and loaded by
+// sicm_init. The file is named after a hash of the machine's topology, so
+// machines that share a home directory each get their own.
+
+#define SMOD_MAGIC	"SICMMODL"
+#define SMOD_VERSION	1
+// most entries that a cache file may have
+#define SMOD_MAX	65536
+
+// well past the last level cache: half is chased, half streamed by the load
+#define SMOD_SIZE	(512UL * 1024 * 1024)
+#define SMOD_CHASE	(1 << 20)
+#define SMOD_PASSES	2
+
+typedef struct smod_header {
+	char		magic[8];
+	uint32_t	version;
+	uint32_t	count;
+	uint64_t	topology;
+} smod_header;
+
+typedef struct smod_entry {
+	int32_t			initiator;
+	int32_t			tag;
+	int32_t			node;
+	int32_t			page_size;
+	sicm_device_model	model;
+} smod_entry;
+
+static pthread_mutex_t smod_mutex = PTHREAD_MUTEX_INITIALIZER;
+// only one sicm_device_characterize measures at a time, without smod_mutex
+static pthread_mutex_t smod_measure_mutex = PTHREAD_MUTEX_INITIALIZER;
+static smod_entry *smod_entries;
+static size_t smod_count;
+
+static void smod_hash(uint64_t *h, const void *data, size_t len) {
+	const unsigned char *p;
+	size_t i;
+
+	// FNV-1a
+	p = data;
+	for(i = 0; i < len; i++) {
+		*h ^= p[i];
+		*h *= 0x100000001b3ULL;
+	}
+}
+
+// The CPU model, the nodes with their CPUs, memory and distances, and the
+// devices. Anything that changes the numbers should change the hash.
+static uint64_t smod_topology(sicm_device_list *devs) {
+	char line[256];
+	uint64_t h;
+	long long size;
+	unsigned int i;
+	int n, m, v;
+	FILE *f;
+
+	h = 0xcbf29ce484222325ULL;
+
+	f = fopen("/proc/cpuinfo", "r");
+	if (f != NULL) {
+		while (fgets(line, sizeof(line), f) != NULL) {
+			if (strncmp(line, "model name", 10) == 0 || strncmp(line, "cpu\t", 4) == 0) {
+				smod_hash(&h, line, strlen(line));
+				break;
+			}
+		}
+		fclose(f);
+	}
+
+	for(n = 0; n <= numa_max_node(); n++) {
+		v = sb_node_cpus(n);
+		smod_hash(&h, &v, sizeof(v));
+		// in GiB, so that memory the kernel reserves doesn't matter
+		size = numa_node_size64(n, NULL) >> 30;
+		smod_hash(&h, &size, sizeof(size));
+		for(m = 0; m <= numa_max_node(); m++) {
+			v = numa_distance(n, m);
+			smod_hash(&h, &v, sizeof(v));
+		}
+	}
+
+	for(i = 0; i < devs->count; i++) {
+		v = devs->devices[i]->tag;
+		smod_hash(&h, &v, sizeof(v));
+		smod_hash(&h, &devs->devices[i]->node, sizeof(int));
+		smod_hash(&h, &devs->devices[i]->page_size, sizeof(int));
+	}
+
+	return h;
+}
+
+// SICM_MODEL_CACHE, $XDG_CACHE_HOME/sicm or ~/.cache/sicm. Returns the
+// length of the directory part, or -1 if there's nowhere to put it.
+static int smod_path(uint64_t topology, char *path, size_t len) {
+	char *env;
+	int dir;
+
+	if ((env = getenv("SICM_MODEL_CACHE")) != NULL && *env != '\0')
+		dir = snprintf(path, len, "%s", env);
+	else if ((env = getenv("XDG_CACHE_HOME")) != NULL && *env != '\0')
+		dir = snprintf(path, len, "%s/sicm", env);
+	else if ((env = getenv("HOME")) != NULL && *env != '\0')
+		dir = snprintf(path, len, "%s/.cache/sicm", env);
+	else
+		return -1;
+
+	if (dir < 0 || (size_t) dir >= len)
+		return -1;
+
+	if (snprintf(path + dir, len - dir, "/model-%016llx", (unsigned long long) topology) >= (int) (len - dir))
+		return -1;
+
+	return dir;
+}
+
+void sicm_model_load(sicm_device_list *devs) {
+	smod_entry *entries;
+	smod_header hdr;
+	char path[4096];
+	uint64_t topology;
+	int fd;
+
+	topology = smod_topology(devs);
+	if (smod_path(topology, path, sizeof(path)) < 0)
+		return;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return;
+
+	entries = NULL;
+	if (read(fd, &hdr, sizeof(hdr)) != sizeof(hdr) || memcmp(hdr.magic, SMOD_MAGIC, 8) != 0 ||
+	    hdr.version != SMOD_VERSION || hdr.topology != topology || hdr.count > SMOD_MAX)
+		goto out;
+
+	entries = malloc(hdr.count * sizeof(smod_entry) + 1);
+	if (entries == NULL)
+		goto out;
+	if (read(fd, entries, hdr.count * sizeof(smod_entry)) != (ssize_t) (hdr.count * sizeof(smod_entry))) {
+		free(entries);
+		goto out;
+	}
+
+	pthread_mutex_lock(&smod_mutex);
+	free(smod_entries);
+	smod_entries = entries;
+	smod_count = hdr.count;
+	pthread_mutex_unlock(&smod_mutex);
+
+out:
+	close(fd);
+}
+
+void sicm_model_clear(void) {
+	pthread_mutex_lock(&smod_mutex);
+	free(smod_entries);
+	smod_entries = NULL;
+	smod_count = 0;
+	pthread_mutex_unlock(&smod_mutex);
+}
+
+static int smod_save(uint64_t topology, smod_entry *entries, size_t count) {
+	char path[4096], tmp[4096 + 32];
+	smod_header hdr;
+	int dir, fd, err;
+	char *p;
+
+	dir = smod_path(topology, path, sizeof(path));
+	if (dir < 0)
+		return -ENOENT;
+
+	// make the directories on the way
+	for(p = path + 1; p < path + dir; p++) {
+		if (*p != '/')
+			continue;
+		*p = '\0';
+		mkdir(path, 0755);
+		*p = '/';
+	}
+	path[dir] = '\0';
+	mkdir(path, 0755);
+	path[dir] = '/';
+
+	// others may be loading it, so it's replaced all at once
+	snprintf(tmp, sizeof(tmp), "%s.%d", path, (int) getpid());
+	fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0)
+		return -errno;
+
+	memcpy(hdr.magic, SMOD_MAGIC, 8);
+	hdr.version = SMOD_VERSION;
+	hdr.count = count;
+	hdr.topology = topology;
+
+	err = 0;
+	if (write(fd, &hdr, sizeof(hdr)) != sizeof(hdr) ||
+	    write(fd, entries, count * sizeof(smod_entry)) != (ssize_t) (count * sizeof(smod_entry)))
+		err = -EIO;
+	if (close(fd) != 0 && err == 0)
+		err = -EIO;
+	if (err == 0 && rename(tmp, path) != 0)
+		err = -errno;
+	if (err != 0)
+		unlink(tmp);
+
+	return err;
+}
+
+static smod_entry *smod_find(smod_entry *entries, size_t count, int initiator, sicm_device *device) {
+	size_t i;
+
+	for(i = 0; i < count; i++) {
+		if (entries[i].initiator == initiator && entries[i].tag == (int32_t) device->tag &&
+		    entries[i].node == device->node && entries[i].page_size == device->page_size)
+			return &entries[i];
+	}
+
+	return NULL;
+}
+
+typedef struct smod_latency {
+	char*			buf;
+	int			initiator;
+	int			threads;	// for the load
+	sicm_device_model*	model;
+} smod_latency;
+
+static void *smod_measure_latency(void *arg) {
+	sicm_latency_stats stats;
+	smod_latency *l;
+	void **pos;
+
+	l = arg;
+	numa_run_on_node(l->initiator);
+
+	pos = sb_chase_init(l->buf, SMOD_SIZE / 2, l->initiator + 1);
+	if (pos == NULL)
+		return NULL;
+
+	// once around to warm up the TLB and page tables
+	sb_chase(&pos, SMOD_CHASE / 4);
+	if (sb_latency(l->buf, SMOD_SIZE, &pos, SMOD_CHASE, 0, l->initiator, &stats) == 0)
+		l->model->idle_latency = stats.mean;
+
+	// a single CPU would only be sharing its time with the load
+	if (l->threads < 1)
+		return NULL;
+
+	if (sb_latency(l->buf, SMOD_SIZE, &pos, SMOD_CHASE, l->threads, l->initiator, &stats) == 0)
+		l->model->loaded_latency = stats.mean;
+
+	return NULL;
+}
+
+static int smod_measure(int initiator, sicm_device *device, sicm_device_model *model) {
+	smod_latency l;
+	pthread_t thread;
+	char *buf;
+	int cpus;
+
+	buf = sicm_device_alloc(device, SMOD_SIZE);
+	if (buf == NULL || buf == MAP_FAILED)
+		return -ENOMEM;
+
+	cpus = sb_node_cpus(initiator);
+	memset(model, 0, sizeof(sicm_device_model));
+	model->read_bandwidth = sb_stream(buf, SMOD_SIZE, SICM_BW_READ, 0, initiator, cpus, SMOD_PASSES);
+	model->write_bandwidth = sb_stream(buf, SMOD_SIZE, SICM_BW_WRITE, SICM_BW_NONTEMPORAL, initiator, cpus, SMOD_PASSES);
+
+	// the chase runs on the initiator too, with the rest of its CPUs as the load
+	l.buf = buf;
+	l.initiator = initiator;
+	l.threads = cpus - 1;
+	l.model = model;
+	if (pthread_create(&thread, NULL, smod_measure_latency, &l) == 0)
+		pthread_join(thread, NULL);
+
+	sicm_device_free(device, buf, SMOD_SIZE);
+
+	return (model->idle_latency > 0)?0:-EIO;
+}
+
+static int smod_is_numa(sicm_device *device) {
+	switch(device->tag) {
+		case SICM_DRAM:
+		case SICM_KNL_HBM:
+		case SICM_OPTANE:
+		case SICM_POWERPC_HBM:
+			return 1;
+		default:
+			return 0;
+	}
+}
+
+int sicm_device_characterize(int force) {
+	sicm_device_list devs;
+	smod_entry *entries, *known;
+	sicm_device_model model;
+	size_t count, max, nknown;
+	uint64_t topology;
+	unsigned int i;
+	int node, err;
+
+	devs = sicm_init();
+	pthread_mutex_lock(&smod_measure_mutex);
+
+	max = (numa_max_node() + 1) * devs.count;
+	entries = malloc((max + 1) * sizeof(smod_entry));
+
+	// measuring takes minutes, so sicm_get_device_model mustn't wait for it:
+	// only which pairs are known is looked at with the lock held
+	pthread_mutex_lock(&smod_mutex);
+	nknown = smod_count;
+	known = malloc((nknown + 1) * sizeof(smod_entry));
+	if (known != NULL)
+		memcpy(known, smod_entries, nknown * sizeof(smod_entry));
+	pthread_mutex_unlock(&smod_mutex);
+
+	if (entries == NULL || known == NULL) {
+		free(entries);
+		free(known);
+		pthread_mutex_unlock(&smod_measure_mutex);
+		sicm_fini();
+		return -ENOMEM;
+	}
+
+	count = 0;
+	for(node = 0; node <= numa_max_node(); node++) {
+		if (sb_node_cpus(node) == 0)
+			continue;
+		for(i = 0; i < devs.count; i++) {
+			if (!smod_is_numa(devs.devices[i]))
+				continue;
+			if (!force && smod_find(known, nknown, node, devs.devices[i]) != NULL)
+				continue;
+			// huge page sizes without reserved pages can't be measured
+			if (smod_measure(node, devs.devices[i], &model) != 0)
+				continue;
+
+			entries[count].initiator = node;
+			entries[count].tag = devs.devices[i]->tag;
+			entries[count].node = devs.devices[i]->node;
+			entries[count].page_size = devs.devices[i]->page_size;
+			entries[count].model = model;
+			count++;
+		}
+	}
+
+	free(known);
+	topology = smod_topology(&devs);
+
+	// keep the cached pairs that weren't measured again
+	pthread_mutex_lock(&smod_mutex);
+	for(i = 0; i < smod_count && count < max; i++) {
+		if (smod_find(entries, count, smod_entries[i].initiator, &(sicm_device) {
+		    .tag = smod_entries[i].tag, .node = smod_entries[i].node, .page_size = smod_entries[i].page_size }) == NULL)
+			entries[count++] = smod_entries[i];
+	}
+	free(smod_entries);
+	smod_entries = entries;
+	smod_count = count;
+
+	err = smod_save(topology, smod_entries, smod_count);
+	pthread_mutex_unlock(&smod_mutex);
+
+	pthread_mutex_unlock(&smod_measure_mutex);
+	sicm_fini();
+	return err;
+}
+
+int sicm_get_device_model(int initiator, sicm_device *device, sicm_device_model *model) {
+	smod_entry *e;
+	int err;
+
+	if (device == NULL || model == NULL)
+		return -EINVAL;
+	if (initiator < 0)
+		initiator = numa_node_of_cpu(sched_getcpu());
+
+	err = -ENOENT;
+	pthread_mutex_lock(&smod_mutex);
+	e = smod_find(smod_entries, smod_count, initiator, device);
+	if (e != NULL) {
+		*model = e->model;
+		err = 0;
+	}
+	pthread_mutex_unlock(&smod_mutex);
+
+	return err;
+}
@@ -0,0 +1,105 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "sicm_high.h"
+
+// sites that get an arena of their own before the rest are grouped
+#define PRIVATE 2
+#define SITES (PRIVATE + 3)
+#define SIZE (4 * 1024 * 1024)
+
+static size_t charged(arena_info *info) {
+	size_t i, n;
+
+	n = 0;
+	pthread_rwlock_rdlock(&extents_lock);
+	for(i = 0; i < extents->index; i++) {
+		if (extents->arr[i].arena == info) {
+			n++;
+		}
+	}
+	pthread_rwlock_unlock(&extents_lock);
+	return n;
+}
+
+// The high-level interface reads its options when it's loaded, so the test
+// runs itself again with room for PRIVATE arenas next to every group.
+int main(int argc, char **argv) {
+	sicm_device_list devs = sicm_init();
+	arena_group *old;
+	arena_info *info;
+	char buf[32];
+	void *ptrs[SITES + 1];
+	int id;
+
+	if (!getenv("SH_ARENA_LAYOUT")) {
+		snprintf(buf, sizeof(buf), "%u", devs.count * 2 + PRIVATE);
+		setenv("SH_ARENA_LAYOUT", "SHARED_SITE_ARENAS", 1);
+		setenv("SH_HOTNESS_BUCKETS", "2", 1);
+		setenv("SH_MAX_PHYSICAL_ARENAS", buf, 1);
+		execv("/proc/self/exe", argv);
+		perror("execv");
+		return 1;
+	}
+
+	// the first sites get their own arenas, and the rest share bucket 0
+	for(id = 1; id <= SITES; id++) {
+		ptrs[id] = sh_alloc(id, SIZE);
+		if (ptrs[id] == NULL) {
+			fprintf(stderr, "sh_alloc failed for site %d\n", id);
+			return 1;
+		}
+		info = arenas[id];
+		if ((id <= PRIVATE) != (info->group == NULL)) {
+			fprintf(stderr, "site %d %s grouped\n", id, info->group ? "was" : "wasn't");
+			return 1;
+		}
+		if (info->group && (info->group->bucket != 0 || info->arena != info->group->arena)) {
+			fprintf(stderr, "site %d isn't in its group's arena\n", id);
+			return 1;
+		}
+	}
+	if (arenas[SITES]->group != arenas[PRIVATE + 1]->group || arenas[SITES]->group->sites != SITES - PRIVATE) {
+		fprintf(stderr, "the grouped sites don't share one group\n");
+		return 1;
+	}
+
+	// a site that switches buckets leaves its extents to the old group
+	info = arenas[SITES];
+	old = info->group;
+	if (charged(info) == 0) {
+		fprintf(stderr, "no extents were charged to site %d\n", SITES);
+		return 1;
+	}
+	sh_move_site(SITES, old->device, 1, 0);
+	if (info->group == old || info->group->bucket != 1 || info->group->device != old->device) {
+		fprintf(stderr, "site %d didn't switch buckets\n", SITES);
+		return 1;
+	}
+	if (old->sites != SITES - PRIVATE - 1 || info->group->sites != 1) {
+		fprintf(stderr, "the groups count %zu and %zu sites\n", old->sites, info->group->sites);
+		return 1;
+	}
+	if (charged(info) != 0) {
+		fprintf(stderr, "site %d is still charged for its old group's extents\n", SITES);
+		return 1;
+	}
+	if (charged(arenas[SITES - 1]) == 0) {
+		fprintf(stderr, "site %d lost its extents\n", SITES - 1);
+		return 1;
+	}
+
+	// and is charged for what it allocates in the new one
+	sh_free(ptrs[SITES]);
+	ptrs[SITES] = sh_alloc(SITES, SIZE);
+	if (ptrs[SITES] == NULL || sicm_arena_lookup(ptrs[SITES]) != info->group->arena || charged(info) == 0) {
+		fprintf(stderr, "site %d didn't allocate from its new group\n", SITES);
+		return 1;
+	}
+
+	for(id = 1; id <= SITES; id++) {
+		sh_free(ptrs[id]);
+	}
+	sicm_fini();
+	return 0;
+}
@@ -0,0 +1,55 @@
+#include <errno.h>
+#include <numa.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sicm_low.h>
+
+#define SIZE (64 * 1024 * 1024)
+
+int main() {
+	sicm_device_list devs = sicm_init();
+	sicm_device *dev = devs.devices[0];
+	const char *isa;
+	double gbps, *matrix;
+	int op, node, nodes;
+
+	isa = sicm_bandwidth_isa();
+	if (isa == NULL || (strcmp(isa, "avx512") && strcmp(isa, "avx2") && strcmp(isa, "sse2") && strcmp(isa, "scalar"))) {
+		fprintf(stderr, "unknown instruction set: %s\n", isa ? isa : "(null)");
+		return 1;
+	}
+
+	node = sicm_numa_id(dev);
+	for(op = SICM_BW_READ; op <= SICM_BW_TRIAD; op++) {
+		if (sicm_bandwidth(dev, node, op, 0, SIZE, 0, &gbps) != 0 || gbps <= 0) {
+			fprintf(stderr, "kernel %d: sicm_bandwidth failed\n", op);
+			return 1;
+		}
+		if (sicm_bandwidth(dev, node, op, SICM_BW_NONTEMPORAL, SIZE, 2, &gbps) != 0 || gbps <= 0) {
+			fprintf(stderr, "kernel %d: non-temporal sicm_bandwidth failed\n", op);
+			return 1;
+		}
+	}
+
+	if (sicm_bandwidth(dev, node, SICM_BW_TRIAD + 1, 0, SIZE, 0, &gbps) != -EINVAL ||
+	    sicm_bandwidth(dev, node, SICM_BW_READ, 0, 64, 1, &gbps) != -EINVAL) {
+		fprintf(stderr, "bad arguments were taken\n");
+		return 1;
+	}
+
+	nodes = numa_max_node() + 1;
+	matrix = malloc(nodes * devs.count * sizeof(double));
+	if (matrix == NULL || sicm_bandwidth_matrix(SICM_BW_READ, 0, SIZE, matrix) != 0) {
+		fprintf(stderr, "sicm_bandwidth_matrix failed\n");
+		return 1;
+	}
+	if (matrix[node * devs.count] <= 0) {
+		fprintf(stderr, "node %d read nothing from its own memory\n", node);
+		return 1;
+	}
+	free(matrix);
+
+	sicm_fini();
+	return 0;
+}
@@ -0,0 +1,59 @@
+#include <stdio.h>
+#include <string.h>
+#include <sicm_low.h>
+
+#define N 1000
+#define SIZE 48
+
+int main() {
+	sicm_device_list devs = sicm_init();
+	sicm_arena arena;
+	void *ptrs[N];
+	size_t got;
+	int i, j;
+
+	arena = sicm_arena_create(0, 0, &(sicm_device_list) { .count = 1, .devices = &devs.devices[0] });
+	if (arena == NULL) {
+		fprintf(stderr, "sicm_arena_create failed\n");
+		return 1;
+	}
+
+	for(j = 0; j < 2; j++) {
+		got = sicm_arena_alloc_batch(arena, SIZE, N, ptrs);
+		if (got != N) {
+			fprintf(stderr, "only allocated %zu of %d objects\n", got, N);
+			return 1;
+		}
+
+		for(i = 0; i < N; i++) {
+			if (sicm_arena_lookup(ptrs[i]) != arena) {
+				fprintf(stderr, "object %d is not in the arena\n", i);
+				return 1;
+			}
+			memset(ptrs[i], i, SIZE);
+		}
+
+		for(i = 0; i < N; i++) {
+			if (((char *) ptrs[i])[0] != (char) i || ((char *) ptrs[i])[SIZE - 1] != (char) i) {
+				fprintf(stderr, "object %d overlaps another one\n", i);
+				return 1;
+			}
+		}
+
+		// NULL entries are skipped
+		ptrs[N / 2] = NULL;
+		if (j == 0)
+			sicm_free_batch(ptrs, N);
+		else
+			sicm_free_batch_sized(ptrs, N, SIZE);
+	}
+
+	// objects that aren't from an arena can be mixed in
+	ptrs[0] = sicm_alloc(SIZE);
+	ptrs[1] = sicm_arena_alloc(arena, SIZE);
+	sicm_free_batch(ptrs, 2);
+
+	sicm_arena_destroy(arena);
+	sicm_fini();
+	return 0;
+}
@@ -0,0 +1,147 @@
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sicm_low.h>
+
+#define THREADS 4
+#define N 1024
+#define SIZE 48
+#define REGION (THREADS * N * SIZE * 4)
+
+static sicm_arena arena;
+static char *bufs[THREADS][N];
+
+static void *worker(void *arg) {
+	intptr_t t;
+	int i;
+
+	t = (intptr_t) arg;
+	for(i = 0; i < N; i++) {
+		bufs[t][i] = sicm_arena_alloc(arena, SIZE);
+		if (bufs[t][i] == NULL || (uintptr_t) bufs[t][i] % 16 != 0)
+			return (void *) 1;
+		memset(bufs[t][i], (int) t + 1, SIZE);
+	}
+
+	return NULL;
+}
+
+// every thread allocates its objects, none of them overlap
+static int run_threads(int round) {
+	pthread_t threads[THREADS];
+	void *ret;
+	intptr_t t;
+	int i, j, err;
+
+	err = 0;
+	for(t = 0; t < THREADS; t++)
+		pthread_create(&threads[t], NULL, worker, (void *) t);
+	for(t = 0; t < THREADS; t++) {
+		pthread_join(threads[t], &ret);
+		if (ret != NULL) {
+			fprintf(stderr, "round %d: thread %d couldn't allocate\n", round, (int) t);
+			err = 1;
+		}
+	}
+
+	for(t = 0; t < THREADS && !err; t++) {
+		for(i = 0; i < N; i++) {
+			if (sicm_arena_lookup(bufs[t][i]) != arena) {
+				fprintf(stderr, "round %d: object isn't in the arena\n", round);
+				return 1;
+			}
+			for(j = 0; j < SIZE; j++) {
+				if (bufs[t][i][j] != t + 1) {
+					fprintf(stderr, "round %d: objects overlap\n", round);
+					return 1;
+				}
+			}
+		}
+	}
+
+	return err;
+}
+
+int main() {
+	sicm_device_list devs = sicm_init();
+	sicm_arena other;
+	char *p, *q, *r, *s;
+	int round;
+
+	arena = sicm_arena_create(REGION, SICM_ARENA_BUMP, &(sicm_device_list) { .count = 1, .devices = &devs.devices[0] });
+	if (arena == NULL) {
+		fprintf(stderr, "sicm_arena_create failed\n");
+		return 1;
+	}
+
+	for(round = 0; round < 2; round++) {
+		if (run_threads(round) != 0)
+			return 1;
+
+		// freeing does nothing, but mustn't crash
+		sicm_free(bufs[0][0]);
+		sicm_free_batch((void **) bufs[1], N);
+
+		if (sicm_arena_reset(arena, round == 0) != 0) {
+			fprintf(stderr, "sicm_arena_reset failed\n");
+			return 1;
+		}
+	}
+
+	p = sicm_arena_alloc_aligned(arena, 100, 4096);
+	if (p == NULL || (uintptr_t) p % 4096 != 0) {
+		fprintf(stderr, "aligned allocation failed\n");
+		return 1;
+	}
+	strcpy(p, "bump");
+	q = sicm_arena_realloc(arena, p, 200);
+	if (q != p || strcmp(q, "bump") != 0) {
+		fprintf(stderr, "realloc didn't grow the last object in place\n");
+		return 1;
+	}
+
+	// an object that isn't the last one is copied, without what follows it
+	r = sicm_arena_alloc(arena, 64);
+	if (r == NULL) {
+		fprintf(stderr, "allocation failed\n");
+		return 1;
+	}
+	memset(r, 'r', 64);
+	q = sicm_arena_realloc(arena, p, 400);
+	if (q == NULL || q == p || strcmp(q, "bump") != 0 || r[0] != 'r' || r[63] != 'r') {
+		fprintf(stderr, "realloc didn't copy the object\n");
+		return 1;
+	}
+
+	// with their own arena, these leave the object alone
+	sicm_arena_free_sized(arena, r, 64);
+	if (sicm_arena_realloc_in_place(arena, r, 128) != 0 || r[0] != 'r' || r[63] != 'r') {
+		fprintf(stderr, "bump object was resized or freed\n");
+		return 1;
+	}
+
+	// moving an object into a normal arena copies it, the old one stays
+	other = sicm_arena_create(0, 0, &(sicm_device_list) { .count = 1, .devices = &devs.devices[0] });
+	if (other == NULL) {
+		fprintf(stderr, "sicm_arena_create failed\n");
+		return 1;
+	}
+	s = sicm_arena_realloc(other, r, 4096);
+	if (s == NULL || sicm_arena_lookup(s) != other || s[0] != 'r' || s[63] != 'r' || r[0] != 'r') {
+		fprintf(stderr, "realloc didn't move the object to the other arena\n");
+		return 1;
+	}
+	sicm_free(s);
+	sicm_arena_destroy(other);
+
+	// the region runs out instead of growing
+	if (sicm_arena_alloc(arena, REGION * 2) != NULL) {
+		fprintf(stderr, "allocated more than the region\n");
+		return 1;
+	}
+
+	sicm_arena_destroy(arena);
+	sicm_fini();
+	return 0;
+}
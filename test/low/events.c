@@ -0,0 +1,132 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <sicm_low.h>
+
+#define SIZE (8 * 1024 * 1024)
+#define MAX_EVENTS 1024
+
+static int cookie;
+static size_t nevents, nalloc;
+static char *obj;
+static pthread_t allocator;
+static int wrong_thread;
+
+static void count_event(const sicm_extent_event *ev) {
+	nevents++;
+	if (ev->cookie != &cookie)
+		fprintf(stderr, "event with the wrong cookie\n");
+	if (ev->type == SICM_EXTENT_ALLOC) {
+		nalloc++;
+		if (!pthread_equal(pthread_self(), allocator))
+			wrong_thread = 1;
+	}
+}
+
+// the events of an allocation are sent by its thread before it returns,
+// which is what lets callers charge new extents to what they allocate for
+static void *alloc_thread(void *arg) {
+	size_t before;
+	char *p;
+
+	allocator = pthread_self();
+	before = nalloc;
+	p = sicm_arena_alloc(arg, 2 * SIZE);
+	if (p == NULL || nalloc == before)
+		return (void *) 1;
+
+	sicm_free(p);
+	return NULL;
+}
+
+int main() {
+	sicm_device_list devs = sicm_init();
+	sicm_extent_event events[MAX_EVENTS];
+	sicm_event_ring *ring;
+	sicm_arena sa;
+	size_t n, i, dalloc;
+	pthread_t thread;
+	void *ret;
+	int covered;
+
+	ring = sicm_event_ring_create(MAX_EVENTS);
+	if (ring == NULL) {
+		fprintf(stderr, "sicm_event_ring_create failed\n");
+		return 1;
+	}
+
+	sa = sicm_arena_create(0, 0, &(sicm_device_list) { .count = 1, .devices = &devs.devices[0] });
+	if (sa == NULL) {
+		fprintf(stderr, "sicm_arena_create failed\n");
+		return 1;
+	}
+
+	if (sicm_arena_set_events(sa, count_event, ring, &cookie) != 0 || sicm_arena_get_cookie(sa) != &cookie) {
+		fprintf(stderr, "sicm_arena_set_events failed\n");
+		return 1;
+	}
+
+	// bigger than anything the arena has yet, so it needs a new extent
+	allocator = pthread_self();
+	obj = sicm_arena_alloc(sa, SIZE);
+	if (obj == NULL) {
+		fprintf(stderr, "sicm_arena_alloc failed\n");
+		return 1;
+	}
+	if (nalloc == 0) {
+		fprintf(stderr, "no extent was reported\n");
+		return 1;
+	}
+
+	n = sicm_event_ring_read(ring, events, MAX_EVENTS);
+	if (n != nevents) {
+		fprintf(stderr, "queued %zu events, sent %zu\n", n, nevents);
+		return 1;
+	}
+
+	covered = 0;
+	for(i = 0; i < n; i++) {
+		if (events[i].arena != sa || events[i].cookie != &cookie) {
+			fprintf(stderr, "queued event of the wrong arena\n");
+			return 1;
+		}
+		if (events[i].type == SICM_EXTENT_ALLOC && (char *) events[i].start <= obj && obj + SIZE <= (char *) events[i].end)
+			covered = 1;
+	}
+	if (!covered) {
+		fprintf(stderr, "no extent holds the object\n");
+		return 1;
+	}
+
+	// the queue is empty now
+	if (sicm_event_ring_read(ring, events, MAX_EVENTS) != 0) {
+		fprintf(stderr, "events were read twice\n");
+		return 1;
+	}
+
+	// same from another thread, with an object that doesn't fit either
+	pthread_create(&thread, NULL, alloc_thread, sa);
+	pthread_join(thread, &ret);
+	if (ret != NULL || wrong_thread) {
+		fprintf(stderr, "extents weren't reported by the allocating thread\n");
+		return 1;
+	}
+
+	sicm_free(obj);
+	sicm_arena_destroy(sa);
+
+	// destroying the arena gives back all of its extents
+	dalloc = 0;
+	while((n = sicm_event_ring_read(ring, events, MAX_EVENTS)) > 0) {
+		for(i = 0; i < n; i++)
+			if (events[i].type == SICM_EXTENT_DALLOC)
+				dalloc++;
+	}
+	if (dalloc == 0 || sicm_event_ring_dropped(ring) != 0) {
+		fprintf(stderr, "extents weren't given back\n");
+		return 1;
+	}
+
+	sicm_event_ring_free(ring);
+	sicm_fini();
+	return 0;
+}
@@ -0,0 +1,112 @@
+#include <stdio.h>
+
+#include "sicm_extent_arr.h"
+
+#define N 1000
+
+int main() {
+	extent_arr *a;
+	extent_info *e;
+	char *base;
+	size_t i;
+
+	a = extent_arr_init();
+	base = (char *) 0x100000;
+
+	// insert out of order: extent i covers [base + 4096 * 2i, base + 4096 * (2i + 1))
+	for(i = 0; i < N; i++) {
+		size_t slot = (i * 7) % N;
+		extent_arr_insert(a, base + 4096 * 2 * slot, base + 4096 * (2 * slot + 1), (void *) (slot + 1));
+	}
+
+	for(i = 1; i < a->index; i++) {
+		if (a->arr[i - 1].start >= a->arr[i].start) {
+			fprintf(stderr, "extent array is not sorted at %zu\n", i);
+			return -1;
+		}
+	}
+
+	for(i = 0; i < N; i++) {
+		e = extent_arr_lookup(a, base + 4096 * 2 * i + 100);
+		if (e == NULL || e->arena != (void *) (i + 1)) {
+			fprintf(stderr, "lookup of extent %zu failed\n", i);
+			return -1;
+		}
+
+		// the gaps between the extents don't belong to anything
+		if (extent_arr_lookup(a, base + 4096 * (2 * i + 1)) != NULL) {
+			fprintf(stderr, "lookup past the end of extent %zu succeeded\n", i);
+			return -1;
+		}
+	}
+
+	if (extent_arr_lookup(a, base - 1) != NULL) {
+		fprintf(stderr, "lookup before the first extent succeeded\n");
+		return -1;
+	}
+
+	// delete every other extent
+	for(i = 0; i < N; i += 2) {
+		extent_arr_delete(a, base + 4096 * 2 * i);
+	}
+
+	if (a->index != N / 2) {
+		fprintf(stderr, "expected %d extents, found %zu\n", N / 2, a->index);
+		return -1;
+	}
+
+	for(i = 0; i < N; i++) {
+		e = extent_arr_lookup(a, base + 4096 * 2 * i);
+		if ((i % 2 == 0) != (e == NULL)) {
+			fprintf(stderr, "extent %zu in the wrong state after deletion\n", i);
+			return -1;
+		}
+	}
+
+	// split the remaining extents in half and merge them back together
+	for(i = 1; i < N; i += 2) {
+		if (extent_arr_split(a, base + 4096 * 2 * i, base + 4096 * 2 * i + 2048) != 0) {
+			fprintf(stderr, "split of extent %zu failed\n", i);
+			return -1;
+		}
+	}
+
+	if (a->index != N) {
+		fprintf(stderr, "expected %d extents after splitting, found %zu\n", N, a->index);
+		return -1;
+	}
+
+	for(i = 1; i < N; i += 2) {
+		e = extent_arr_lookup(a, base + 4096 * 2 * i + 3000);
+		if (e == NULL || e->start != base + 4096 * 2 * i + 2048 || e->arena != (void *) (i + 1)) {
+			fprintf(stderr, "second half of extent %zu is wrong\n", i);
+			return -1;
+		}
+	}
+
+	if (extent_arr_split(a, base + 4096 * 2 + 100, base + 4096 * 2 + 200) == 0) {
+		fprintf(stderr, "split of an extent that doesn't exist succeeded\n");
+		return -1;
+	}
+
+	// extents that aren't adjacent can't be merged
+	if (extent_arr_merge(a, base + 4096 * 2, base + 4096 * 6) == 0) {
+		fprintf(stderr, "merge of extents that aren't adjacent succeeded\n");
+		return -1;
+	}
+
+	for(i = 1; i < N; i += 2) {
+		if (extent_arr_merge(a, base + 4096 * 2 * i, base + 4096 * 2 * i + 2048) != 0) {
+			fprintf(stderr, "merge of extent %zu failed\n", i);
+			return -1;
+		}
+	}
+
+	if (a->index != N / 2) {
+		fprintf(stderr, "expected %d extents after merging, found %zu\n", N / 2, a->index);
+		return -1;
+	}
+
+	extent_arr_free(a);
+	return 0;
+}
@@ -0,0 +1,88 @@
+#include <stdio.h>
+#include <string.h>
+#include <sicm_low.h>
+
+#define N 32
+#define SIZE (1024 * 1024)
+#define BUDGET (16 * SIZE)
+
+int main() {
+	sicm_device_list devs = sicm_init();
+	sicm_device *dev;
+	sicm_device *chain[2];
+	size_t budgets[2];
+	sicm_arena arena;
+	char *bufs[N];
+	int i, failed;
+
+	dev = devs.devices[0];
+	arena = sicm_arena_create(0, 0, &(sicm_device_list) { .count = 1, .devices = &dev });
+	if (arena == NULL) {
+		fprintf(stderr, "sicm_arena_create failed\n");
+		return 1;
+	}
+	sicm_arena_set_decay(arena, 0, 0);
+
+	// a single device with a budget runs out
+	budgets[0] = BUDGET;
+	if (sicm_arena_set_fallback(arena, &(sicm_device_list) { .count = 1, .devices = &dev }, budgets) != 0) {
+		fprintf(stderr, "sicm_arena_set_fallback failed\n");
+		return 1;
+	}
+
+	failed = 0;
+	for(i = 0; i < N; i++) {
+		bufs[i] = sicm_arena_alloc(arena, SIZE);
+		if (bufs[i] == NULL)
+			failed++;
+	}
+
+	if (failed == 0 || sicm_arena_device_size(arena, dev) > BUDGET) {
+		fprintf(stderr, "%zu bytes on a device with a budget of %d\n", sicm_arena_device_size(arena, dev), BUDGET);
+		return 1;
+	}
+
+	for(i = 0; i < N; i++)
+		sicm_free(bufs[i]);
+
+	// with a second device nothing fails, and nothing is lost when moving between them
+	chain[0] = dev;
+	chain[1] = dev;
+	budgets[1] = 0;
+	if (sicm_arena_set_fallback(arena, &(sicm_device_list) { .count = 2, .devices = chain }, budgets) != 0) {
+		fprintf(stderr, "sicm_arena_set_fallback with two devices failed\n");
+		return 1;
+	}
+
+	for(i = 0; i < N; i++) {
+		bufs[i] = sicm_arena_alloc(arena, SIZE);
+		if (bufs[i] == NULL) {
+			fprintf(stderr, "allocation %d failed with a device without a budget\n", i);
+			return 1;
+		}
+		memset(bufs[i], i, SIZE);
+	}
+
+	if (sicm_arena_device_size(arena, dev) < N * SIZE) {
+		fprintf(stderr, "only %zu bytes are accounted for\n", sicm_arena_device_size(arena, dev));
+		return 1;
+	}
+
+	for(i = 0; i < N / 2; i++) {
+		sicm_free(bufs[i]);
+		bufs[i] = NULL;
+	}
+	sicm_arena_promote(arena);
+
+	for(i = N / 2; i < N; i++) {
+		if (bufs[i][0] != (char) i || bufs[i][SIZE - 1] != (char) i) {
+			fprintf(stderr, "buffer %d is corrupted\n", i);
+			return 1;
+		}
+		sicm_free(bufs[i]);
+	}
+
+	sicm_arena_destroy(arena);
+	sicm_fini();
+	return 0;
+}
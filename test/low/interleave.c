@@ -0,0 +1,88 @@
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <sicm_low.h>
+
+#define N 64
+#define SIZE (1024 * 1024)
+
+int main() {
+	sicm_device_list devs = sicm_init();
+	sicm_device_list numa;
+	sicm_device *dev;
+	sicm_arena arena, strict;
+	unsigned weights[64];
+	char *bufs[N];
+	int i, err;
+
+	// one device per NUMA node, with the same page size
+	numa.count = 0;
+	numa.devices = (sicm_device *[64]) { NULL };
+	dev = devs.devices[0];
+	for(i = 0; i < devs.count && numa.count < 64; i++) {
+		if (devs.devices[i]->tag == dev->tag && sicm_device_page_size(devs.devices[i]) == sicm_device_page_size(dev)) {
+			numa.devices[numa.count] = devs.devices[i];
+			weights[numa.count] = numa.count + 1;
+			numa.count++;
+		}
+	}
+
+	arena = sicm_arena_create(0, SICM_ALLOC_INTERLEAVE, &numa);
+	if (arena == NULL) {
+		fprintf(stderr, "sicm_arena_create failed\n");
+		return 1;
+	}
+
+	for(i = 0; i < N / 2; i++) {
+		bufs[i] = sicm_arena_alloc(arena, SIZE);
+		if (bufs[i] == NULL) {
+			fprintf(stderr, "allocation %d failed\n", i);
+			return 1;
+		}
+		memset(bufs[i], i, SIZE);
+	}
+
+	err = sicm_arena_set_weights(arena, &numa, weights);
+	if (err != 0) {
+		fprintf(stderr, "sicm_arena_set_weights failed: %d\n", err);
+		return 1;
+	}
+
+	// new extents follow the weights too
+	for(i = N / 2; i < N; i++) {
+		bufs[i] = sicm_arena_alloc(arena, SIZE);
+		if (bufs[i] == NULL) {
+			fprintf(stderr, "allocation %d failed\n", i);
+			return 1;
+		}
+		memset(bufs[i], i, SIZE);
+	}
+
+	for(i = 0; i < N; i++) {
+		if (bufs[i][0] != (char) i || bufs[i][SIZE - 1] != (char) i) {
+			fprintf(stderr, "buffer %d is corrupted\n", i);
+			return 1;
+		}
+	}
+
+	weights[0] = 0;
+	if (sicm_arena_set_weights(arena, &numa, weights) != -EINVAL) {
+		fprintf(stderr, "a weight of 0 was accepted\n");
+		return 1;
+	}
+
+	strict = sicm_arena_create(0, SICM_ALLOC_STRICT, &numa);
+	weights[0] = 1;
+	if (strict == NULL || sicm_arena_set_weights(strict, &numa, weights) != -EINVAL) {
+		fprintf(stderr, "weights were accepted for an arena that isn't interleaved\n");
+		return 1;
+	}
+	sicm_arena_destroy(strict);
+
+	for(i = 0; i < N; i++)
+		sicm_free(bufs[i]);
+
+	sicm_arena_destroy(arena);
+	sicm_fini();
+	return 0;
+}
@@ -0,0 +1,41 @@
+#include <stdio.h>
+#include <sicm_low.h>
+
+#define SIZE (64 * 1024 * 1024)
+#define ACCESSES (256 * 1024)
+
+int main() {
+	sicm_device_list devs = sicm_init();
+	sicm_latency_stats res[2];
+	int i;
+
+	if (sicm_latency_curve(devs.devices[0], SIZE, ACCESSES, 1, res) != 0) {
+		fprintf(stderr, "sicm_latency_curve failed\n");
+		return 1;
+	}
+
+	for(i = 0; i < 2; i++) {
+		if (res[i].mean <= 0 || res[i].min > res[i].p50 || res[i].p50 > res[i].p90 ||
+		    res[i].p90 > res[i].p99 || res[i].p99 > res[i].max) {
+			fprintf(stderr, "%d load threads: bad percentiles\n", i);
+			return 1;
+		}
+		if (res[i].page_size < sicm_device_page_size(devs.devices[0])) {
+			fprintf(stderr, "%d load threads: measured smaller pages than the device's\n", i);
+			return 1;
+		}
+	}
+
+	if (res[0].load_bandwidth != 0 || res[1].load_bandwidth <= 0) {
+		fprintf(stderr, "load bandwidth: %f GB/s without load, %f GB/s with\n", res[0].load_bandwidth, res[1].load_bandwidth);
+		return 1;
+	}
+
+	if (sicm_latency_chase(devs.devices[0], SIZE, ACCESSES, 0, res) != 0 || res[0].mean <= 0) {
+		fprintf(stderr, "sicm_latency_chase failed\n");
+		return 1;
+	}
+
+	sicm_fini();
+	return 0;
+}
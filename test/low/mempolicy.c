@@ -0,0 +1,77 @@
+#include <numa.h>
+#include <numaif.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sicm_low.h>
+
+#define SIZE (16 * 1024 * 1024)
+
+// Extents are bound with mbind, so allocating them leaves the thread's
+// memory policy alone, and their pages go where the arena says anyway.
+int main() {
+	sicm_device_list devs = sicm_init();
+	unsigned long mask, got;
+	sicm_device *dev;
+	sicm_arena arena;
+	int i, mode, node, other;
+	size_t off;
+	char *buf;
+
+	dev = devs.devices[0];
+	node = sicm_numa_id(dev);
+
+	// prefer another node than the arena's, if there is one
+	other = node;
+	for(i = 0; i <= numa_max_node() && i < (int) (8 * sizeof(mask)); i++) {
+		if (i != node && numa_node_size64(i, NULL) > 0) {
+			other = i;
+			break;
+		}
+	}
+	mask = 1UL << other;
+	if (set_mempolicy(MPOL_PREFERRED, &mask, 8 * sizeof(mask)) != 0) {
+		perror("set_mempolicy");
+		return 1;
+	}
+
+	arena = sicm_arena_create(0, 0, &(sicm_device_list) { .count = 1, .devices = &dev });
+	if (arena == NULL) {
+		fprintf(stderr, "sicm_arena_create failed\n");
+		return 1;
+	}
+
+	// bigger than anything the arena has yet, so it needs a new extent
+	buf = sicm_arena_alloc(arena, SIZE);
+	if (buf == NULL) {
+		fprintf(stderr, "sicm_arena_alloc failed\n");
+		return 1;
+	}
+	memset(buf, 1, SIZE);
+
+	got = 0;
+	if (get_mempolicy(&mode, &got, 8 * sizeof(got), NULL, 0) != 0) {
+		perror("get_mempolicy");
+		return 1;
+	}
+	if (mode != MPOL_PREFERRED || got != mask) {
+		fprintf(stderr, "the thread's policy changed to %d, nodes %#lx\n", mode, got);
+		return 1;
+	}
+
+	for(off = 0; off < SIZE; off += sysconf(_SC_PAGESIZE)) {
+		if (get_mempolicy(&i, NULL, 0, buf + off, MPOL_F_NODE | MPOL_F_ADDR) != 0) {
+			perror("get_mempolicy");
+			return 1;
+		}
+		if (i != node) {
+			fprintf(stderr, "page at %zu is on node %d instead of %d\n", off, i, node);
+			return 1;
+		}
+	}
+
+	sicm_free(buf);
+	sicm_arena_destroy(arena);
+	sicm_fini();
+	return 0;
+}
@@ -0,0 +1,103 @@
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <sicm_low.h>
+
+#define N 256
+#define SIZE (64 * 1024)
+
+int main() {
+	sicm_device_list devs = sicm_init();
+	sicm_device *src, *dst;
+	sicm_arena arena;
+	sicm_migration *m;
+	char *bufs[N], *extra;
+	size_t done, total;
+	int i, err;
+
+	src = devs.devices[0];
+	dst = devs.devices[0];
+	for(i = 0; i < devs.count; i++) {
+		if (sicm_device_page_size(devs.devices[i]) == sicm_device_page_size(src) && sicm_numa_id(devs.devices[i]) != sicm_numa_id(src)) {
+			dst = devs.devices[i];
+			break;
+		}
+	}
+
+	arena = sicm_arena_create(0, 0, &(sicm_device_list) { .count = 1, .devices = &src });
+	if (arena == NULL) {
+		fprintf(stderr, "sicm_arena_create failed\n");
+		return 1;
+	}
+
+	for(i = 0; i < N; i++) {
+		bufs[i] = sicm_arena_alloc(arena, SIZE);
+		if (bufs[i] == NULL) {
+			fprintf(stderr, "allocation %d failed\n", i);
+			return 1;
+		}
+		memset(bufs[i], i, SIZE);
+	}
+
+	m = sicm_arena_set_device_list_async(arena, &(sicm_device_list) { .count = 1, .devices = &dst });
+	if (m == NULL) {
+		fprintf(stderr, "sicm_arena_set_device_list_async failed\n");
+		return 1;
+	}
+
+	// the arena has to stay usable while its memory moves
+	extra = sicm_arena_alloc(arena, SIZE);
+	if (extra == NULL || sicm_arena_lookup(extra) != arena) {
+		fprintf(stderr, "allocation during the migration failed\n");
+		return 1;
+	}
+	sicm_free(extra);
+
+	err = sicm_migration_wait(m);
+	if (err != 0) {
+		fprintf(stderr, "migration failed: %d\n", err);
+		return 1;
+	}
+
+	if (sicm_migration_poll(m, &done, &total) != 1 || done != total) {
+		fprintf(stderr, "finished migration moved %zu of %zu bytes\n", done, total);
+		return 1;
+	}
+	sicm_migration_free(m);
+
+	for(i = 0; i < N; i++) {
+		if (bufs[i][0] != (char) i || bufs[i][SIZE - 1] != (char) i) {
+			fprintf(stderr, "buffer %d is corrupted\n", i);
+			return 1;
+		}
+	}
+
+	// a cancelled migration either finished anyway or says it was cancelled
+	m = sicm_arena_set_device_list_async(arena, &(sicm_device_list) { .count = 1, .devices = &src });
+	sicm_migration_cancel(m);
+	err = sicm_migration_wait(m);
+	if (err != 0 && err != -ECANCELED) {
+		fprintf(stderr, "cancelled migration failed: %d\n", err);
+		return 1;
+	}
+	sicm_migration_free(m);
+
+	// changing the page size copies the memory, which can't happen while the arena is in use
+	for(i = 0; i < devs.count; i++) {
+		if (sicm_device_page_size(devs.devices[i]) != sicm_device_page_size(src) &&
+		    sicm_arena_set_device_list_async(arena, &(sicm_device_list) { .count = 1, .devices = &devs.devices[i] }) != NULL) {
+			fprintf(stderr, "a migration to another page size was started\n");
+			return 1;
+		}
+	}
+
+	// handles can be dropped right away, and destroying the arena stops the migration
+	sicm_migration_free(sicm_arena_set_device_list_async(arena, &(sicm_device_list) { .count = 1, .devices = &dst }));
+
+	for(i = 0; i < N; i++)
+		sicm_free(bufs[i]);
+
+	sicm_arena_destroy(arena);
+	sicm_fini();
+	return 0;
+}
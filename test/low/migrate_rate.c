@@ -0,0 +1,95 @@
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <sicm_low.h>
+
+#define SIZE (8 * 1024 * 1024)
+#define RATE (32 * 1024 * 1024)
+
+static sicm_arena filled_arena(sicm_device *dev, char **buf) {
+	sicm_arena arena;
+
+	arena = sicm_arena_create(0, 0, &(sicm_device_list) { .count = 1, .devices = &dev });
+	if (arena == NULL)
+		return NULL;
+
+	*buf = sicm_arena_alloc(arena, SIZE);
+	if (*buf == NULL)
+		return NULL;
+	memset(*buf, 1, SIZE);
+
+	return arena;
+}
+
+int main() {
+	sicm_device_list devs = sicm_init();
+	sicm_device *dev;
+	sicm_arena low, high;
+	sicm_migration *ml, *mh;
+	char *lbuf, *hbuf;
+	struct timespec start, end;
+	double elapsed;
+
+	dev = devs.devices[0];
+	low = filled_arena(dev, &lbuf);
+	high = filled_arena(dev, &hbuf);
+	if (low == NULL || high == NULL) {
+		fprintf(stderr, "could not set up the arenas\n");
+		return 1;
+	}
+
+	sicm_set_migration_rate(RATE);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	ml = sicm_arena_set_device_list_async(low, &(sicm_device_list) { .count = 1, .devices = &dev });
+	mh = sicm_arena_set_device_list_async(high, &(sicm_device_list) { .count = 1, .devices = &dev });
+	if (ml == NULL || mh == NULL) {
+		fprintf(stderr, "sicm_arena_set_device_list_async failed\n");
+		return 1;
+	}
+	sicm_migration_set_priority(mh, 1);
+
+	if (sicm_migration_pending() < SIZE) {
+		fprintf(stderr, "only %zu bytes pending right after starting\n", sicm_migration_pending());
+		return 1;
+	}
+
+	// the later migration has the higher priority, so it has to finish first
+	if (sicm_migration_wait(mh) != 0) {
+		fprintf(stderr, "high priority migration failed\n");
+		return 1;
+	}
+	if (sicm_migration_poll(ml, NULL, NULL) != 0) {
+		fprintf(stderr, "low priority migration finished first\n");
+		return 1;
+	}
+
+	if (sicm_migration_wait(ml) != 0) {
+		fprintf(stderr, "low priority migration failed\n");
+		return 1;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	// at most one chunk goes before the limit kicks in
+	elapsed = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+	if (elapsed < (2.0 * SIZE) / RATE / 2) {
+		fprintf(stderr, "moved %d bytes in %.3f s with a limit of %d bytes/s\n", 2 * SIZE, elapsed, RATE);
+		return 1;
+	}
+
+	if (sicm_migration_pending() != 0) {
+		fprintf(stderr, "%zu bytes pending after the migrations finished\n", sicm_migration_pending());
+		return 1;
+	}
+
+	sicm_migration_free(ml);
+	sicm_migration_free(mh);
+	sicm_set_migration_rate(0);
+
+	sicm_free(lbuf);
+	sicm_free(hbuf);
+	sicm_arena_destroy(low);
+	sicm_arena_destroy(high);
+	sicm_fini();
+	return 0;
+}
@@ -0,0 +1,79 @@
+#include <dirent.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sicm_low.h>
+
+int main() {
+	char dir[] = "/tmp/sicm_model_XXXXXX";
+	char path[256];
+	sicm_device_list devs;
+	sicm_device_model model;
+	struct dirent *entry;
+	DIR *d;
+	int found;
+
+	if (mkdtemp(dir) == NULL)
+		return 1;
+	setenv("SICM_MODEL_CACHE", dir, 1);
+
+	devs = sicm_init();
+	if (sicm_get_device_model(-1, devs.devices[0], &model) != -ENOENT) {
+		fprintf(stderr, "the device was measured before sicm_device_characterize\n");
+		return 1;
+	}
+
+	if (sicm_device_characterize(0) != 0) {
+		fprintf(stderr, "sicm_device_characterize failed\n");
+		return 1;
+	}
+
+	if (sicm_get_device_model(-1, devs.devices[0], &model) != 0) {
+		fprintf(stderr, "the device wasn't measured\n");
+		return 1;
+	}
+	if (model.idle_latency <= 0 || model.read_bandwidth <= 0 || model.write_bandwidth <= 0) {
+		fprintf(stderr, "bad measurements: %f ns, %f GB/s read, %f GB/s write\n",
+			model.idle_latency, model.read_bandwidth, model.write_bandwidth);
+		return 1;
+	}
+
+	// the results were saved, and are there again after sicm_init
+	found = 0;
+	d = opendir(dir);
+	while (d != NULL && (entry = readdir(d)) != NULL) {
+		if (strncmp(entry->d_name, "model-", 6) != 0)
+			continue;
+		found = 1;
+		snprintf(path, sizeof(path), "%s/%s", dir, entry->d_name);
+	}
+	if (d != NULL)
+		closedir(d);
+	if (!found) {
+		fprintf(stderr, "no cache file was written\n");
+		return 1;
+	}
+
+	// sicm_fini forgets the models, so they can only come from the file
+	sicm_fini();
+	devs = sicm_init();
+	if (sicm_get_device_model(-1, devs.devices[0], &model) != 0) {
+		fprintf(stderr, "the cache wasn't loaded\n");
+		return 1;
+	}
+
+	// and without the file there's nothing
+	unlink(path);
+	sicm_fini();
+	devs = sicm_init();
+	if (sicm_get_device_model(-1, devs.devices[0], &model) != -ENOENT) {
+		fprintf(stderr, "the models outlived sicm_fini\n");
+		return 1;
+	}
+
+	sicm_fini();
+	rmdir(dir);
+	return 0;
+}
@@ -0,0 +1,57 @@
+#include <stdio.h>
+#include <string.h>
+#include <sicm_low.h>
+
+// big enough for the pages to be spread over several threads
+#define SIZE (96 * 1024 * 1024)
+
+int main() {
+	sicm_device_list devs = sicm_init();
+	sicm_device *src, *dst;
+	char *buf;
+	size_t i;
+	int threads;
+
+	src = devs.devices[0];
+	dst = devs.devices[0];
+	for(i = 0; i < devs.count; i++) {
+		if (sicm_device_page_size(devs.devices[i]) == sicm_device_page_size(src) && sicm_numa_id(devs.devices[i]) != sicm_numa_id(src)) {
+			dst = devs.devices[i];
+			break;
+		}
+	}
+
+	if (sicm_set_migration_threads(0) == 0) {
+		fprintf(stderr, "sicm_set_migration_threads accepted 0 threads\n");
+		return 1;
+	}
+
+	buf = sicm_device_alloc(src, SIZE);
+	if (buf == NULL) {
+		fprintf(stderr, "sicm_device_alloc failed\n");
+		return 1;
+	}
+
+	// only touch part of the buffer, the rest has to follow the policy
+	for(i = 0; i < SIZE / 2; i += 4096)
+		buf[i] = (char) (i / 4096);
+
+	for(threads = 1; threads <= 4; threads *= 2) {
+		sicm_set_migration_threads(threads);
+		if (sicm_move(src, dst, buf, SIZE) != 0 || sicm_move(dst, src, buf, SIZE) != 0) {
+			fprintf(stderr, "sicm_move with %d threads failed\n", threads);
+			return 1;
+		}
+
+		for(i = 0; i < SIZE / 2; i += 4096) {
+			if (buf[i] != (char) (i / 4096)) {
+				fprintf(stderr, "page %zu is corrupted after moving with %d threads\n", i / 4096, threads);
+				return 1;
+			}
+		}
+	}
+
+	sicm_device_free(src, buf, SIZE);
+	sicm_fini();
+	return 0;
+}
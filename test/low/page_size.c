@@ -0,0 +1,121 @@
+#include <stdio.h>
+#include <string.h>
+#include <sicm_low.h>
+
+#define N 64
+#define SIZE (256 * 1024)
+#define BIG (4 * 1024 * 1024)
+
+// data has to survive moving the arena between devices with different page sizes
+static int check(char **bufs, const char *when) {
+	int i;
+	size_t j;
+
+	for(i = 0; i < N; i++) {
+		for(j = 0; j < SIZE; j += 4096) {
+			if (bufs[i][j] != (char) (i + j / 4096)) {
+				fprintf(stderr, "buffer %d is corrupted %s\n", i, when);
+				return 1;
+			}
+		}
+	}
+
+	return 0;
+}
+
+int main() {
+	sicm_device_list devs = sicm_init();
+	sicm_device *normal, *huge;
+	sicm_arena arena;
+	char *bufs[N];
+	int i, err;
+	size_t j;
+
+	normal = devs.devices[0];
+	huge = NULL;
+	for(i = 0; i < devs.count; i++) {
+		if (devs.devices[i]->tag == normal->tag && sicm_numa_id(devs.devices[i]) == sicm_numa_id(normal) &&
+		    sicm_device_page_size(devs.devices[i]) > sicm_device_page_size(normal)) {
+			huge = devs.devices[i];
+			break;
+		}
+	}
+
+	if (huge == NULL) {
+		printf("no huge page device, skipping\n");
+		return 0;
+	}
+
+	arena = sicm_arena_create(0, 0, &(sicm_device_list) { .count = 1, .devices = &huge });
+	if (arena == NULL) {
+		fprintf(stderr, "sicm_arena_create failed\n");
+		return 1;
+	}
+
+	for(i = 0; i < N; i++) {
+		bufs[i] = sicm_arena_alloc(arena, SIZE);
+		if (bufs[i] == NULL) {
+			fprintf(stderr, "allocation %d failed\n", i);
+			return 1;
+		}
+
+		for(j = 0; j < SIZE; j += 4096)
+			bufs[i][j] = (char) (i + j / 4096);
+	}
+
+	// the arena's memory is in huge page aligned regions, so this always works
+	err = sicm_arena_set_device(arena, normal);
+	if (err != 0) {
+		fprintf(stderr, "moving to normal pages failed: %d\n", err);
+		return 1;
+	}
+
+	if (check(bufs, "after moving to normal pages"))
+		return 1;
+
+	for(i = 0; i < N; i++) {
+		if (sicm_arena_lookup(bufs[i]) != arena) {
+			fprintf(stderr, "buffer %d left the arena\n", i);
+			return 1;
+		}
+	}
+
+	// this can fail if there are no free huge pages, but the data has to stay intact either way
+	err = sicm_arena_set_device(arena, huge);
+	if (check(bufs, err?"after failing to move back to huge pages":"after moving back to huge pages"))
+		return 1;
+
+	for(i = 0; i < N; i++)
+		sicm_free(bufs[i]);
+
+	sicm_arena_destroy(arena);
+
+	// big extents of normal pages are aligned to huge pages, so they can move onto them too
+	arena = sicm_arena_create(0, 0, &(sicm_device_list) { .count = 1, .devices = &normal });
+	if (arena == NULL) {
+		fprintf(stderr, "sicm_arena_create failed\n");
+		return 1;
+	}
+
+	for(i = 0; i < N; i++) {
+		bufs[i] = sicm_arena_alloc(arena, BIG);
+		if (bufs[i] == NULL) {
+			fprintf(stderr, "big allocation %d failed\n", i);
+			return 1;
+		}
+
+		for(j = 0; j < SIZE; j += 4096)
+			bufs[i][j] = (char) (i + j / 4096);
+	}
+
+	err = sicm_arena_set_device(arena, huge);
+	if (check(bufs, err?"after failing to move to huge pages":"after moving to huge pages"))
+		return 1;
+
+	for(i = 0; i < N; i++)
+		sicm_free(bufs[i]);
+
+	sicm_arena_destroy(arena);
+	sicm_fini();
+	return 0;
+}
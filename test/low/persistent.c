@@ -0,0 +1,116 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <sicm_low.h>
+
+#define MAXSIZE (64 * 1024 * 1024)
+#define N 1024
+
+struct table {
+	size_t count;
+	size_t values[N];
+};
+
+// the first run builds the table and exits
+static int build(const char *path) {
+	sicm_device_list devs = sicm_init();
+	sicm_arena arena;
+	struct table *t;
+	size_t i;
+
+	arena = sicm_arena_open_persistent(path, MAXSIZE, 0, &(sicm_device_list) { .count = 1, .devices = &devs.devices[0] });
+	if (arena == NULL) {
+		fprintf(stderr, "sicm_arena_open_persistent failed\n");
+		return 1;
+	}
+
+	t = sicm_arena_alloc(arena, sizeof(struct table));
+	if (t == NULL) {
+		fprintf(stderr, "sicm_arena_alloc failed\n");
+		return 1;
+	}
+
+	t->count = N;
+	for(i = 0; i < N; i++)
+		t->values[i] = i * i;
+
+	if (sicm_arena_set_root(arena, t) != 0) {
+		fprintf(stderr, "sicm_arena_set_root failed\n");
+		return 1;
+	}
+
+	sicm_arena_detach(arena);
+	sicm_fini();
+	return 0;
+}
+
+int main() {
+	char path[] = "/tmp/sicm_persistent_XXXXXX";
+	sicm_arena arena;
+	struct table *t;
+	void *more;
+	int fd, status;
+	size_t i;
+	pid_t pid;
+
+	fd = mkstemp(path);
+	if (fd < 0)
+		return 1;
+	close(fd);
+
+	pid = fork();
+	if (pid == 0)
+		exit(build(path));
+
+	if (waitpid(pid, &status, 0) != pid || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+		fprintf(stderr, "building the table failed\n");
+		unlink(path);
+		return 1;
+	}
+
+	// the second run finds the table where the first one left it
+	sicm_init();
+	arena = sicm_arena_open_persistent(path, 0, 0, NULL);
+	if (arena == NULL) {
+		fprintf(stderr, "reopening the arena failed\n");
+		unlink(path);
+		return 1;
+	}
+
+	t = sicm_arena_get_root(arena);
+	if (t == NULL || t->count != N) {
+		fprintf(stderr, "the table is gone\n");
+		unlink(path);
+		return 1;
+	}
+
+	for(i = 0; i < N; i++) {
+		if (t->values[i] != i * i) {
+			fprintf(stderr, "the table is corrupted\n");
+			unlink(path);
+			return 1;
+		}
+	}
+
+	// new objects don't overwrite the old ones
+	more = sicm_arena_alloc(arena, sizeof(struct table));
+	if (more == NULL || ((char *) more < (char *) (t + 1) && (char *) t < (char *) more + sizeof(struct table))) {
+		fprintf(stderr, "new allocation overlaps the table\n");
+		unlink(path);
+		return 1;
+	}
+	memset(more, 0xff, sizeof(struct table));
+	sicm_free(more);
+
+	if (sicm_arena_detach(arena) != 0) {
+		fprintf(stderr, "wrong number of attached processes\n");
+		unlink(path);
+		return 1;
+	}
+
+	unlink(path);
+	sicm_fini();
+	return 0;
+}
@@ -0,0 +1,61 @@
+#include <stdio.h>
+#include <string.h>
+#include <sicm_low.h>
+
+#define SMALL 64
+#define LARGE (1024 * 1024)
+
+int main() {
+	sicm_device_list devs = sicm_init();
+	sicm_arena arena;
+	char *p, *q;
+	size_t sz;
+	int i;
+
+	arena = sicm_arena_create(0, 0, &(sicm_device_list) { .count = 1, .devices = &devs.devices[0] });
+	if (arena == NULL) {
+		fprintf(stderr, "sicm_arena_create failed\n");
+		return 1;
+	}
+
+	p = sicm_arena_alloc(arena, SMALL);
+	memset(p, 7, SMALL);
+
+	// growing an object must not move it out of its arena
+	q = sicm_realloc(p, LARGE);
+	if (q == NULL || sicm_arena_lookup(q) != arena) {
+		fprintf(stderr, "sicm_realloc moved the object out of its arena\n");
+		return 1;
+	}
+
+	for(i = 0; i < SMALL; i++) {
+		if (q[i] != 7) {
+			fprintf(stderr, "sicm_realloc lost the contents\n");
+			return 1;
+		}
+	}
+
+	// shrinking in place always works
+	sz = sicm_arena_realloc_in_place(arena, q, LARGE / 2);
+	if (sz < LARGE / 2 || sicm_arena_lookup(q) != arena || q[0] != 7) {
+		fprintf(stderr, "sicm_arena_realloc_in_place failed: %zu\n", sz);
+		return 1;
+	}
+	sicm_free_sized(q, sz);
+
+	p = sicm_arena_alloc(arena, SMALL);
+	sicm_arena_free_sized(arena, p, SMALL);
+
+	// pointers that aren't from an arena work too
+	p = sicm_realloc(NULL, SMALL);
+	p = sicm_realloc(p, LARGE);
+	if (p == NULL) {
+		fprintf(stderr, "sicm_realloc without an arena failed\n");
+		return 1;
+	}
+	sicm_free_sized(p, LARGE);
+
+	sicm_arena_destroy(arena);
+	sicm_fini();
+	return 0;
+}
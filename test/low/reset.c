@@ -0,0 +1,53 @@
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <sicm_low.h>
+
+#define N 512
+#define STEPS 4
+
+int main() {
+	sicm_device_list devs = sicm_init();
+	sicm_arena arena;
+	char *bufs[N];
+	size_t size;
+	int i, step;
+
+	arena = sicm_arena_create(0, SICM_ARENA_TCACHE, &(sicm_device_list) { .count = 1, .devices = &devs.devices[0] });
+	if (arena == NULL) {
+		fprintf(stderr, "sicm_arena_create failed\n");
+		return 1;
+	}
+
+	// scratch objects of every step are thrown away together
+	for(step = 0; step < STEPS; step++) {
+		for(i = 0; i < N; i++) {
+			size = (i % 2)?64:(32 * 1024);
+			bufs[i] = sicm_arena_alloc(arena, size);
+			if (bufs[i] == NULL || sicm_arena_lookup(bufs[i]) != arena) {
+				fprintf(stderr, "step %d: allocation %d failed\n", step, i);
+				return 1;
+			}
+			memset(bufs[i], step, size);
+		}
+
+		// some are freed as usual, the reset has to cope with that
+		for(i = 0; i < N; i += 7) {
+			sicm_free(bufs[i]);
+		}
+
+		if (sicm_arena_reset(arena, step < STEPS - 1) != 0) {
+			fprintf(stderr, "step %d: sicm_arena_reset failed\n", step);
+			return 1;
+		}
+	}
+
+	if (sicm_arena_reset(NULL, 0) != -EINVAL) {
+		fprintf(stderr, "resetting the default arena worked\n");
+		return 1;
+	}
+
+	sicm_arena_destroy(arena);
+	sicm_fini();
+	return 0;
+}
@@ -0,0 +1,131 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <sicm_low.h>
+
+#define MAXSIZE (64 * 1024 * 1024)
+#define SIZE (1024 * 1024)
+
+static int check(char *buf, char c, const char *what) {
+	size_t i;
+
+	for(i = 0; i < SIZE; i += 4096) {
+		if (buf[i] != c) {
+			fprintf(stderr, "%s is corrupted\n", what);
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+// attaches to the parent's arena, reads its table and leaves one behind
+static int child(int fd, int in, int out) {
+	sicm_arena arena;
+	char *table, *buf;
+
+	sicm_init();
+	if (read(in, &table, sizeof(table)) != sizeof(table))
+		return 1;
+
+	arena = sicm_arena_attach_shared(fd);
+	if (arena == NULL) {
+		fprintf(stderr, "sicm_arena_attach_shared failed\n");
+		return 1;
+	}
+
+	if (check(table, 1, "the parent's table"))
+		return 1;
+
+	buf = sicm_arena_alloc(arena, SIZE);
+	if (buf == NULL || (buf < table + SIZE && table < buf + SIZE)) {
+		fprintf(stderr, "the child's allocation overlaps the parent's\n");
+		return 1;
+	}
+	memset(buf, 2, SIZE);
+
+	if (write(out, &buf, sizeof(buf)) != sizeof(buf))
+		return 1;
+
+	// the parent is still attached
+	if (sicm_arena_detach(arena) != 1) {
+		fprintf(stderr, "wrong number of attached processes\n");
+		return 1;
+	}
+
+	sicm_fini();
+	return 0;
+}
+
+int main() {
+	char path[] = "/dev/shm/sicm_shared_XXXXXX";
+	int fd, down[2], up[2], status;
+	sicm_device_list devs;
+	sicm_device *dev;
+	sicm_arena arena;
+	char *table, *buf;
+	pid_t pid;
+
+	fd = mkstemp(path);
+	if (fd < 0) {
+		printf("no /dev/shm, skipping\n");
+		return 0;
+	}
+	unlink(path);
+
+	if (pipe(down) != 0 || pipe(up) != 0)
+		return 1;
+
+	pid = fork();
+	if (pid == 0)
+		exit(child(fd, down[0], up[1]));
+
+	devs = sicm_init();
+	dev = devs.devices[0];
+	arena = sicm_arena_create_shared(MAXSIZE, 0, &(sicm_device_list) { .count = 1, .devices = &dev }, fd);
+	if (arena == NULL) {
+		fprintf(stderr, "sicm_arena_create_shared failed\n");
+		return 1;
+	}
+
+	table = sicm_arena_alloc(arena, SIZE);
+	if (table == NULL) {
+		fprintf(stderr, "sicm_arena_alloc failed\n");
+		return 1;
+	}
+	memset(table, 1, SIZE);
+
+	if (write(down[1], &table, sizeof(table)) != sizeof(table))
+		return 1;
+
+	if (read(up[0], &buf, sizeof(buf)) != sizeof(buf)) {
+		fprintf(stderr, "the child failed\n");
+		return 1;
+	}
+
+	if (waitpid(pid, &status, 0) != pid || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+		fprintf(stderr, "the child failed\n");
+		return 1;
+	}
+
+	// both tables are still there after the child is gone
+	if (check(table, 1, "the table") || check(buf, 2, "the child's table"))
+		return 1;
+
+	// the size limit holds across processes
+	if (sicm_arena_alloc(arena, MAXSIZE) != NULL) {
+		fprintf(stderr, "allocation over the arena's size succeeded\n");
+		return 1;
+	}
+
+	sicm_free(table);
+	if (sicm_arena_detach(arena) != 0) {
+		fprintf(stderr, "wrong number of attached processes\n");
+		return 1;
+	}
+
+	sicm_fini();
+	return 0;
+}
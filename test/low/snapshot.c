@@ -0,0 +1,55 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <sicm_low.h>
+
+int main() {
+	sicm_device_list devs = sicm_init();
+	sicm_device_snapshot *snap;
+	size_t count, i;
+
+	count = sicm_devices_snapshot(NULL, 0);
+	if (count != devs.count) {
+		fprintf(stderr, "snapshot has %zu devices, sicm_init found %u\n", count, devs.count);
+		return 1;
+	}
+
+	snap = malloc(count * sizeof(sicm_device_snapshot));
+	if (snap == NULL)
+		return 1;
+
+	// a long interval, so that the lookups below see the same snapshot
+	sicm_set_snapshot_interval(60 * 1000);
+	sicm_devices_snapshot(snap, count);
+
+	for(i = 0; i < count; i++) {
+		if (snap[i].device != devs.devices[i]) {
+			fprintf(stderr, "device %zu is out of order\n", i);
+			return 1;
+		}
+		if (snap[i].capacity != sicm_capacity(devs.devices[i]) || snap[i].avail != sicm_avail(devs.devices[i])) {
+			fprintf(stderr, "device %zu: lookups don't match the snapshot\n", i);
+			return 1;
+		}
+		if (snap[i].capacity == (size_t) -1)
+			continue;
+		if (snap[i].avail > snap[i].capacity) {
+			fprintf(stderr, "device %zu: %zu kB available out of %zu kB\n", i, snap[i].avail, snap[i].capacity);
+			return 1;
+		}
+		if (sicm_device_page_size(devs.devices[i]) == sicm_device_page_size(devs.devices[0]) && snap[i].mem_total == 0) {
+			fprintf(stderr, "device %zu: meminfo wasn't read\n", i);
+			return 1;
+		}
+	}
+
+	// reads again every time
+	sicm_set_snapshot_interval(0);
+	if (count > 0 && sicm_capacity(devs.devices[0]) != snap[0].capacity) {
+		fprintf(stderr, "capacity changed\n");
+		return 1;
+	}
+
+	free(snap);
+	sicm_fini();
+	return 0;
+}
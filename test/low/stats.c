@@ -0,0 +1,64 @@
+#include <stdio.h>
+#include <string.h>
+#include <sicm_low.h>
+
+#define SIZE (8 * 1024 * 1024)
+#define NODES 64
+
+int main() {
+	sicm_device_list devs = sicm_init();
+	sicm_device *dev;
+	sicm_arena arena;
+	struct sicm_arena_stats stats;
+	size_t resident[NODES], total;
+	char *buf;
+	int i;
+
+	dev = devs.devices[0];
+	arena = sicm_arena_create(0, 0, &(sicm_device_list) { .count = 1, .devices = &dev });
+	if (arena == NULL) {
+		fprintf(stderr, "sicm_arena_create failed\n");
+		return 1;
+	}
+
+	buf = sicm_arena_alloc(arena, SIZE);
+	if (buf == NULL) {
+		fprintf(stderr, "sicm_arena_alloc failed\n");
+		return 1;
+	}
+	memset(buf, 1, SIZE);
+
+	// without somewhere to put them, the nodes aren't looked up
+	stats.resident = NULL;
+	stats.nodes = 0;
+	if (sicm_arena_stats(arena, &stats) != 0 || stats.mapped != sicm_arena_size(arena) || stats.mapped < SIZE) {
+		fprintf(stderr, "sicm_arena_stats says %zu bytes are mapped, sicm_arena_size %zu\n", stats.mapped, sicm_arena_size(arena));
+		return 1;
+	}
+
+	stats.resident = resident;
+	stats.nodes = NODES;
+	if (sicm_arena_stats(arena, &stats) != 0) {
+		fprintf(stderr, "sicm_arena_stats failed\n");
+		return 1;
+	}
+
+	total = 0;
+	for(i = 0; i < NODES; i++)
+		total += resident[i];
+
+	if (total < SIZE || total > stats.mapped) {
+		fprintf(stderr, "%zu bytes resident, %d written, %zu mapped\n", total, SIZE, stats.mapped);
+		return 1;
+	}
+
+	if (sicm_numa_id(dev) < NODES && resident[sicm_numa_id(dev)] != total) {
+		fprintf(stderr, "only %zu of %zu resident bytes are on the arena's node\n", resident[sicm_numa_id(dev)], total);
+		return 1;
+	}
+
+	sicm_free(buf);
+	sicm_arena_destroy(arena);
+	sicm_fini();
+	return 0;
+}
@@ -0,0 +1,93 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <sicm_low.h>
+
+#define THREADS 8
+#define COUNT 1000
+
+static sicm_arena arena;
+
+static void *worker(void *arg) {
+	void *ptrs[COUNT];
+	size_t i;
+
+	for(i = 0; i < COUNT; i++) {
+		ptrs[i] = sicm_arena_alloc(arena, 16 + (i % 8) * 16);
+		if (ptrs[i] == NULL)
+			return (void *) 1;
+		memset(ptrs[i], 0xff, 16);
+	}
+
+	for(i = 0; i < COUNT; i++) {
+		if (sicm_arena_lookup(ptrs[i]) != arena)
+			return (void *) 1;
+	}
+
+	// leave half of the objects allocated, the arena is destroyed with them
+	for(i = 0; i < COUNT; i += 2)
+		sicm_free(ptrs[i]);
+
+	return NULL;
+}
+
+static int run_threads() {
+	pthread_t threads[THREADS];
+	void *ret;
+	int i, err;
+
+	err = 0;
+	for(i = 0; i < THREADS; i++)
+		pthread_create(&threads[i], NULL, worker, NULL);
+
+	for(i = 0; i < THREADS; i++) {
+		pthread_join(threads[i], &ret);
+		if (ret != NULL)
+			err = 1;
+	}
+
+	return err;
+}
+
+int main() {
+	sicm_device_list devs = sicm_init();
+	sicm_device_list ds = {
+		.count = 1,
+		.devices = &devs.devices[0],
+	};
+	int round;
+	void *ptr;
+
+	// destroy and recreate so that arena indices and tcache slots get reused
+	for(round = 0; round < 3; round++) {
+		arena = sicm_arena_create(0, SICM_ARENA_TCACHE, &ds);
+		if (arena == NULL) {
+			fprintf(stderr, "sicm_arena_create failed\n");
+			return 1;
+		}
+
+		// objects cached by this thread have to be flushed when the arena moves
+		ptr = sicm_arena_alloc(arena, 32);
+		sicm_free(ptr);
+		if (sicm_arena_set_device_list(arena, &ds) != 0) {
+			fprintf(stderr, "sicm_arena_set_device_list failed\n");
+			return 1;
+		}
+
+		if (run_threads() != 0) {
+			fprintf(stderr, "worker threads failed in round %d\n", round);
+			return 1;
+		}
+
+		ptr = sicm_arena_alloc(arena, 32);
+		if (sicm_arena_lookup(ptr) != arena) {
+			fprintf(stderr, "allocation not in arena after set_device_list\n");
+			return 1;
+		}
+
+		sicm_arena_destroy(arena);
+	}
+
+	sicm_fini();
+	return 0;
+}
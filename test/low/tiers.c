@@ -0,0 +1,52 @@
+#include <stdio.h>
+#include <string.h>
+#include <sicm_low.h>
+
+int main() {
+	sicm_device_list devs = sicm_init();
+	sicm_device_perf perf, first;
+	unsigned int i, j;
+	int fastest, near;
+
+	fastest = -1;
+	near = 0;
+	for(i = 0; i < devs.count; i++) {
+		if (devs.devices[i]->tag == SICM_HIP)
+			continue;
+
+		if (sicm_get_device_perf(devs.devices[i], &perf) != 0 || perf.tier < 0) {
+			fprintf(stderr, "device %u has no tier\n", i);
+			return 1;
+		}
+		if (perf.tier != sicm_device_tier(devs.devices[i])) {
+			fprintf(stderr, "device %u: sicm_device_tier doesn't match\n", i);
+			return 1;
+		}
+		if (fastest < 0 || perf.tier < fastest)
+			fastest = perf.tier;
+		near |= sicm_is_near(devs.devices[i]);
+
+		// every page size of a node is the same memory
+		for(j = 0; j < i; j++) {
+			if (sicm_numa_id(devs.devices[j]) != sicm_numa_id(devs.devices[i]))
+				continue;
+			sicm_get_device_perf(devs.devices[j], &first);
+			if (memcmp(&first, &perf, sizeof(perf)) != 0) {
+				fprintf(stderr, "devices %u and %u are on the same node but differ\n", j, i);
+				return 1;
+			}
+		}
+	}
+
+	if (fastest > 0) {
+		fprintf(stderr, "no device is in the fastest tier\n");
+		return 1;
+	}
+	if (fastest == 0 && !near) {
+		fprintf(stderr, "no device is near\n");
+		return 1;
+	}
+
+	sicm_fini();
+	return 0;
+}